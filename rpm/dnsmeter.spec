@@ -75,6 +75,7 @@ rm -rf $RPM_BUILD_ROOT
 %files
 %defattr(-,root,root)
 %{_bindir}/dnsmeter
+%{_bindir}/dnsmeter-responder
 %{_datadir}/doc/*
 %{_mandir}/man1/*
 
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "agent_link.h"
+#include "exceptions.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+AgentLink::AgentLink()
+{
+    sd       = -1;
+    buffered = 0;
+    buffer   = (char*)malloc(MAX_LINE);
+    if (!buffer)
+        throw ppl7::OutOfMemoryException();
+}
+
+AgentLink::~AgentLink()
+{
+    close();
+    free(buffer);
+}
+
+/*
+ * Accepts PORT, HOST:PORT and [IPv6]:PORT. Without a host the loopback
+ * address is used, other interfaces have to be given explicitly.
+ */
+socklen_t AgentLink::resolve(const ppl7::String& address, struct sockaddr_storage& addr)
+{
+    ppl7::String Host;
+    ppl7::String Port;
+    ppl7::Array  matches;
+    if (address.pregMatch("/^\\[(.+)\\]:([0-9]+)$/", matches)) {
+        Host = matches[1];
+        Port = matches[2];
+    } else if (address.pregMatch("/^([^:]+):([0-9]+)$/", matches)) {
+        Host = matches[1];
+        Port = matches[2];
+    } else if (address.pregMatch("/^[0-9]+$/")) {
+        Port = address;
+    } else {
+        throw InvalidCommandlineParameter("invalid agent address, expected [HOST:]PORT: %s", (const char*)address);
+    }
+    int port = Port.toInt();
+    if (port < 1 || port > 65535)
+        throw InvalidCommandlineParameter("invalid agent port: %s", (const char*)address);
+    memset(&addr, 0, sizeof(addr));
+    if (Host.isEmpty()) {
+        struct sockaddr_in* a = (struct sockaddr_in*)&addr;
+        a->sin_family         = AF_INET;
+        a->sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+        a->sin_port           = htons(port);
+        return sizeof(struct sockaddr_in);
+    }
+    std::list<ppl7::IPAddress> Result;
+    if (!ppl7::GetHostByName(Host, Result, ppl7::af_unspec))
+        throw InvalidCommandlineParameter("could not resolve agent address: %s", (const char*)Host);
+    const ppl7::IPAddress& ip = Result.front();
+    if (ip.family() == ppl7::IPAddress::IPv6) {
+        ip.toSockAddr(&addr, sizeof(struct sockaddr_in6));
+        ((struct sockaddr_in6*)&addr)->sin6_port = htons(port);
+        return sizeof(struct sockaddr_in6);
+    }
+    ip.toSockAddr(&addr, sizeof(struct sockaddr_in));
+    ((struct sockaddr_in*)&addr)->sin_port = htons(port);
+    return sizeof(struct sockaddr_in);
+}
+
+void AgentLink::listen(const ppl7::String& address)
+{
+    struct sockaddr_storage addr;
+    socklen_t               addrlen = resolve(address, addr);
+    close();
+    sd = ::socket(addr.ss_family, SOCK_STREAM, 0);
+    if (sd < 0)
+        ppl7::throwExceptionFromErrno(errno, "Could not create agent socket");
+    int on = 1;
+    setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(sd, (const struct sockaddr*)&addr, addrlen) < 0 || ::listen(sd, 1) < 0) {
+        int e = errno;
+        close();
+        ppl7::throwExceptionFromErrno(e, ppl7::String("Could not listen on ") + address);
+    }
+    Name = address;
+}
+
+/*
+ * Returns false if no coordinator connected within timeout_ms milliseconds.
+ */
+bool AgentLink::accept(AgentLink& client, int timeout_ms)
+{
+    struct pollfd pfd;
+    pfd.fd     = sd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeout_ms) <= 0)
+        return false;
+    struct sockaddr_storage addr;
+    socklen_t               addrlen = sizeof(addr);
+    int                     c       = ::accept(sd, (struct sockaddr*)&addr, &addrlen);
+    if (c < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == ECONNABORTED)
+            return false;
+        ppl7::throwExceptionFromErrno(errno, "accept failed");
+    }
+    client.close();
+    client.sd = c;
+    int on    = 1;
+    setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    ppl7::SockAddr sa(&addr, addrlen);
+    client.Name.setf("%s:%d", (const char*)sa.toIPAddress().toString(), sa.port());
+    return true;
+}
+
+void AgentLink::connect(const ppl7::String& address)
+{
+    struct sockaddr_storage addr;
+    socklen_t               addrlen = resolve(address, addr);
+    close();
+    sd = ::socket(addr.ss_family, SOCK_STREAM, 0);
+    if (sd < 0)
+        ppl7::throwExceptionFromErrno(errno, "Could not create agent socket");
+    if (::connect(sd, (const struct sockaddr*)&addr, addrlen) < 0) {
+        int e = errno;
+        close();
+        ppl7::throwExceptionFromErrno(e, ppl7::String("Could not connect to agent ") + address);
+    }
+    int on = 1;
+    setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    Name = address;
+}
+
+void AgentLink::close()
+{
+    if (sd >= 0)
+        ::close(sd);
+    sd       = -1;
+    buffered = 0;
+}
+
+bool AgentLink::isOpen() const
+{
+    return sd >= 0;
+}
+
+int AgentLink::socket() const
+{
+    return sd;
+}
+
+const ppl7::String& AgentLink::name() const
+{
+    return Name;
+}
+
+void AgentLink::sendLine(const ppl7::String& line)
+{
+    ppl7::String data = line;
+    data.append("\n");
+    const char* ptr  = (const char*)data;
+    size_t      left = data.size();
+    while (left) {
+        ssize_t n = ::send(sd, ptr, left, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            ppl7::throwExceptionFromErrno(errno, ppl7::String("Could not send to ") + Name);
+        }
+        ptr += n;
+        left -= n;
+    }
+}
+
+/*
+ * Returns false if no complete line arrived within timeout_ms
+ * milliseconds. A closed connection is an error.
+ */
+bool AgentLink::readLine(ppl7::String& line, int timeout_ms)
+{
+    while (1) {
+        char* nl = (char*)memchr(buffer, '\n', buffered);
+        if (nl) {
+            size_t len = nl - buffer;
+            line.set(buffer, len);
+            buffered -= len + 1;
+            memmove(buffer, nl + 1, buffered);
+            return true;
+        }
+        if (buffered == MAX_LINE)
+            throw AgentProtocolError("line from %s is too long", (const char*)Name);
+        struct pollfd pfd;
+        pfd.fd     = sd;
+        pfd.events = POLLIN;
+        int ret    = poll(&pfd, 1, timeout_ms);
+        if (ret == 0)
+            return false;
+        if (ret < 0) {
+            if (errno == EINTR)
+                return false;
+            ppl7::throwExceptionFromErrno(errno, "poll failed");
+        }
+        ssize_t n = ::recv(sd, buffer + buffered, MAX_LINE - buffered, 0);
+        if (n == 0)
+            throw AgentProtocolError("connection closed by %s", (const char*)Name);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            ppl7::throwExceptionFromErrno(errno, ppl7::String("Could not read from ") + Name);
+        }
+        buffered += n;
+    }
+}
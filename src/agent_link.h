@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ppl7.h>
+#include <ppl7-inet.h>
+#include <sys/socket.h>
+
+#ifndef __dnsmeter_agent_link_h
+#define __dnsmeter_agent_link_h
+
+/*
+ * Line based TCP connection between the coordinator and an agent.
+ *
+ * The coordinator authenticates with "AUTH <secret>" and sends the
+ * command line of the agents ("ARG" lines followed by "END"), the agent
+ * answers with "READY" or "ERROR". Every
+ * load step is started with "STEP <index> <rate> <outstanding> <start>",
+ * where start is the wall clock time in seconds at which all agents start
+ * sending. During the step the agent sends a "STAT" line with its
+ * cumulated results once per second and a "RESULT" line at the end.
+ * "QUIT" ends the session.
+ */
+class AgentLink {
+private:
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || __cplusplus >= 201103L
+    AgentLink& operator=(const AgentLink& other);
+    AgentLink(AgentLink &&other) noexcept;
+    AgentLink const & operator=(AgentLink &&other);
+#endif
+
+    enum {
+        MAX_LINE = 65536
+    };
+
+    int          sd;
+    char*        buffer;
+    size_t       buffered;
+    ppl7::String Name;
+
+    static socklen_t resolve(const ppl7::String& address, struct sockaddr_storage& addr);
+
+public:
+    AgentLink();
+    ~AgentLink();
+    void listen(const ppl7::String& address);
+    bool accept(AgentLink& client, int timeout_ms);
+    void connect(const ppl7::String& address);
+    void close();
+    bool isOpen() const;
+    int  socket() const;
+    void sendLine(const ppl7::String& line);
+    bool readLine(ppl7::String& line, int timeout_ms);
+    const ppl7::String& name() const;
+};
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "alias_table.h"
+
+AliasTable::AliasTable()
+{
+}
+
+/*
+ * Builds the table from relative weights, which do not need to be
+ * normalized. Throws InvalidArgumentsException if there is no positive
+ * weight or the table would have more than 2^32 entries.
+ */
+void AliasTable::build(const std::vector<double>& weights)
+{
+    size_t n     = weights.size();
+    double total = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        if (weights[i] < 0.0)
+            throw ppl7::InvalidArgumentsException("negative weight");
+        total += weights[i];
+    }
+    if (n == 0 || n > 0xffffffffULL || total <= 0.0)
+        throw ppl7::InvalidArgumentsException();
+
+    // probabilities scaled so that the average entry is 1.0
+    std::vector<double> p(n);
+    std::vector<size_t> small, large;
+    for (size_t i = 0; i < n; i++) {
+        p[i] = weights[i] * n / total;
+        if (p[i] < 1.0)
+            small.push_back(i);
+        else
+            large.push_back(i);
+    }
+    threshold.assign(n, 0xffffffff);
+    alias.resize(n);
+    for (size_t i = 0; i < n; i++)
+        alias[i] = (unsigned int)i;
+    while (!small.empty() && !large.empty()) {
+        size_t s = small.back();
+        size_t l = large.back();
+        small.pop_back();
+        threshold[s] = (unsigned int)(p[s] * 4294967296.0);
+        alias[s]     = (unsigned int)l;
+        p[l]         = (p[l] + p[s]) - 1.0;
+        if (p[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // whatever is left over is 1.0 apart from rounding errors and keeps
+    // the threshold which always selects the entry itself
+}
+
+void AliasTable::clear()
+{
+    threshold.clear();
+    alias.clear();
+}
+
+bool AliasTable::empty() const
+{
+    return threshold.empty();
+}
+
+size_t AliasTable::size() const
+{
+    return threshold.size();
+}
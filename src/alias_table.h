@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fast_random.h"
+
+#include <ppl7.h>
+#include <vector>
+
+#ifndef __dnsmeter_alias_table_h
+#define __dnsmeter_alias_table_h
+
+/*
+ * Draws indexes from a discrete distribution in constant time
+ * (Walker's alias method, built with Vose's algorithm).
+ *
+ * Every index i has a threshold and an alias. One random number picks
+ * the index with its upper half and decides between the index and its
+ * alias with its lower half, so a draw is a multiplication, a compare
+ * and two table reads, independent of the number of entries.
+ */
+class AliasTable {
+private:
+    std::vector<unsigned int> threshold;
+    std::vector<unsigned int> alias;
+
+public:
+    AliasTable();
+    void   build(const std::vector<double>& weights);
+    void   clear();
+    bool   empty() const;
+    size_t size() const;
+
+    inline size_t sample(FastRandom& random) const
+    {
+        ppluint64    r = random.next();
+        unsigned int i = (unsigned int)(((r >> 32) * threshold.size()) >> 32);
+        return ((unsigned int)r < threshold[i]) ? i : alias[i];
+    }
+};
+
+#endif
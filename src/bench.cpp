@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "packet.h"
+#include "checksum.h"
+#include "query.h"
+#include "payload_file.h"
+#include "raw_socket_receiver.h"
+#include "target_list.h"
+#include "query_classes.h"
+#include "fast_random.h"
+
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * Micro-benchmarks of the routines on the send and receive path. Every
+ * benchmark runs several times for a fixed time and the fastest run is
+ * reported in ns/op and ops/s, one line per benchmark, so that the output
+ * of two builds can be compared with diff.
+ */
+
+typedef void (*bench_function)(ppluint64 iterations);
+
+static Packet*                                       pkt4;
+static Packet*                                       pkt6;
+static unsigned char                                 query_buffer[4096];
+static unsigned char                                 plain_query[4096];
+static int                                           plain_query_size;
+static ppl7::String                                  query_name("www.example.com A");
+static PayloadFile*                                  payload;
+static TargetList                                    targets;
+static QueryClasses                                  classes;
+static StepCounters<RawSocketReceiver::Counter>      receive_counter;
+static CounterBlock<QueryClassCounter>               class_counter;
+static unsigned char                                 response_frame[4096];
+static size_t                                        response_frame_size;
+static unsigned int                                  spoof_start;
+static unsigned char                                 spoof_net6[16];
+static FastRandom                                    random_generator;
+static int                                           payload_threads;
+static Checksum::Function                            checksum_function;
+static unsigned char                                 checksum_data[1232];
+static volatile size_t                               sink;
+
+static void bench_checksum_ipv4(ppluint64 iterations)
+{
+    for (ppluint64 i = 0; i < iterations; i++) {
+        pkt4->setDnsId((unsigned short)i);
+        sink += pkt4->ptr()[10];
+    }
+}
+
+static void bench_checksum_ipv6(ppluint64 iterations)
+{
+    for (ppluint64 i = 0; i < iterations; i++) {
+        pkt6->setDnsId((unsigned short)i);
+        sink += pkt6->ptr()[40];
+    }
+}
+
+// a payload of the maximum EDNS buffer size recommended for UDP
+static void bench_checksum_payload(ppluint64 iterations)
+{
+    for (ppluint64 i = 0; i < iterations; i++)
+        sink += checksum_function((unsigned int)i, checksum_data, sizeof(checksum_data));
+}
+
+static void bench_make_query(ppluint64 iterations)
+{
+    for (ppluint64 i = 0; i < iterations; i++)
+        sink += MakeQuery(query_name, query_buffer, sizeof(query_buffer), false);
+}
+
+static void bench_make_query_dnssec(ppluint64 iterations)
+{
+    for (ppluint64 i = 0; i < iterations; i++)
+        sink += MakeQuery(query_name, query_buffer, sizeof(query_buffer), true);
+}
+
+static void bench_add_dnssec(ppluint64 iterations)
+{
+    for (ppluint64 i = 0; i < iterations; i++) {
+        memcpy(query_buffer, plain_query, plain_query_size);
+        sink += AddDnssecToQuery(query_buffer, sizeof(query_buffer), plain_query_size);
+    }
+}
+
+static void bench_random_source_ipv4(ppluint64 iterations)
+{
+    for (ppluint64 i = 0; i < iterations; i++) {
+        pkt4->randomSourceIP(spoof_start, 65536);
+        pkt4->randomSourcePort();
+    }
+}
+
+static void bench_random_source_ipv6(ppluint64 iterations)
+{
+    for (ppluint64 i = 0; i < iterations; i++) {
+        pkt6->randomSourceIPv6(spoof_net6, 48);
+        pkt6->randomSourcePort();
+    }
+}
+
+static void bench_count_packet(ppluint64 iterations)
+{
+    RawSocketReceiver::Context ctx = { &targets, NULL, NULL, NULL };
+    for (ppluint64 i = 0; i < iterations; i++)
+        RawSocketReceiver::countPacket(ctx, receive_counter, response_frame, response_frame_size);
+}
+
+static void bench_count_packet_classes(ppluint64 iterations)
+{
+    RawSocketReceiver::Context ctx = { &targets, NULL, &classes, &class_counter };
+    for (ppluint64 i = 0; i < iterations; i++)
+        RawSocketReceiver::countPacket(ctx, receive_counter, response_frame, response_frame_size);
+}
+
+class PayloadThread : public ppl7::Thread {
+public:
+    ppluint64 iterations;
+
+    void run()
+    {
+        for (ppluint64 i = 0; i < iterations; i++)
+            sink += payload->getQuery().size();
+    }
+};
+
+/*
+ * Several threads share one payload file like the sender threads do, the
+ * result is the total throughput of all threads.
+ */
+static void bench_payload_get_query(ppluint64 iterations)
+{
+    ppl7::ThreadPool pool;
+    for (int i = 0; i < payload_threads; i++) {
+        PayloadThread* thread = new PayloadThread();
+        thread->iterations    = iterations / payload_threads;
+        pool.addThread(thread);
+    }
+    pool.startThreads();
+    pool.stopThreads();
+    pool.destroyAllThreads();
+}
+
+static void bench_payload_get_query_zipf(ppluint64 iterations)
+{
+    for (ppluint64 i = 0; i < iterations; i++)
+        sink += payload->getQuery(random_generator).size();
+}
+
+static void setup()
+{
+    pkt4 = new Packet();
+    pkt4->setSource(ppl7::IPAddress("192.0.2.10"), 40000);
+    pkt4->setDestination(ppl7::IPAddress("192.0.2.1"), 53);
+    pkt4->setPayloadDNSQuery(query_name);
+    pkt6 = new Packet();
+    pkt6->setSource(ppl7::IPAddress("2001:db8::10"), 40000);
+    pkt6->setDestination(ppl7::IPAddress("2001:db8::1"), 53);
+    pkt6->setPayloadDNSQuery(query_name);
+
+    plain_query_size = MakeQuery(query_name, plain_query, sizeof(plain_query), false);
+    spoof_start      = ntohl(*(const in_addr_t*)ppl7::IPAddress("10.0.0.0").addr());
+    memcpy(spoof_net6, ppl7::IPAddress("2001:db8::").addr(), sizeof(spoof_net6));
+
+    // a response of the target, as the receiver gets it from the interface
+    Packet response;
+    response.setSource(ppl7::IPAddress("192.0.2.1"), 53);
+    response.setDestination(ppl7::IPAddress("192.0.2.10"), 40000);
+    unsigned char answer[512];
+    int           size = MakeQuery(query_name, answer, sizeof(answer), true);
+    ((struct DNS_HEADER*)answer)->qr = 1;
+    response.setPayload(answer, size);
+    memset(response_frame, 0, 14);
+    response_frame[12] = 0x08;
+    memcpy(response_frame + 14, response.ptr(), response.size());
+    response_frame_size = 14 + response.size();
+    targets.parse("192.0.2.1:53");
+    targets.compile();
+    receive_counter.resize(1);
+    classes.setDefault();
+    for (size_t i = 0; i < sizeof(checksum_data); i++)
+        checksum_data[i] = (unsigned char)(i * 7);
+
+    char filename[] = "/tmp/dnsmeter-bench.XXXXXX";
+    int  fd         = mkstemp(filename);
+    if (fd < 0)
+        ppl7::throwExceptionFromErrno(errno, "Could not create payload file");
+    close(fd);
+    ppl7::File file(filename, ppl7::File::WRITE);
+    for (int i = 0; i < 10000; i++)
+        file.putsf("q%d.example.com %s\n", i, (i % 4) ? "A" : "AAAA");
+    file.close();
+    payload = new PayloadFile();
+    payload->openQueryFile(filename);
+    payload->setZipf(1.0);
+    unlink(filename);
+}
+
+/*
+ * Runs the benchmark for about the given time and returns the time per
+ * operation in seconds.
+ */
+static double measure(bench_function func, double seconds)
+{
+    ppluint64 iterations = 1000;
+    double    elapsed    = 0.0;
+    while (1) {
+        double start = ppl7::GetMicrotime();
+        func(iterations);
+        elapsed = ppl7::GetMicrotime() - start;
+        if (elapsed >= seconds)
+            break;
+        if (elapsed < seconds / 100.0)
+            iterations *= 10;
+        else
+            iterations = (ppluint64)((double)iterations * seconds * 1.1 / elapsed);
+    }
+    return elapsed / (double)iterations;
+}
+
+static void report(const ppl7::String& name, bench_function func, double seconds, int runs)
+{
+    double best = 0.0;
+    for (int r = 0; r < runs; r++) {
+        double t = measure(func, seconds);
+        if (r == 0 || t < best)
+            best = t;
+    }
+    printf("%-32s %10.2f ns/op %14.0f ops/s\n", (const char*)name, best * 1e9, 1.0 / best);
+    fflush(stdout);
+}
+
+static void help()
+{
+    ppl7::String name, underline;
+    name.setf("dnsmeter-bench %s", PACKAGE_VERSION);
+    underline.repeat("=", name.size());
+    name.printnl();
+    underline.printnl();
+    printf("\nUsage:\n"
+           "  -h            shows this help\n"
+           "  -t #          time of one run in seconds (default=0.5)\n"
+           "  -r #          number of runs per benchmark, the fastest is reported\n"
+           "                (default=3)\n"
+           "  -b NAME       run only the benchmarks whose name contains NAME\n"
+           "\n");
+}
+
+int main(int argc, char** argv)
+{
+    if (ppl7::HaveArgv(argc, argv, "-h") || ppl7::HaveArgv(argc, argv, "--help")) {
+        help();
+        return 0;
+    }
+    double       seconds = 0.5;
+    int          runs    = 3;
+    ppl7::String filter  = ppl7::GetArgv(argc, argv, "-b");
+    if (ppl7::HaveArgv(argc, argv, "-t"))
+        seconds = ppl7::GetArgv(argc, argv, "-t").toDouble();
+    if (ppl7::HaveArgv(argc, argv, "-r"))
+        runs = ppl7::GetArgv(argc, argv, "-r").toInt();
+    if (seconds <= 0.0 || runs < 1) {
+        help();
+        return 1;
+    }
+
+    static const struct {
+        const char*    name;
+        bench_function func;
+    } benchmarks[] = {
+        { "checksum_ipv4", bench_checksum_ipv4 },
+        { "checksum_ipv6", bench_checksum_ipv6 },
+        { "make_query", bench_make_query },
+        { "make_query_dnssec", bench_make_query_dnssec },
+        { "add_dnssec_to_query", bench_add_dnssec },
+        { "random_source_ipv4", bench_random_source_ipv4 },
+        { "random_source_ipv6", bench_random_source_ipv6 },
+        { "count_packet", bench_count_packet },
+        { "count_packet_classes", bench_count_packet_classes },
+        { "payload_get_query_zipf", bench_payload_get_query_zipf },
+        { NULL, NULL }
+    };
+    static const int thread_counts[] = { 1, 2, 4, 8, 16, 32, 64, 0 };
+
+    try {
+        // the payload file prints some information while loading
+        setup();
+        printf("# dnsmeter-bench %s, %0.2f seconds per run, best of %d runs\n", PACKAGE_VERSION, seconds, runs);
+        for (int i = 0; benchmarks[i].name; i++) {
+            if (filter.notEmpty() && ppl7::String(benchmarks[i].name).instr(filter) < 0)
+                continue;
+            report(benchmarks[i].name, benchmarks[i].func, seconds, runs);
+        }
+        for (int i = 0; i < Checksum::IMPLEMENTATIONS; i++) {
+            ppl7::String name;
+            name.setf("checksum_1232b_%s", Checksum::name((Checksum::Implementation)i));
+            checksum_function = Checksum::get((Checksum::Implementation)i);
+            if (!checksum_function || (filter.notEmpty() && name.instr(filter) < 0))
+                continue;
+            report(name, bench_checksum_payload, seconds, runs);
+        }
+        for (int i = 0; thread_counts[i]; i++) {
+            ppl7::String name;
+            name.setf("payload_get_query_%dt", thread_counts[i]);
+            if (filter.notEmpty() && name.instr(filter) < 0)
+                continue;
+            payload_threads = thread_counts[i];
+            report(name, bench_payload_get_query, seconds, runs);
+        }
+    } catch (const ppl7::Exception& e) {
+        e.print();
+        return 1;
+    }
+    return 0;
+}
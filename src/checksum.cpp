@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "checksum.h"
+
+#if (defined(__i386__) || defined(__x86_64__)) && defined(__GNUC__)
+#define DNSMETER_CHECKSUM_X86 1
+#include <immintrin.h>
+#endif
+
+Checksum::Function Checksum::function = Checksum::resolve;
+
+unsigned int Checksum::scalar(unsigned int sum, const void* data, size_t len)
+{
+    const unsigned short* w = (const unsigned short*)data;
+    while (len > 1) {
+        sum += *w++;
+        len -= 2;
+    }
+    if (len) {
+        unsigned short last      = 0;
+        *(unsigned char*)(&last) = *(const unsigned char*)w;
+        sum += last;
+    }
+    return sum;
+}
+
+#ifdef DNSMETER_CHECKSUM_X86
+/*
+ * The vector kernels split every 32 bit lane into its low and high word
+ * and add both to 32 bit accumulators, which is the same as adding up the
+ * 16 bit words one by one. The tail is left to the scalar loop, which
+ * starts at an even offset, so odd lengths are padded the same way.
+ * Loads are unaligned, the data can start at any address.
+ */
+__attribute__((target("sse2"))) static unsigned int cksum_sse2(unsigned int sum, const void* data, size_t len)
+{
+    const unsigned char* p    = (const unsigned char*)data;
+    const __m128i        mask = _mm_set1_epi32(0xffff);
+    __m128i              acc1 = _mm_setzero_si128();
+    __m128i              acc2 = _mm_setzero_si128();
+    while (len >= 32) {
+        __m128i v1 = _mm_loadu_si128((const __m128i*)p);
+        __m128i v2 = _mm_loadu_si128((const __m128i*)(p + 16));
+        acc1       = _mm_add_epi32(acc1, _mm_and_si128(v1, mask));
+        acc2       = _mm_add_epi32(acc2, _mm_srli_epi32(v1, 16));
+        acc1       = _mm_add_epi32(acc1, _mm_and_si128(v2, mask));
+        acc2       = _mm_add_epi32(acc2, _mm_srli_epi32(v2, 16));
+        p += 32;
+        len -= 32;
+    }
+    if (len >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        acc1      = _mm_add_epi32(acc1, _mm_and_si128(v, mask));
+        acc2      = _mm_add_epi32(acc2, _mm_srli_epi32(v, 16));
+        p += 16;
+        len -= 16;
+    }
+    acc1 = _mm_add_epi32(acc1, acc2);
+    acc1 = _mm_add_epi32(acc1, _mm_shuffle_epi32(acc1, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc1 = _mm_add_epi32(acc1, _mm_shuffle_epi32(acc1, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum += (unsigned int)_mm_cvtsi128_si32(acc1);
+    return Checksum::scalar(sum, p, len);
+}
+
+__attribute__((target("avx2"))) static unsigned int cksum_avx2(unsigned int sum, const void* data, size_t len)
+{
+    const unsigned char* p    = (const unsigned char*)data;
+    const __m256i        mask = _mm256_set1_epi32(0xffff);
+    __m256i              acc1 = _mm256_setzero_si256();
+    __m256i              acc2 = _mm256_setzero_si256();
+    while (len >= 64) {
+        __m256i v1 = _mm256_loadu_si256((const __m256i*)p);
+        __m256i v2 = _mm256_loadu_si256((const __m256i*)(p + 32));
+        acc1       = _mm256_add_epi32(acc1, _mm256_and_si256(v1, mask));
+        acc2       = _mm256_add_epi32(acc2, _mm256_srli_epi32(v1, 16));
+        acc1       = _mm256_add_epi32(acc1, _mm256_and_si256(v2, mask));
+        acc2       = _mm256_add_epi32(acc2, _mm256_srli_epi32(v2, 16));
+        p += 64;
+        len -= 64;
+    }
+    if (len >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        acc1      = _mm256_add_epi32(acc1, _mm256_and_si256(v, mask));
+        acc2      = _mm256_add_epi32(acc2, _mm256_srli_epi32(v, 16));
+        p += 32;
+        len -= 32;
+    }
+    acc1      = _mm256_add_epi32(acc1, acc2);
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc1), _mm256_extracti128_si256(acc1, 1));
+    s         = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s         = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum += (unsigned int)_mm_cvtsi128_si32(s);
+    return Checksum::scalar(sum, p, len);
+}
+
+__attribute__((target("avx512f"))) static unsigned int cksum_avx512(unsigned int sum, const void* data, size_t len)
+{
+    const unsigned char* p    = (const unsigned char*)data;
+    const __m512i        mask = _mm512_set1_epi32(0xffff);
+    __m512i              acc1 = _mm512_setzero_si512();
+    __m512i              acc2 = _mm512_setzero_si512();
+    while (len >= 64) {
+        __m512i v = _mm512_loadu_si512((const void*)p);
+        acc1      = _mm512_add_epi32(acc1, _mm512_and_si512(v, mask));
+        acc2      = _mm512_add_epi32(acc2, _mm512_maskz_srli_epi32(0xffff, v, 16));
+        p += 64;
+        len -= 64;
+    }
+    unsigned int lanes[16];
+    _mm512_storeu_si512((void*)lanes, _mm512_add_epi32(acc1, acc2));
+    for (int i = 0; i < 16; i++)
+        sum += lanes[i];
+    return Checksum::scalar(sum, p, len);
+}
+#endif
+
+bool Checksum::supported(Checksum::Implementation impl)
+{
+#ifdef DNSMETER_CHECKSUM_X86
+    __builtin_cpu_init();
+    switch (impl) {
+    case SCALAR:
+        return true;
+    case SSE2:
+        return __builtin_cpu_supports("sse2");
+    case AVX2:
+        return __builtin_cpu_supports("avx2");
+    case AVX512:
+        return __builtin_cpu_supports("avx512f");
+    default:
+        return false;
+    }
+#else
+    return impl == SCALAR;
+#endif
+}
+
+Checksum::Function Checksum::get(Checksum::Implementation impl)
+{
+    if (!supported(impl))
+        return NULL;
+#ifdef DNSMETER_CHECKSUM_X86
+    switch (impl) {
+    case SSE2:
+        return cksum_sse2;
+    case AVX2:
+        return cksum_avx2;
+    case AVX512:
+        return cksum_avx512;
+    default:
+        break;
+    }
+#endif
+    return scalar;
+}
+
+const char* Checksum::name(Checksum::Implementation impl)
+{
+    static const char* names[] = { "scalar", "sse2", "avx2", "avx512" };
+    if (impl < 0 || impl >= IMPLEMENTATIONS)
+        return "unknown";
+    return names[impl];
+}
+
+Checksum::Implementation Checksum::selected()
+{
+    for (int i = IMPLEMENTATIONS - 1; i > SCALAR; i--) {
+        if (supported((Implementation)i))
+            return (Implementation)i;
+    }
+    return SCALAR;
+}
+
+/*
+ * The function pointer starts out here, so there is no static
+ * initialization order to care about. Threads racing on the first call
+ * all store the same pointer.
+ */
+unsigned int Checksum::resolve(unsigned int sum, const void* data, size_t len)
+{
+    Function f = get(selected());
+    __atomic_store_n(&function, f, __ATOMIC_RELAXED);
+    return f(sum, data, len);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+
+#ifndef __dnsmeter_checksum_h
+#define __dnsmeter_checksum_h
+
+/*
+ * One's complement sum of 16 bit words as used by the Internet checksum
+ * (RFC 1071). The words are added up in host byte order into 32 bit
+ * without folding the carries, so every implementation returns exactly
+ * the same sum. This does not overflow for anything up to 64 KB.
+ *
+ * On x86 the implementation is chosen on the first call by the features
+ * CPUID reports, SSE2, AVX2 or AVX-512, otherwise a scalar loop is used.
+ */
+class Checksum {
+public:
+    enum Implementation {
+        SCALAR,
+        SSE2,
+        AVX2,
+        AVX512,
+        IMPLEMENTATIONS
+    };
+
+    typedef unsigned int (*Function)(unsigned int sum, const void* data, size_t len);
+
+private:
+    static Function function;
+    static unsigned int resolve(unsigned int sum, const void* data, size_t len);
+
+public:
+    static unsigned int scalar(unsigned int sum, const void* data, size_t len);
+
+    // headers are too short for the vector units to pay off
+    static inline unsigned int add(unsigned int sum, const void* data, size_t len)
+    {
+        if (len < 32)
+            return scalar(sum, data, len);
+        return function(sum, data, len);
+    }
+
+    static inline unsigned short fold(unsigned int sum)
+    {
+        sum = (sum >> 16) + (sum & 0xffff);
+        sum += (sum >> 16);
+        return (unsigned short)sum;
+    }
+
+    static Implementation selected();
+    static bool           supported(Implementation impl);
+    static Function       get(Implementation impl);
+    static const char*    name(Implementation impl);
+};
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "concurrency_window.h"
+#include "query.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+ConcurrencyWindow::ConcurrencyWindow(int lanes, int timeout_seconds)
+{
+    if (lanes < 1)
+        throw ppl7::InvalidArgumentsException();
+    // Slots must be expired before the timestamp ring wraps around
+    if (timeout_seconds < 1)
+        timeout_seconds = 1;
+    if (timeout_seconds > 5)
+        timeout_seconds = 5;
+    numLanes     = lanes;
+    timeoutSlots = timeout_seconds * 10000 / TICKS_PER_SLOT;
+    void* ptr    = NULL;
+    if (posix_memalign(&ptr, DNSMETER_CACHELINE_SIZE, sizeof(Lane) * lanes) != 0)
+        throw ppl7::OutOfMemoryException();
+    lane = (Lane*)ptr;
+    memset(lane, 0, sizeof(Lane) * lanes);
+    reset(1);
+}
+
+ConcurrencyWindow::~ConcurrencyWindow()
+{
+    free(lane);
+}
+
+void ConcurrencyWindow::reset(int limit)
+{
+    int now_slot = getQueryTimestamp() / TICKS_PER_SLOT;
+    for (int l = 0; l < numLanes; l++) {
+        Lane& ln = lane[l];
+        memset(ln.outstanding, 0, sizeof(ln.outstanding));
+        ln.inflight     = 0;
+        ln.timeouts     = 0;
+        ln.sweeping     = 0;
+        ln.expired_slot = (now_slot + SLOTS - timeoutSlots) % SLOTS;
+        __atomic_store_n(&ln.limit, (long)limit, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * Changes the number of outstanding queries per lane while queries are
+ * in flight, a smaller limit takes effect when enough responses arrived.
+ */
+void ConcurrencyWindow::setLimit(int limit)
+{
+    for (int l = 0; l < numLanes; l++)
+        __atomic_store_n(&lane[l].limit, (long)limit, __ATOMIC_RELEASE);
+}
+
+int ConcurrencyWindow::lanes() const
+{
+    return numLanes;
+}
+
+void ConcurrencyWindow::release(int l, unsigned short id)
+{
+    Lane&         ln   = lane[l];
+    unsigned int* slot = &ln.outstanding[(id / TICKS_PER_SLOT) % SLOTS];
+    unsigned int  cur  = __atomic_load_n(slot, __ATOMIC_RELAXED);
+    while (cur > 0) {
+        if (__atomic_compare_exchange_n(slot, &cur, cur - 1, true,
+                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            __atomic_fetch_sub(&ln.inflight, 1, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+    // slot was already expired, response came in too late
+}
+
+void ConcurrencyWindow::expire(int l)
+{
+    Lane& ln = lane[l];
+    if (__atomic_exchange_n(&ln.sweeping, 1, __ATOMIC_ACQUIRE))
+        return;
+    int target = (getQueryTimestamp() / TICKS_PER_SLOT + SLOTS - timeoutSlots) % SLOTS;
+    int steps  = (target - ln.expired_slot + SLOTS) % SLOTS;
+    if (steps > SLOTS - timeoutSlots)
+        steps = SLOTS - timeoutSlots;
+    for (int i = 0; i < steps; i++) {
+        ln.expired_slot = (ln.expired_slot + 1) % SLOTS;
+        unsigned int n  = __atomic_exchange_n(&ln.outstanding[ln.expired_slot], 0, __ATOMIC_ACQ_REL);
+        if (n) {
+            __atomic_fetch_sub(&ln.inflight, (long)n, __ATOMIC_RELEASE);
+            __atomic_fetch_add(&ln.timeouts, n, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_store_n(&ln.sweeping, 0, __ATOMIC_RELEASE);
+}
+
+long ConcurrencyWindow::getInflight() const
+{
+    long total = 0;
+    for (int l = 0; l < numLanes; l++)
+        total += __atomic_load_n(&lane[l].inflight, __ATOMIC_RELAXED);
+    return total;
+}
+
+ppluint64 ConcurrencyWindow::getTimeouts() const
+{
+    ppluint64 total = 0;
+    for (int l = 0; l < numLanes; l++)
+        total += __atomic_load_n(&lane[l].timeouts, __ATOMIC_RELAXED);
+    return total;
+}
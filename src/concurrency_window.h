@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "seqlock.h"
+
+#include <ppl7.h>
+
+#ifndef __dnsmeter_concurrency_window_h
+#define __dnsmeter_concurrency_window_h
+
+/*
+ * Limits the number of outstanding queries for the closed-loop mode.
+ *
+ * Queries are not tracked one by one. The DNS ID of every query is its
+ * send timestamp (see getQueryTimestamp()), so outstanding queries are
+ * counted per 10 ms slot of the 6 second timestamp ring. A response
+ * releases one query of the slot it was sent in, slots older than the
+ * timeout are expired as a whole.
+ *
+ * A window has one or more lanes. With one lane all sender threads share
+ * the limit, otherwise every sender thread has its own lane and marks its
+ * queries with a source port which is a multiple of its lane.
+ */
+class ConcurrencyWindow {
+private:
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || __cplusplus >= 201103L
+    ConcurrencyWindow& operator=(const ConcurrencyWindow& other);
+    ConcurrencyWindow(ConcurrencyWindow &&other) noexcept;
+    ConcurrencyWindow const & operator=(ConcurrencyWindow &&other);
+#endif
+
+public:
+    enum {
+        TICKS_PER_SLOT = 100,
+        SLOTS          = 60000 / TICKS_PER_SLOT
+    };
+
+private:
+    class DNSMETER_CACHELINE_ALIGNED Lane {
+    public:
+        long         limit;
+        long         inflight;
+        ppluint64    timeouts;
+        int          expired_slot;
+        int          sweeping;
+        unsigned int outstanding[SLOTS];
+    };
+
+    Lane* lane;
+    int   numLanes;
+    int   timeoutSlots;
+
+public:
+    ConcurrencyWindow(int lanes, int timeout_seconds);
+    ~ConcurrencyWindow();
+
+    void reset(int limit);
+    void setLimit(int limit);
+    int  lanes() const;
+
+    inline int laneFromPort(unsigned short port) const
+    {
+        return port % numLanes;
+    }
+
+    inline bool acquire(int l)
+    {
+        Lane& ln  = lane[l];
+        long  cur = __atomic_load_n(&ln.inflight, __ATOMIC_RELAXED);
+        while (cur < ln.limit) {
+            if (__atomic_compare_exchange_n(&ln.inflight, &cur, cur + 1, true,
+                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                return true;
+        }
+        return false;
+    }
+
+    inline void sent(int l, unsigned short id)
+    {
+        __atomic_fetch_add(&lane[l].outstanding[(id / TICKS_PER_SLOT) % SLOTS], 1, __ATOMIC_RELAXED);
+    }
+
+    void release(int l, unsigned short id);
+    void expire(int l);
+
+    long      getInflight() const;
+    ppluint64 getTimeouts() const;
+};
+
+#endif
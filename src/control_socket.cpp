@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "control_socket.h"
+#include "exceptions.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+ControlSocket::ControlSocket()
+{
+    sd       = -1;
+    client   = -1;
+    buffered = 0;
+    buffer   = (char*)malloc(MAX_LINE);
+    if (!buffer)
+        throw ppl7::OutOfMemoryException();
+}
+
+ControlSocket::~ControlSocket()
+{
+    close();
+    free(buffer);
+}
+
+void ControlSocket::listen(const ppl7::String& path)
+{
+    struct sockaddr_un addr;
+    if (path.isEmpty() || path.size() >= sizeof(addr.sun_path))
+        throw InvalidCommandlineParameter("invalid path for the control socket: %s", (const char*)path);
+    close();
+    // a socket left over by an earlier run is replaced
+    struct stat st;
+    if (lstat((const char*)path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink((const char*)path);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, (const char*)path, sizeof(addr.sun_path) - 1);
+    sd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sd < 0)
+        ppl7::throwExceptionFromErrno(errno, "Could not create control socket");
+    if (bind(sd, (const struct sockaddr*)&addr, sizeof(addr)) < 0 || ::listen(sd, 4) < 0) {
+        int e = errno;
+        ::close(sd);
+        sd = -1;
+        ppl7::throwExceptionFromErrno(e, ppl7::String("Could not listen on ") + path);
+    }
+    Path = path;
+}
+
+void ControlSocket::closeClient()
+{
+    if (client >= 0)
+        ::close(client);
+    client   = -1;
+    buffered = 0;
+}
+
+void ControlSocket::close()
+{
+    closeClient();
+    if (sd >= 0) {
+        ::close(sd);
+        unlink((const char*)Path);
+    }
+    sd = -1;
+}
+
+/*
+ * Does not block, returns true if a complete command has arrived. A new
+ * client is accepted when the previous one has closed the connection.
+ */
+bool ControlSocket::readCommand(ppl7::String& line)
+{
+    if (sd < 0)
+        return false;
+    struct pollfd pfd;
+    if (client < 0) {
+        pfd.fd     = sd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 0) <= 0)
+            return false;
+        client = ::accept(sd, NULL, NULL);
+        if (client < 0)
+            return false;
+    }
+    while (1) {
+        char* nl = (char*)memchr(buffer, '\n', buffered);
+        if (nl) {
+            size_t len = nl - buffer;
+            line.set(buffer, len);
+            line.trim();
+            buffered -= len + 1;
+            memmove(buffer, nl + 1, buffered);
+            return true;
+        }
+        if (buffered == MAX_LINE) {
+            reply("ERROR line too long");
+            closeClient();
+            return false;
+        }
+        pfd.fd     = client;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 0) <= 0)
+            return false;
+        ssize_t n = ::recv(client, buffer + buffered, MAX_LINE - buffered, 0);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN))
+            return false;
+        if (n <= 0) {
+            closeClient();
+            return false;
+        }
+        buffered += n;
+    }
+}
+
+/*
+ * A client which went away before the answer is ignored
+ */
+void ControlSocket::reply(const ppl7::String& line)
+{
+    if (client < 0)
+        return;
+    ppl7::String data = line;
+    data.append("\n");
+    const char* ptr  = (const char*)data;
+    size_t      left = data.size();
+    while (left) {
+        ssize_t n = ::send(client, ptr, left, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            closeClient();
+            return;
+        }
+        ptr += n;
+        left -= n;
+    }
+}
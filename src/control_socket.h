@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ppl7.h>
+
+#ifndef __dnsmeter_control_socket_h
+#define __dnsmeter_control_socket_h
+
+/*
+ * UNIX domain socket to control a running session, e.g. with
+ * "echo RATE 20000 | socat - UNIX-CONNECT:PATH". One client is served at
+ * a time, it sends one command per line and gets one line as answer:
+ *
+ *   RATE #           change the query rate of the running step, in
+ *                    closed-loop mode the outstanding queries
+ *   PAUSE / RESUME   stop and continue sending queries
+ *   STATS            current results of the step
+ *   PAYLOAD FILE     send the queries of another payload file
+ *   END              end the running step, the next one is started
+ *
+ * The answer starts with "OK" or "ERROR".
+ */
+class ControlSocket {
+private:
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || __cplusplus >= 201103L
+    ControlSocket& operator=(const ControlSocket& other);
+    ControlSocket(ControlSocket &&other) noexcept;
+    ControlSocket const & operator=(ControlSocket &&other);
+#endif
+
+    enum {
+        MAX_LINE = 4096
+    };
+
+    int          sd;
+    int          client;
+    char*        buffer;
+    size_t       buffered;
+    ppl7::String Path;
+
+    void closeClient();
+
+public:
+    ControlSocket();
+    ~ControlSocket();
+    void listen(const ppl7::String& path);
+    void close();
+    bool readCommand(ppl7::String& line);
+    void reply(const ppl7::String& line);
+};
+
+#endif
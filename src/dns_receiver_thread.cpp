@@ -25,6 +25,9 @@
 
 DNSReceiverThread::DNSReceiverThread()
 {
+    clock         = NULL;
+    phaseInterval = 0;
+    counter.setView(&view);
 }
 
 DNSReceiverThread::~DNSReceiverThread()
@@ -36,55 +39,80 @@ void DNSReceiverThread::setInterface(const ppl7::String& Device)
     Socket.initInterface(Device);
 }
 
-void DNSReceiverThread::setSource(const ppl7::IPAddress& ip, int port)
+void DNSReceiverThread::setTargets(const TargetList& targets)
 {
-    Socket.setSource(ip, port);
+    counter.resize(targets.size());
+    Socket.setTargets(targets);
 }
 
-void DNSReceiverThread::run()
+void DNSReceiverThread::setConcurrencyWindow(ConcurrencyWindow* window)
 {
-    counter.clear();
-    while (1) {
-        if (Socket.socketReady())
-            Socket.receive(counter);
-        if (this->threadShouldStop())
-            break;
-    }
+    Socket.setConcurrencyWindow(window);
+}
+
+void DNSReceiverThread::setQueryClasses(const QueryClasses* classes)
+{
+    Socket.setQueryClasses(classes, class_counter);
+}
+
+void DNSReceiverThread::setPhaseTiming(unsigned int interval)
+{
+    phaseInterval = interval;
+    phases.setInterval(interval, &phase_counter[view.slot()]);
 }
 
-ppluint64 DNSReceiverThread::getPacketsReceived() const
+/*
+ * The receiver runs for the whole session and follows the steps of the
+ * clock, without a clock everything is counted as step 0.
+ */
+void DNSReceiverThread::setStepClock(StepClock* clock)
 {
-    return counter.num_pkgs;
+    this->clock = clock;
 }
 
-ppluint64 DNSReceiverThread::getBytesReceived() const
+void DNSReceiverThread::beginStep()
 {
-    return counter.bytes_rcv;
+    int slot = view.slot();
+    counter[slot].clear();
+    class_counter[slot].clear();
+    phase_counter[slot].clear();
+    phases.setInterval(phaseInterval, &phase_counter[slot]);
 }
 
-double DNSReceiverThread::getDuration() const
+void DNSReceiverThread::run()
 {
-    return counter.rtt_total;
+    beginStep();
+    while (1) {
+        if (clock && clock->sync(view))
+            beginStep();
+        if (view.grace)
+            view.tick(ppl7::GetMicrotime());
+        if (Socket.socketReady()) {
+            phases.begin();
+            Socket.receive(counter);
+            phases.mark(PhaseTimer::RECEIVE);
+        }
+        if (this->threadShouldStop())
+            break;
+    }
 }
 
-double DNSReceiverThread::getRoundTripTimeAverage() const
+void DNSReceiverThread::getCounter(RawSocketReceiver::Counter& snapshot, int step) const
 {
-    if (counter.num_pkgs)
-        return counter.rtt_total / counter.num_pkgs; //NOSONAR
-    return 0.0f;
+    counter[step & 1].snapshot(snapshot);
 }
 
-double DNSReceiverThread::getRoundTripTimeMin() const
+void DNSReceiverThread::getCounter(RawSocketReceiver::Counter& snapshot, int step, int target) const
 {
-    return counter.rtt_min;
+    counter[step & 1][target].snapshot(snapshot);
 }
 
-double DNSReceiverThread::getRoundTripTimeMax() const
+void DNSReceiverThread::getClassCounter(QueryClassCounter& snapshot, int step) const
 {
-    return counter.rtt_max;
+    class_counter[step & 1].snapshot(snapshot);
 }
 
-const RawSocketReceiver::Counter& DNSReceiverThread::getCounter() const
+void DNSReceiverThread::getPhaseCounter(PhaseTimer::Counter& snapshot, int step) const
 {
-    return counter;
+    phase_counter[step & 1].snapshot(snapshot);
 }
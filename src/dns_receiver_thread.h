@@ -20,6 +20,8 @@
  */
 
 #include "raw_socket_receiver.h"
+#include "phase_timer.h"
+#include "step_clock.h"
 
 #include <ppl7.h>
 #include <ppl7-inet.h>
@@ -29,24 +31,31 @@
 
 class DNSReceiverThread : public ppl7::Thread {
 private:
-    RawSocketReceiver          Socket;
-    RawSocketReceiver::Counter counter;
+    RawSocketReceiver                        Socket;
+    StepCounters<RawSocketReceiver::Counter> counter;
+    CounterBlock<QueryClassCounter>          class_counter[2];
+    CounterBlock<PhaseTimer::Counter>        phase_counter[2];
+    PhaseTimer                               phases;
+    StepClock*                               clock;
+    StepView                                 view;
+    unsigned int                             phaseInterval;
+
+    void beginStep();
 
 public:
     DNSReceiverThread();
     ~DNSReceiverThread();
     void setInterface(const ppl7::String& Device);
-    void setSource(const ppl7::IPAddress& ip, int port);
+    void setTargets(const TargetList& targets);
+    void setConcurrencyWindow(ConcurrencyWindow* window);
+    void setQueryClasses(const QueryClasses* classes);
+    void setPhaseTiming(unsigned int interval);
+    void setStepClock(StepClock* clock);
     void run();
-
-    ppluint64 getPacketsReceived() const;
-    ppluint64 getBytesReceived() const;
-
-    double                            getDuration() const;
-    double                            getRoundTripTimeAverage() const;
-    double                            getRoundTripTimeMin() const;
-    double                            getRoundTripTimeMax() const;
-    const RawSocketReceiver::Counter& getCounter() const;
+    void getCounter(RawSocketReceiver::Counter& snapshot, int step) const;
+    void getCounter(RawSocketReceiver::Counter& snapshot, int step, int target) const;
+    void getClassCounter(QueryClassCounter& snapshot, int step) const;
+    void getPhaseCounter(PhaseTimer::Counter& snapshot, int step) const;
 };
 
 #endif
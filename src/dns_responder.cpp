@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dns_responder.h"
+#include "exceptions.h"
+
+#include <signal.h>
+#include <strings.h>
+
+static bool responderStop = false;
+
+static void responder_sighandler(int sig)
+{
+    responderStop = true;
+    printf("Stopping...\n");
+}
+
+static const char* rcode_names[] = {
+    "NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED",
+    "YXDOMAIN", "YXRRSET", "NXRRSET", "NOTAUTH", "NOTZONE",
+    NULL
+};
+
+static int parse_rcode(const ppl7::String& name)
+{
+    if (name.pregMatch("/^[0-9]+$/")) {
+        int rcode = name.toInt();
+        if (rcode > 15)
+            throw InvalidCommandlineParameter("invalid rcode: %s", (const char*)name);
+        return rcode;
+    }
+    for (int i = 0; rcode_names[i]; i++) {
+        if (strcasecmp(rcode_names[i], name) == 0)
+            return i;
+    }
+    throw InvalidCommandlineParameter("unknown rcode: %s", (const char*)name);
+}
+
+DNSResponder::DNSResponder()
+{
+    ListenPort  = 53;
+    ThreadCount = 1;
+    Runtime     = 0;
+    Rcode       = 0;
+    AnswerSize  = 0;
+    Delay       = 0.0;
+}
+
+DNSResponder::~DNSResponder()
+{
+    threadpool.destroyAllThreads();
+}
+
+void DNSResponder::help()
+{
+    ppl7::String name, underline;
+    name.setf("dnsmeter-responder %s", PACKAGE_VERSION);
+    underline.repeat("=", name.size());
+    name.printnl();
+    underline.printnl();
+    printf("\nUsage:\n"
+           "  -h            shows this help\n"
+           "  -b [HOST:]PORT\n"
+           "                address and port to listen on, IPv6 addresses with port in\n"
+           "                brackets: [::1]:5353 (default=0.0.0.0:53)\n"
+           "  -n #          number of threads, each with its own socket (default=1)\n"
+           "  -l #          runtime in seconds (default=until interrupted)\n"
+           "  --rcode NAME|#\n"
+           "                rcode of the responses, e.g. NOERROR, SERVFAIL, NXDOMAIN,\n"
+           "                REFUSED or a number (default=NOERROR)\n"
+           "  --answer-size #\n"
+           "                add a TXT record of # bytes (at least 13) to the answer\n"
+           "                section of every response (default=no answer)\n"
+           "  --delay #     delay every response by # milliseconds, fractions are\n"
+           "                allowed (default=0)\n"
+           "\n"
+           "Every query is answered by reflecting it with the QR bit and the rcode\n"
+           "set. The number of queries and responses is printed once per second.\n"
+           "\n");
+}
+
+void DNSResponder::getListenAddress(const ppl7::String& address)
+{
+    ppl7::String Host;
+    ppl7::String Port;
+    ppl7::Array  matches;
+    if (address.pregMatch("/^\\[(.+)\\]:([0-9]+)$/", matches)) {
+        Host = matches[1];
+        Port = matches[2];
+    } else if (address.pregMatch("/^([^:]+):([0-9]+)$/", matches)) {
+        Host = matches[1];
+        Port = matches[2];
+    } else if (address.pregMatch("/^[0-9]+$/")) {
+        Port = address;
+    } else {
+        throw InvalidCommandlineParameter("invalid address, expected [HOST:]PORT: %s", (const char*)address);
+    }
+    ListenPort = Port.toInt();
+    if (ListenPort < 1 || ListenPort > 65535)
+        throw InvalidCommandlineParameter("invalid port: %s", (const char*)address);
+    if (Host.isEmpty()) {
+        ListenIP.set("0.0.0.0");
+        return;
+    }
+    std::list<ppl7::IPAddress> Result;
+    if (!ppl7::GetHostByName(Host, Result, ppl7::af_unspec))
+        throw InvalidCommandlineParameter("could not resolve address: %s", (const char*)Host);
+    ListenIP = Result.front();
+}
+
+int DNSResponder::getParameter(int argc, char** argv)
+{
+    try {
+        getListenAddress(ppl7::HaveArgv(argc, argv, "-b") ? ppl7::GetArgv(argc, argv, "-b") : ppl7::String("53"));
+        if (ppl7::HaveArgv(argc, argv, "-n"))
+            ThreadCount = ppl7::GetArgv(argc, argv, "-n").toInt();
+        if (ThreadCount < 1)
+            throw InvalidCommandlineParameter("-n must be at least 1");
+        Runtime = ppl7::GetArgv(argc, argv, "-l").toInt();
+        if (ppl7::HaveArgv(argc, argv, "--rcode"))
+            Rcode = parse_rcode(ppl7::GetArgv(argc, argv, "--rcode").trimmed());
+        if (ppl7::HaveArgv(argc, argv, "--answer-size")) {
+            AnswerSize = ppl7::GetArgv(argc, argv, "--answer-size").toInt();
+            if (AnswerSize > 0 && (AnswerSize < 13 || AnswerSize > DNSResponderThread::MAXPACKETSIZE / 2))
+                throw InvalidCommandlineParameter("--answer-size must be between 13 and %d bytes",
+                    DNSResponderThread::MAXPACKETSIZE / 2);
+        }
+        if (ppl7::HaveArgv(argc, argv, "--delay")) {
+            Delay = ppl7::GetArgv(argc, argv, "--delay").toDouble();
+            if (Delay < 0.0 || Delay > 5000.0)
+                throw InvalidCommandlineParameter("--delay must be between 0 and 5000 milliseconds");
+        }
+    } catch (const ppl7::Exception& e) {
+        printf("ERROR: missing or invalid parameter\n");
+        e.print();
+        printf("\n");
+        help();
+        return 1;
+    }
+    return 0;
+}
+
+void DNSResponder::getCounter(DNSResponderThread::Counter& total)
+{
+    ppl7::ThreadPool::iterator it;
+    total.clear();
+    for (it = threadpool.begin(); it != threadpool.end(); ++it) {
+        DNSResponderThread::Counter counter;
+        ((DNSResponderThread*)(*it))->getCounter(counter);
+        total += counter;
+    }
+}
+
+void DNSResponder::showStats(ppl7::ppl_time_t start_time)
+{
+    DNSResponderThread::Counter total;
+    getCounter(total);
+    DNSResponderThread::Counter diff    = total - prev;
+    ppl7::ppl_time_t            runtime = ppl7::GetTime() - start_time;
+    prev                                = total;
+
+    int h = (int)(runtime / 3600);
+    runtime -= h * 3600;
+    int m = (int)(runtime / 60);
+    int s = runtime - (m * 60);
+
+    printf("%02d:%02d:%02d Queries rcv: %7llu, answered: %7llu, dropped: %5llu, ", h, m, s,
+        diff.received, diff.answered, diff.dropped);
+    printf("Data rcv: %6llu KB, send: %6llu KB\n", diff.bytes_received / 1024, diff.bytes_answered / 1024);
+    fflush(stdout);
+}
+
+int DNSResponder::main(int argc, char** argv)
+{
+    if (ppl7::HaveArgv(argc, argv, "-h") || ppl7::HaveArgv(argc, argv, "--help")) {
+        help();
+        return 0;
+    }
+    if (getParameter(argc, argv) != 0)
+        return 1;
+
+    signal(SIGINT, responder_sighandler);
+    signal(SIGTERM, responder_sighandler);
+
+    try {
+        for (int i = 0; i < ThreadCount; i++) {
+            DNSResponderThread* thread = new DNSResponderThread();
+            threadpool.addThread(thread);
+            thread->bind(ListenIP, ListenPort);
+            thread->setRcode(Rcode);
+            thread->setAnswerSize(AnswerSize);
+            thread->setDelay(Delay);
+        }
+    } catch (const ppl7::Exception& e) {
+        e.print();
+        return 1;
+    }
+    ppl7::String RcodeName;
+    if (Rcode < 11)
+        RcodeName = rcode_names[Rcode];
+    else
+        RcodeName.setf("%d", Rcode);
+    printf("# Listening on %s port %d with Threads: %d, rcode: %s, answer size: %d, delay: %0.3f ms\n",
+        (const char*)ListenIP.toString(), ListenPort, ThreadCount,
+        (const char*)RcodeName, (int)AnswerSize, Delay);
+    fflush(stdout);
+
+    threadpool.startThreads();
+    ppl7::ppl_time_t start  = ppl7::GetTime();
+    ppl7::ppl_time_t report = start + 1;
+    while (!responderStop && (Runtime == 0 || ppl7::GetTime() < start + Runtime)) {
+        ppl7::MSleep(100);
+        ppl7::ppl_time_t now = ppl7::GetTime();
+        if (now >= report) {
+            report = now + 1;
+            showStats(start);
+        }
+    }
+    threadpool.stopThreads();
+
+    DNSResponderThread::Counter total;
+    getCounter(total);
+    printf("# Queries received: %llu, answered: %llu, dropped: %llu\n",
+        total.received, total.answered, total.dropped);
+    return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dns_responder_thread.h"
+
+#include <ppl7.h>
+#include <ppl7-inet.h>
+
+#ifndef __dnsmeter_dns_responder_h
+#define __dnsmeter_dns_responder_h
+
+/*
+ * dnsmeter-responder: answers every query it receives as fast as possible.
+ * It is meant as the reference target for benchmarks and tests of
+ * dnsmeter, not as a nameserver.
+ */
+class DNSResponder {
+private:
+    ppl7::ThreadPool            threadpool;
+    ppl7::IPAddress             ListenIP;
+    int                         ListenPort;
+    int                         ThreadCount;
+    int                         Runtime;
+    int                         Rcode;
+    size_t                      AnswerSize;
+    double                      Delay;
+    DNSResponderThread::Counter prev;
+
+    void help();
+    int  getParameter(int argc, char** argv);
+    void getListenAddress(const ppl7::String& address);
+    void getCounter(DNSResponderThread::Counter& total);
+    void showStats(ppl7::ppl_time_t start_time);
+
+public:
+    DNSResponder();
+    ~DNSResponder();
+    int main(int argc, char** argv);
+};
+
+#endif
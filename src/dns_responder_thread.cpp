@@ -0,0 +1,428 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dns_responder_thread.h"
+#include "query.h"
+
+#include <netinet/in.h>
+#include <unistd.h>
+#include <poll.h>
+#include <string.h>
+#include <errno.h>
+
+DNSResponderThread::Counter::Counter()
+{
+    clear();
+}
+
+void DNSResponderThread::Counter::clear()
+{
+    received       = 0;
+    answered       = 0;
+    dropped        = 0;
+    bytes_received = 0;
+    bytes_answered = 0;
+}
+
+DNSResponderThread::Counter& DNSResponderThread::Counter::operator+=(const DNSResponderThread::Counter& other)
+{
+    received += other.received;
+    answered += other.answered;
+    dropped += other.dropped;
+    bytes_received += other.bytes_received;
+    bytes_answered += other.bytes_answered;
+    return *this;
+}
+
+DNSResponderThread::Counter DNSResponderThread::Counter::operator-(const DNSResponderThread::Counter& other) const
+{
+    DNSResponderThread::Counter r;
+    r.received       = received - other.received;
+    r.answered       = answered - other.answered;
+    r.dropped        = dropped - other.dropped;
+    r.bytes_received = bytes_received - other.bytes_received;
+    r.bytes_answered = bytes_answered - other.bytes_answered;
+    return r;
+}
+
+DNSResponderThread::DNSResponderThread()
+{
+    sd          = -1;
+    rcode       = 0;
+    answer      = NULL;
+    answerSize  = 0;
+    delay       = 0.0;
+    queue       = NULL;
+    queueBuffer = NULL;
+    queueHead   = 0;
+    queueCount  = 0;
+    recvBuffer  = (unsigned char*)malloc(BATCH * MAXPACKETSIZE);
+    sendBuffer  = (unsigned char*)malloc(BATCH * MAXPACKETSIZE);
+    if (!recvBuffer || !sendBuffer) {
+        free(recvBuffer);
+        free(sendBuffer);
+        throw ppl7::OutOfMemoryException();
+    }
+    memset(recvIov, 0, sizeof(recvIov));
+    memset(sendIov, 0, sizeof(sendIov));
+    for (int i = 0; i < BATCH; i++) {
+        recvIov[i].iov_base = recvBuffer + i * MAXPACKETSIZE;
+        recvIov[i].iov_len  = MAXPACKETSIZE;
+        sendAddr[i]         = NULL;
+        sendAddrlen[i]      = 0;
+    }
+#ifdef HAVE_SENDMMSG
+    memset(sendMsg, 0, sizeof(sendMsg));
+    for (int i = 0; i < BATCH; i++) {
+        sendMsg[i].msg_hdr.msg_iov    = &sendIov[i];
+        sendMsg[i].msg_hdr.msg_iovlen = 1;
+    }
+#endif
+#ifdef HAVE_RECVMMSG
+    memset(recvMsg, 0, sizeof(recvMsg));
+    for (int i = 0; i < BATCH; i++) {
+        recvMsg[i].msg_hdr.msg_iov    = &recvIov[i];
+        recvMsg[i].msg_hdr.msg_iovlen = 1;
+        recvMsg[i].msg_hdr.msg_name   = &recvAddr[i];
+    }
+#endif
+}
+
+DNSResponderThread::~DNSResponderThread()
+{
+    if (sd >= 0)
+        ::close(sd);
+    free(recvBuffer);
+    free(sendBuffer);
+    free(answer);
+    free(queue);
+    free(queueBuffer);
+}
+
+void DNSResponderThread::bind(const ppl7::IPAddress& ip, int port)
+{
+    struct sockaddr_storage addr;
+    socklen_t               addrlen;
+    memset(&addr, 0, sizeof(addr));
+    if (ip.family() == ppl7::IPAddress::IPv6) {
+        ip.toSockAddr(&addr, sizeof(struct sockaddr_in6));
+        ((struct sockaddr_in6*)&addr)->sin6_port = htons(port);
+        addrlen                                  = sizeof(struct sockaddr_in6);
+    } else {
+        ip.toSockAddr(&addr, sizeof(struct sockaddr_in));
+        ((struct sockaddr_in*)&addr)->sin_port = htons(port);
+        addrlen                                = sizeof(struct sockaddr_in);
+    }
+    if (sd >= 0)
+        ::close(sd);
+    sd = socket(addr.ss_family, SOCK_DGRAM, 0);
+    if (sd < 0)
+        ppl7::throwExceptionFromErrno(errno, "Could not create UDP socket");
+    int on = 1;
+#ifdef SO_REUSEPORT_LB
+    // FreeBSD only balances between the sockets with SO_REUSEPORT_LB
+    setsockopt(sd, SOL_SOCKET, SO_REUSEPORT_LB, &on, sizeof(on));
+#elif defined(SO_REUSEPORT)
+    setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#endif
+    int bufsize = 4 * 1024 * 1024;
+    setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    setsockopt(sd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    if (::bind(sd, (const struct sockaddr*)&addr, addrlen) < 0)
+        ppl7::throwExceptionFromErrno(errno, "Could not bind UDP socket");
+}
+
+void DNSResponderThread::setRcode(int rcode)
+{
+    if (rcode < 0 || rcode > 15)
+        throw ppl7::InvalidArgumentsException();
+    this->rcode = rcode;
+}
+
+/*
+ * Builds the answer record which is inserted into every response: a TXT
+ * record for the name of the question, filled up to the given size.
+ */
+void DNSResponderThread::setAnswerSize(size_t size)
+{
+    free(answer);
+    answer     = NULL;
+    answerSize = 0;
+    if (!size)
+        return;
+    // name pointer, type, class, ttl, rdlength and at least one length byte
+    if (size < 13 || size > MAXPACKETSIZE / 2)
+        throw ppl7::InvalidArgumentsException();
+    answer = (unsigned char*)malloc(size);
+    if (!answer)
+        throw ppl7::OutOfMemoryException();
+    size_t rdlength = size - 12;
+    unsigned char header[12] = { 0xc0, 0x0c, 0, 16, 0, 1, 0, 0, 0, 0,
+        (unsigned char)(rdlength >> 8), (unsigned char)(rdlength & 0xff) };
+    memcpy(answer, header, 12);
+    size_t p = 12;
+    while (p < size) {
+        size_t chunk = size - p - 1;
+        if (chunk > 255)
+            chunk = 255;
+        answer[p++] = (unsigned char)chunk;
+        memset(answer + p, 'x', chunk);
+        p += chunk;
+    }
+    answerSize = size;
+}
+
+void DNSResponderThread::setDelay(double milliseconds)
+{
+    free(queue);
+    free(queueBuffer);
+    queue       = NULL;
+    queueBuffer = NULL;
+    queueHead   = 0;
+    queueCount  = 0;
+    delay       = 0.0;
+    if (milliseconds <= 0.0)
+        return;
+    queue       = (Pending*)calloc(DELAYQUEUE, sizeof(Pending));
+    queueBuffer = (unsigned char*)malloc((size_t)DELAYQUEUE * MAXPACKETSIZE);
+    if (!queue || !queueBuffer)
+        throw ppl7::OutOfMemoryException();
+    delay = milliseconds / 1000.0;
+}
+
+/*
+ * Writes the response to the given query into response and returns its
+ * size, or 0 if the packet should not be answered. Packets which already
+ * are responses are never answered, so two responders can not loop.
+ */
+size_t DNSResponderThread::respond(const unsigned char* query, size_t size, unsigned char* response) const
+{
+    const struct DNS_HEADER* q = (const struct DNS_HEADER*)query;
+    if (size < sizeof(struct DNS_HEADER) || q->qr)
+        return 0;
+    size_t end = size;
+    if (answerSize && ntohs(q->q_count) == 1 && q->ans_count == 0 && size + answerSize <= MAXPACKETSIZE) {
+        size_t p = sizeof(struct DNS_HEADER);
+        while (p < size && query[p]) {
+            // the question is never compressed
+            if (query[p] & 0xc0) {
+                p = size;
+                break;
+            }
+            p += query[p] + 1;
+        }
+        // terminating label, type and class
+        if (p + 5 <= size)
+            end = p + 5;
+    }
+    memcpy(response, query, end);
+    struct DNS_HEADER* r = (struct DNS_HEADER*)response;
+    r->qr                = 1;
+    r->rcode             = rcode;
+    if (end == size)
+        return size;
+    // the answer goes between question and authority/additional section,
+    // so an OPT record of the query is kept at the end
+    memcpy(response + end, answer, answerSize);
+    memcpy(response + end + answerSize, query + end, size - end);
+    r->ans_count = htons(1);
+    return size + answerSize;
+}
+
+/*
+ * Reads up to BATCH queries without waiting and returns their number.
+ */
+int DNSResponderThread::receive()
+{
+#ifdef HAVE_RECVMMSG
+    for (int i = 0; i < BATCH; i++)
+        recvMsg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    int n = recvmmsg(sd, recvMsg, BATCH, MSG_DONTWAIT, NULL);
+    for (int i = 0; i < n; i++) {
+        recvSize[i]    = recvMsg[i].msg_len;
+        recvAddrlen[i] = recvMsg[i].msg_hdr.msg_namelen;
+    }
+#else
+    recvAddrlen[0] = sizeof(struct sockaddr_storage);
+    ssize_t len    = recvfrom(sd, recvBuffer, MAXPACKETSIZE, MSG_DONTWAIT,
+        (struct sockaddr*)&recvAddr[0], &recvAddrlen[0]);
+    int n       = len < 0 ? -1 : 1;
+    recvSize[0] = len < 0 ? 0 : len;
+#endif
+    return n;
+}
+
+/*
+ * Sends the first count responses of sendIov/sendAddr and returns the
+ * number of responses which were sent.
+ */
+int DNSResponderThread::send(int count, Counter& c)
+{
+    int done = 0;
+#ifdef HAVE_SENDMMSG
+    for (int i = 0; i < count; i++) {
+        sendMsg[i].msg_hdr.msg_name    = sendAddr[i];
+        sendMsg[i].msg_hdr.msg_namelen = sendAddrlen[i];
+    }
+#endif
+    while (done < count) {
+#ifdef HAVE_SENDMMSG
+        int n = sendmmsg(sd, sendMsg + done, count - done, 0);
+#else
+        int n = (sendto(sd, sendIov[done].iov_base, sendIov[done].iov_len, 0,
+                     (const struct sockaddr*)sendAddr[done], sendAddrlen[done])
+                    < 0)
+            ? -1
+            : 1;
+#endif
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            // skip the response which could not be sent
+            c.dropped++;
+            done++;
+            continue;
+        }
+        for (int i = done; i < done + n; i++)
+            c.bytes_answered += sendIov[i].iov_len;
+        c.answered += n;
+        done += n;
+    }
+    return done;
+}
+
+void DNSResponderThread::answerBatch(int count)
+{
+    Counter& c = counter.beginUpdate();
+    int      n = 0;
+    for (int i = 0; i < count; i++) {
+        c.received++;
+        c.bytes_received += recvSize[i];
+        unsigned char* response = sendBuffer + n * MAXPACKETSIZE;
+        size_t         size     = respond((const unsigned char*)recvIov[i].iov_base, recvSize[i], response);
+        if (!size) {
+            c.dropped++;
+            continue;
+        }
+        sendIov[n].iov_base = response;
+        sendIov[n].iov_len  = size;
+        sendAddr[n]         = &recvAddr[i];
+        sendAddrlen[n]      = recvAddrlen[i];
+        n++;
+    }
+    if (n)
+        send(n, c);
+    counter.endUpdate();
+}
+
+void DNSResponderThread::queueBatch(int count)
+{
+    Counter& c   = counter.beginUpdate();
+    double   due = ppl7::GetMicrotime() + delay;
+    for (int i = 0; i < count; i++) {
+        c.received++;
+        c.bytes_received += recvSize[i];
+        if (queueCount == DELAYQUEUE) {
+            c.dropped++;
+            continue;
+        }
+        size_t   slot = (queueHead + queueCount) % DELAYQUEUE;
+        Pending& p    = queue[slot];
+        p.size        = respond((const unsigned char*)recvIov[i].iov_base, recvSize[i],
+            queueBuffer + slot * MAXPACKETSIZE);
+        if (!p.size) {
+            c.dropped++;
+            continue;
+        }
+        p.due     = due;
+        p.addrlen = recvAddrlen[i];
+        memcpy(&p.addr, &recvAddr[i], recvAddrlen[i]);
+        queueCount++;
+    }
+    counter.endUpdate();
+}
+
+/*
+ * Sends all queued responses which are due. The delay is the same for all
+ * responses, so the queue is ordered by due time.
+ */
+void DNSResponderThread::sendDue()
+{
+    double now = ppl7::GetMicrotime();
+    while (queueCount && queue[queueHead].due <= now) {
+        int n = 0;
+        while (n < BATCH && n < (int)queueCount) {
+            Pending& p = queue[(queueHead + n) % DELAYQUEUE];
+            if (p.due > now)
+                break;
+            sendIov[n].iov_base = queueBuffer + ((queueHead + n) % DELAYQUEUE) * MAXPACKETSIZE;
+            sendIov[n].iov_len  = p.size;
+            sendAddr[n]         = &p.addr;
+            sendAddrlen[n]      = p.addrlen;
+            n++;
+        }
+        send(n, counter.beginUpdate());
+        counter.endUpdate();
+        queueHead = (queueHead + n) % DELAYQUEUE;
+        queueCount -= n;
+    }
+}
+
+/*
+ * Milliseconds to wait for queries before the next queued response is due.
+ */
+int DNSResponderThread::pollTimeout() const
+{
+    if (!queueCount)
+        return 100;
+    double wait = queue[queueHead].due - ppl7::GetMicrotime();
+    if (wait <= 0.0)
+        return 0;
+    return (int)(wait * 1000.0) + 1;
+}
+
+void DNSResponderThread::run()
+{
+    counter.clear();
+    while (!threadShouldStop()) {
+        if (queueCount)
+            sendDue();
+        int n = receive();
+        if (n > 0) {
+            if (delay > 0.0)
+                queueBatch(n);
+            else
+                answerBatch(n);
+            continue;
+        }
+        struct pollfd pfd;
+        pfd.fd     = sd;
+        pfd.events = POLLIN;
+        poll(&pfd, 1, pollTimeout());
+    }
+}
+
+void DNSResponderThread::getCounter(Counter& snapshot) const
+{
+    counter.snapshot(snapshot);
+}
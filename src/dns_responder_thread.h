@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "seqlock.h"
+
+#include <ppl7.h>
+#include <ppl7-inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifndef __dnsmeter_dns_responder_thread_h
+#define __dnsmeter_dns_responder_thread_h
+
+/*
+ * One thread of dnsmeter-responder. Every thread has its own UDP socket
+ * bound to the same address with SO_REUSEPORT, so the kernel distributes
+ * the queries over the threads. Queries are read and answered in batches.
+ *
+ * The response is the query with the QR bit and the configured rcode set.
+ * If an answer size is configured, a TXT record of exactly that size is
+ * inserted after the question. With a delay, responses are queued and sent
+ * when they are due.
+ */
+class DNSResponderThread : public ppl7::Thread {
+public:
+    enum {
+        BATCH         = 64,
+        MAXPACKETSIZE = 4096,
+        DELAYQUEUE    = 8192
+    };
+
+    class Counter {
+    public:
+        ppluint64 received;
+        ppluint64 answered;
+        ppluint64 dropped;
+        ppluint64 bytes_received;
+        ppluint64 bytes_answered;
+
+        Counter();
+        void     clear();
+        Counter& operator+=(const Counter& other);
+        Counter  operator-(const Counter& other) const;
+    };
+
+private:
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || __cplusplus >= 201103L
+    DNSResponderThread& operator=(const DNSResponderThread& other);
+    DNSResponderThread(DNSResponderThread &&other) noexcept;
+    DNSResponderThread const & operator=(DNSResponderThread &&other);
+#endif
+
+    struct Pending {
+        double                  due;
+        size_t                  size;
+        socklen_t               addrlen;
+        struct sockaddr_storage addr;
+    };
+
+    int                      sd;
+    int                      rcode;
+    unsigned char*           answer;
+    size_t                   answerSize;
+    double                   delay;
+    unsigned char*           recvBuffer;
+    unsigned char*           sendBuffer;
+    struct iovec             recvIov[BATCH];
+    struct iovec             sendIov[BATCH];
+    size_t                   recvSize[BATCH];
+    struct sockaddr_storage  recvAddr[BATCH];
+    socklen_t                recvAddrlen[BATCH];
+    struct sockaddr_storage* sendAddr[BATCH];
+    socklen_t                sendAddrlen[BATCH];
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr sendMsg[BATCH];
+#endif
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr recvMsg[BATCH];
+#endif
+    Pending*              queue;
+    unsigned char*        queueBuffer;
+    size_t                queueHead;
+    size_t                queueCount;
+    CounterBlock<Counter> counter;
+
+    size_t respond(const unsigned char* query, size_t size, unsigned char* response) const;
+    int    receive();
+    int    send(int count, Counter& c);
+    void   answerBatch(int count);
+    void   queueBatch(int count);
+    void   sendDue();
+    int    pollTimeout() const;
+
+public:
+    DNSResponderThread();
+    ~DNSResponderThread();
+    void bind(const ppl7::IPAddress& ip, int port);
+    void setRcode(int rcode);
+    void setAnswerSize(size_t size);
+    void setDelay(double milliseconds);
+    void run();
+    void getCounter(Counter& snapshot) const;
+};
+
+#endif
@@ -24,16 +24,18 @@
 #include "dns_sender.h"
 #include "exceptions.h"
 #include "dns_sender_thread.h"
+#include "metrics_writer.h"
+#include "control_socket.h"
+#include "concurrency_window.h"
+#include "agent_link.h"
+#include "query.h"
 
 #include <signal.h>
 #include <string.h>
+#include <algorithm>
 
-static const char* rcode_names[] = {
-    "OK", "FORMAT", "SRVFAIL", "NAME", "NOTIMPL", "REFUSED",
-    "YXDOMAIN", "YXRRSET", "NXRRSET", "NOTAUTH", "NOTZONE",
-    "11", "12", "13", "14", "15",
-    NULL
-};
+// seconds the responses have to be steady to end the warm-up (--steady)
+#define STEADY_SECONDS 3
 
 bool stopFlag = false;
 
@@ -55,24 +57,115 @@ void DNSSender::help()
            "  -q HOST       hostname or IP address of sender if you don't want to spoof\n"
            "                (see -s)\n"
            "  -s NET|pcap   spoof sender address. Use random IP from the given network\n"
-           "                (example: 192.168.0.0/16). Only works when running as root!\n"
+           "                (example: 192.168.0.0/16 or 2001:db8::/48). Only works when\n"
+           "                running as root!\n"
            "                If payload is a pcap file, you can use \"-s pcap\" to use the\n"
            "                source addresses and ports from the pcap file.\n"
            "  -e ETH        interface on which the packet receiver should listen\n"
            "                (FreeBSD only)\n"
-           "  -z HOST:PORT  hostname or IP address and port of the target nameserver\n"
+           "  -z HOST:PORT  hostname or IP address and port of the target nameserver,\n"
+           "                IPv6 addresses with port in brackets: [2001:db8::1]:53\n"
+           "                Several targets are separated by comma, each can have a\n"
+           "                weight: 192.0.2.1@3,192.0.2.2@1\n"
+           "  --target-select rr|weight|hash\n"
+           "                distribute the queries over the targets in turn (rr), by\n"
+           "                weight or by a hash of the query name (default=weight if\n"
+           "                weights are given, otherwise rr)\n"
            "  -p FILE       file with queries/payload or pcap file\n"
+           "  --generate TEMPLATE\n"
+           "                generate the queries instead of reading them from a file (-p).\n"
+           "                TEMPLATE is a query name with placeholders and a query type,\n"
+           "                e.g. \"{rand:12}.{seq}.example.com A\". Placeholders are\n"
+           "                {rand:N} (N random characters), {seq} (sequence number of the\n"
+           "                thread) and {thread} (number of the thread). Several templates\n"
+           "                separated by \";\" are used in turn\n"
+           "  --zipf #      draw the queries from the payload file with a Zipf distribution\n"
+           "                with exponent # instead of using them in turn. The first\n"
+           "                query of the file is the most popular one\n"
+           "  --weights FILE\n"
+           "                draw the queries from the payload file with the popularity\n"
+           "                given in FILE, one weight per query in the same order\n"
            "  -l #          runtime in seconds (default=10 seconds)\n"
+           "  --warmup #    send for # seconds before every load step without counting\n"
+           "                the results (default=0)\n"
+           "  --steady #    end the warm-up as soon as the responses per second and\n"
+           "                their average rtt of the last 3 seconds differ by at most\n"
+           "                # percent, --warmup is the maximum then (default=30)\n"
            "  -t #          timeout in seconds (default=2 seconds)\n"
            "  -n #          number of worker threads (default=1)\n"
            "  -r #          queryrate (Default=as much as possible)\n"
            "                can be a single value, a comma separated list (rate,rate,...)\n"
            "                or a range and a step value (start - end, step)\n"
+           "  -o #          closed-loop mode: keep # queries outstanding in total and send\n"
+           "                the next query as soon as a response arrives or a query\n"
+           "                times out (-t). Like -r, this can be a list or a range\n"
+           "  -O #          closed-loop mode with # outstanding queries per thread\n"
+           "  --search      search the highest queryrate which meets the service level\n"
+           "                given with --sla-loss and --sla-p99. -r defines the search\n"
+           "                range and resolution (start - end, step)\n"
+           "  --sla-loss #  maximum loss in percent for --search (default=1)\n"
+           "  --sla-p99 #   maximum 99th percentile of the rtt in milliseconds for\n"
+           "                --search (default=no limit)\n"
+           "  --search-runs #\n"
+           "                number of runs per queryrate for --search, a rate passes\n"
+           "                if the majority of runs meet the service level (default=2)\n"
            "  -d #          amount of queries in percent on which the DNSSEC-flags are set\n"
            "                (default=0)\n"
            "  -c FILE       CSV-file for results\n"
+           "  --ecs NET[,LEN]\n"
+           "                add an EDNS client subnet option with a random subnet of\n"
+           "                prefix length LEN (default=24 or 56 for IPv6) from NET\n"
+           "  --cookie #    add an EDNS client cookie, one of # simulated clients\n"
+           "  --padding #   pad queries with EDNS padding to a multiple of # bytes\n"
+           "  --nsid        request the name server identifier (NSID)\n"
+           "  --engine raw|udp|tcp|dot\n"
+           "                how queries are sent. \"raw\" (default) uses raw sockets and\n"
+           "                needs root. \"udp\" uses a pool of connected UDP sockets per\n"
+           "                thread, does not need any privileges but can not spoof (-q).\n"
+           "                \"tcp\" sends over a pool of TCP connections per thread,\n"
+           "                \"dot\" over a pool of TLS connections (default port 853)\n"
+           "  --sockets #   number of UDP sockets or TCP connections per thread for\n"
+           "                --engine udp|tcp|dot (default=8)\n"
+           "  --pipeline #  maximum number of outstanding queries per TCP connection\n"
+           "                (default=100)\n"
+           "  --churn #     open a new TCP connection after # queries, 0 keeps the\n"
+           "                connections open (default=0)\n"
+           "  --no-resume   do not resume TLS sessions for --engine dot, every\n"
+           "                connection does a full handshake\n"
+           "  --metrics FILE\n"
+           "                write live metrics in OpenMetrics text format to FILE, the\n"
+           "                file is replaced once per second\n"
+           "  --metrics-json FILE\n"
+           "                append live metrics as one JSON object per line and second\n"
+           "                to FILE, which can also be a FIFO\n"
+           "  --control PATH\n"
+           "                accept commands on the UNIX domain socket PATH to change\n"
+           "                the running session: RATE #, PAUSE, RESUME, STATS,\n"
+           "                PAYLOAD FILE and END\n"
+           "  --qtype-stats break down the responses by the query type of the question\n"
+           "  --qclass LABEL=TYPE,...;LABEL=TYPE,...\n"
+           "                break down the responses by user defined classes of query\n"
+           "                types, e.g. \"slow=DNSKEY,ANY;fast=A,AAAA\"\n"
+           "  --backoff     retry sends which fail because the queue of the interface\n"
+           "                or the socket buffer is full, queries which still can not\n"
+           "                be sent are counted as local drops and made up later\n"
+           "  --phase-timing #\n"
+           "                time the phases of every #th query in the send and receive\n"
+           "                path and show the nanoseconds per packet of every thread\n"
            "  --ignore      answers are ignored and therefor not counted. In this mode\n"
-           "                the tool only generates traffic."
+           "                the tool only generates traffic.\n"
+           "  --agent [HOST:]PORT\n"
+           "                run as agent and wait for a coordinator on PORT of HOST,\n"
+           "                the default is the loopback address. Further options\n"
+           "                given here take precedence over the ones of the\n"
+           "                coordinator, e.g. -q or -e\n"
+           "  --agents HOST:PORT,...\n"
+           "                run as coordinator: send the options to the agents, start\n"
+           "                every load step on all agents at the same time and merge\n"
+           "                their results. Rates are the total of all agents\n"
+           "  --agent-secret FILE\n"
+           "                file with the shared secret of coordinator and agents,\n"
+           "                required with --agent and --agents"
            "\n");
 }
 
@@ -86,6 +179,8 @@ DNSSender::Results::Results()
     counter_errors   = 0;
     packages_lost    = 0;
     counter_0bytes   = 0;
+    dropped_local    = 0;
+    backoffs         = 0;
     for (int i                = 0; i < 255; i++)
         counter_errorcodes[i] = 0;
     rtt_avg                   = 0.0f;
@@ -94,7 +189,16 @@ DNSSender::Results::Results()
     rtt_max                   = 0.0f;
     for (int i    = 0; i < 16; i++)
         rcodes[i] = 0;
-    truncated     = 0;
+    truncated          = 0;
+    connects           = 0;
+    connect_errors     = 0;
+    connections_closed = 0;
+    queries_dropped    = 0;
+    resumed            = 0;
+    start              = 0.0;
+    duration           = 0.0;
+    rtt_histogram.clear();
+    handshake_histogram.clear();
 }
 
 void DNSSender::Results::clear()
@@ -107,6 +211,8 @@ void DNSSender::Results::clear()
     counter_errors   = 0;
     packages_lost    = 0;
     counter_0bytes   = 0;
+    dropped_local    = 0;
+    backoffs         = 0;
     for (int i                = 0; i < 255; i++)
         counter_errorcodes[i] = 0;
     rtt_avg                   = 0.0f;
@@ -115,7 +221,16 @@ void DNSSender::Results::clear()
     rtt_max                   = 0.0f;
     for (int i    = 0; i < 16; i++)
         rcodes[i] = 0;
-    truncated     = 0;
+    truncated          = 0;
+    connects           = 0;
+    connect_errors     = 0;
+    connections_closed = 0;
+    queries_dropped    = 0;
+    resumed            = 0;
+    start              = 0.0;
+    duration           = 0.0;
+    rtt_histogram.clear();
+    handshake_histogram.clear();
 }
 
 DNSSender::Results operator-(const DNSSender::Results& second, const DNSSender::Results& first)
@@ -129,6 +244,8 @@ DNSSender::Results operator-(const DNSSender::Results& second, const DNSSender::
     r.counter_errors   = second.counter_errors - first.counter_errors;
     r.packages_lost    = second.packages_lost - first.packages_lost;
     r.counter_0bytes   = second.counter_0bytes - first.counter_0bytes;
+    r.dropped_local    = second.dropped_local - first.dropped_local;
+    r.backoffs         = second.backoffs - first.backoffs;
     for (int i                  = 0; i < 255; i++)
         r.counter_errorcodes[i] = second.counter_errorcodes[i] - first.counter_errorcodes[i];
     r.rtt_total                 = second.rtt_total - first.rtt_total;
@@ -141,29 +258,255 @@ DNSSender::Results operator-(const DNSSender::Results& second, const DNSSender::
 
     for (int i      = 0; i < 16; i++)
         r.rcodes[i] = second.rcodes[i] - first.rcodes[i];
-    r.truncated     = second.truncated - first.truncated;
+    r.truncated           = second.truncated - first.truncated;
+    r.connects            = second.connects - first.connects;
+    r.connect_errors      = second.connect_errors - first.connect_errors;
+    r.connections_closed  = second.connections_closed - first.connections_closed;
+    r.queries_dropped     = second.queries_dropped - first.queries_dropped;
+    r.resumed             = second.resumed - first.resumed;
+    r.rtt_histogram       = second.rtt_histogram - first.rtt_histogram;
+    r.handshake_histogram = second.handshake_histogram - first.handshake_histogram;
+    r.start               = first.start;
+    r.duration            = second.duration - first.duration;
     return r;
 }
 
+/*
+ * Text form of the results for the agent protocol: "key=value" pairs
+ * separated by blanks, counters and histogram buckets which are 0 are
+ * left out.
+ */
+ppl7::String DNSSender::Results::serialize() const
+{
+    ppl7::String s;
+    s.setf("send=%llu rcv=%llu bsend=%llu brcv=%llu err=%llu zero=%llu tc=%llu "
+           "rtt_total=%0.9f rtt_min=%0.9f rtt_max=%0.9f "
+           "connects=%llu cerr=%llu closed=%llu dropped=%llu resumed=%llu "
+           "ldrop=%llu backoffs=%llu start=%0.6f dur=%0.6f",
+        counter_send, counter_received, bytes_send, bytes_received, counter_errors,
+        counter_0bytes, truncated, rtt_total, rtt_min, rtt_max,
+        connects, connect_errors, connections_closed, queries_dropped, resumed,
+        dropped_local, backoffs, start, duration);
+    for (int i = 0; i < 255; i++) {
+        if (counter_errorcodes[i])
+            s.appendf(" e%d=%llu", i, counter_errorcodes[i]);
+    }
+    for (int i = 0; i < 16; i++) {
+        if (rcodes[i])
+            s.appendf(" rc%d=%llu", i, rcodes[i]);
+    }
+    for (int i = 0; i < RTTHistogram::BUCKETS; i++) {
+        if (rtt_histogram.bucketCount(i))
+            s.appendf(" h%d=%llu", i, rtt_histogram.bucketCount(i));
+        if (handshake_histogram.bucketCount(i))
+            s.appendf(" hs%d=%llu", i, handshake_histogram.bucketCount(i));
+    }
+    return s;
+}
+
+void DNSSender::Results::unserialize(const ppl7::String& data)
+{
+    clear();
+    ppl7::Array tok(data, " ", 0, true);
+    ppl7::Array matches;
+    for (size_t i = 0; i < tok.size(); i++) {
+        if (!tok[i].pregMatch("/^([a-z_]+)([0-9]*)=([0-9.eE+-]+)$/", matches))
+            throw AgentProtocolError("invalid result: %s", (const char*)tok[i]);
+        const ppl7::String& key   = matches[1];
+        int                 index = matches[2].toInt();
+        ppluint64           value = matches[3].toUnsignedInt64();
+        if (key == "send")
+            counter_send = value;
+        else if (key == "rcv")
+            counter_received = value;
+        else if (key == "bsend")
+            bytes_send = value;
+        else if (key == "brcv")
+            bytes_received = value;
+        else if (key == "err")
+            counter_errors = value;
+        else if (key == "zero")
+            counter_0bytes = value;
+        else if (key == "tc")
+            truncated = value;
+        else if (key == "rtt_total")
+            rtt_total = matches[3].toDouble();
+        else if (key == "rtt_min")
+            rtt_min = matches[3].toDouble();
+        else if (key == "rtt_max")
+            rtt_max = matches[3].toDouble();
+        else if (key == "connects")
+            connects = value;
+        else if (key == "cerr")
+            connect_errors = value;
+        else if (key == "closed")
+            connections_closed = value;
+        else if (key == "dropped")
+            queries_dropped = value;
+        else if (key == "resumed")
+            resumed = value;
+        else if (key == "ldrop")
+            dropped_local = value;
+        else if (key == "backoffs")
+            backoffs = value;
+        else if (key == "start")
+            start = matches[3].toDouble();
+        else if (key == "dur")
+            duration = matches[3].toDouble();
+        else if (key == "e" && index < 255)
+            counter_errorcodes[index] = value;
+        else if (key == "rc" && index < 16)
+            rcodes[index] = value;
+        else if (key == "h")
+            rtt_histogram.addBucket(index, value);
+        else if (key == "hs")
+            handshake_histogram.addBucket(index, value);
+    }
+    if (counter_received)
+        rtt_avg = rtt_total / counter_received; //NOSONAR
+    packages_lost = 0;
+    if (counter_send > counter_received)
+        packages_lost = counter_send - counter_received;
+}
+
+DNSSender::Results& DNSSender::Results::operator+=(const DNSSender::Results& other)
+{
+    if (other.counter_received) {
+        if (!counter_received || other.rtt_min < rtt_min)
+            rtt_min = other.rtt_min;
+        if (other.rtt_max > rtt_max)
+            rtt_max = other.rtt_max;
+    }
+    queryrate += other.queryrate;
+    counter_send += other.counter_send;
+    counter_received += other.counter_received;
+    bytes_send += other.bytes_send;
+    bytes_received += other.bytes_received;
+    counter_errors += other.counter_errors;
+    packages_lost += other.packages_lost;
+    counter_0bytes += other.counter_0bytes;
+    dropped_local += other.dropped_local;
+    backoffs += other.backoffs;
+    for (int i = 0; i < 255; i++)
+        counter_errorcodes[i] += other.counter_errorcodes[i];
+    for (int i = 0; i < 16; i++)
+        rcodes[i] += other.rcodes[i];
+    truncated += other.truncated;
+    rtt_total += other.rtt_total;
+    rtt_avg = counter_received ? rtt_total / counter_received : 0.0; //NOSONAR
+    connects += other.connects;
+    connect_errors += other.connect_errors;
+    connections_closed += other.connections_closed;
+    queries_dropped += other.queries_dropped;
+    resumed += other.resumed;
+    rtt_histogram += other.rtt_histogram;
+    handshake_histogram += other.handshake_histogram;
+    // the measurement window covers the windows of all agents
+    if (duration <= 0.0) {
+        start    = other.start;
+        duration = other.duration;
+    } else if (other.duration > 0.0) {
+        double end = std::max(start + duration, other.start + other.duration);
+        start      = std::min(start, other.start);
+        duration   = end - start;
+    }
+    return *this;
+}
+
+/*
+ * Average per second of the measurement window
+ */
+double DNSSender::Results::perSecond(double value) const
+{
+    if (duration <= 0.0)
+        return 0.0;
+    return value / duration;
+}
+
+DNSSender::SearchProbe::SearchProbe()
+{
+    queryrate     = 0;
+    runs          = 0;
+    passed        = 0;
+    qps_send      = 0.0;
+    loss_min      = 0.0;
+    loss_max      = 0.0;
+    p99_min       = 0.0;
+    p99_max       = 0.0;
+    senderLimited = false;
+}
+
+bool DNSSender::SearchProbe::ok() const
+{
+    return passed * 2 > runs;
+}
+
+DNSSender::StepInfo::StepInfo()
+{
+    queryrate   = 0;
+    outstanding = 0;
+    timeouts    = 0;
+    start       = 0;
+    begin       = 0.0;
+    end         = 0.0;
+    warmup      = 0.0;
+    steady      = false;
+    warming     = false;
+}
+
 DNSSender::DNSSender()
 {
     ppl7::InitSockets();
     Runtime         = 10;
+    Warmup          = 0;
+    SteadyTolerance = 0.0f;
     Timeout         = 2;
     ThreadCount     = 1;
     Timeslices      = 1.0f;
     ignoreResponses = false;
     DnssecRate      = 0;
-    TargetPort      = 53;
     spoofingEnabled = false;
     Receiver        = NULL;
+    Metrics         = NULL;
+    Window          = NULL;
+    Coordinator     = NULL;
+    Control         = NULL;
+    coordinatorMode = false;
+    classStats      = false;
+    backoff         = false;
+    Outstanding     = 0;
+    Engine          = DNSSenderThread::ENGINE_RAW;
+    SocketCount     = 8;
+    Pipeline        = 100;
+    Churn           = 0;
+    resumeSessions  = true;
+    closedLoop      = false;
+    perThreadWindow = false;
+    searchMode      = false;
+    SearchRuns      = 2;
+    PhaseInterval   = 0;
+    SlaLoss         = 1.0f;
+    ZipfExponent    = 0.0f;
+    SlaP99          = 0.0f;
     spoofFromPcap   = false;
+    CurrentStep     = 0;
+    CurrentRate     = 0;
+    ClockStep       = 0;
 }
 
 DNSSender::~DNSSender()
 {
     if (Receiver)
         delete Receiver;
+    if (Metrics)
+        delete Metrics;
+    if (Window)
+        delete Window;
+    if (Control)
+        delete Control;
+    std::list<PayloadFile*>::iterator it;
+    for (it = payloads.begin(); it != payloads.end(); ++it)
+        delete *it;
 }
 
 ppl7::Array DNSSender::getQueryRates(const ppl7::String& QueryRates)
@@ -189,23 +532,20 @@ void DNSSender::getTarget(int argc, char** argv)
     if (!ppl7::HaveArgv(argc, argv, "-z")) {
         throw MissingCommandlineParameter("target IP/hostname or port missing (-z IP:PORT)");
     }
-    ppl7::String Tmp = ppl7::GetArgv(argc, argv, "-z");
-    ppl7::Array  Tok(Tmp, ":");
-    if (Tok.size() != 2) {
-        if (Tok.size() != 1)
-            throw InvalidCommandlineParameter("-z IP:PORT");
-        TargetPort = 53;
-    } else {
-        TargetPort = Tok[1].toInt();
-    }
-    if (TargetPort < 1 || TargetPort > 65535)
-        throw InvalidCommandlineParameter("-z IP:PORT, Invalid Port");
-    std::list<ppl7::IPAddress> Result;
-    size_t                     num = ppl7::GetHostByName(Tok[0], Result, ppl7::af_inet);
-    if (!num)
-        throw InvalidCommandlineParameter("-z IP:PORT, Invalid IP or could not resolve Hostname");
-    TargetIP = Result.front();
-    //printf ("num=%d, %s\n",num, (const char*)TargetIP.toString());
+    // IPv6 addresses need brackets if a port is given: [2001:db8::1]:53
+    targets.parse(ppl7::GetArgv(argc, argv, "-z"));
+    ppl7::String Tmp = ppl7::GetArgv(argc, argv, "--target-select").toLowerCase();
+    if (Tmp.isEmpty())
+        targets.setSelection(targets.hasWeights() ? TargetList::SELECT_WEIGHT : TargetList::SELECT_ROUND_ROBIN);
+    else if (Tmp == "rr")
+        targets.setSelection(TargetList::SELECT_ROUND_ROBIN);
+    else if (Tmp == "weight")
+        targets.setSelection(TargetList::SELECT_WEIGHT);
+    else if (Tmp == "hash")
+        targets.setSelection(TargetList::SELECT_HASH);
+    else
+        throw InvalidCommandlineParameter("--target-select must be rr, weight or hash");
+    targets.compile();
 }
 
 void DNSSender::getSource(int argc, char** argv)
@@ -216,23 +556,136 @@ void DNSSender::getSource(int argc, char** argv)
             spoofFromPcap = true;
         } else {
             SourceNet.set(Tmp);
-            if (SourceNet.family() != ppl7::IPAddress::IPv4)
-                throw UnsupportedIPFamily("only IPv4 works");
+            if (SourceNet.family() != targets.family())
+                throw UnsupportedIPFamily("-s NETWORK must be of the same address family as the target");
         }
         spoofingEnabled = true;
     } else {
         ppl7::String               Tmp = ppl7::GetArgv(argc, argv, "-q");
         std::list<ppl7::IPAddress> Result;
-        size_t                     num = ppl7::GetHostByName(Tmp, Result, ppl7::af_inet);
+        size_t                     num = ppl7::GetHostByName(Tmp, Result,
+            targets.family() == ppl7::IPAddress::IPv6 ? ppl7::af_inet6 : ppl7::af_inet);
         if (!num)
-            throw InvalidCommandlineParameter("-q HOST, Invalid IP or could not resolve Hostname");
+            throw InvalidCommandlineParameter("-q HOST, Invalid IP or could not resolve Hostname of the address family of the target");
         SourceIP = Result.front();
-        if (SourceIP.family() != ppl7::IPAddress::IPv4)
-            throw UnsupportedIPFamily("only IPv4 works");
         spoofingEnabled = false;
     }
 }
 
+int DNSSender::getEngineParameter(int argc, char** argv)
+{
+    ppl7::String Tmp = ppl7::GetArgv(argc, argv, "--engine").toLowerCase();
+    if (Tmp.isEmpty() || Tmp == "raw") {
+        Engine = DNSSenderThread::ENGINE_RAW;
+        return 0;
+    }
+    if (Tmp == "udp") {
+        Engine = DNSSenderThread::ENGINE_UDP;
+    } else if (Tmp == "tcp") {
+        Engine = DNSSenderThread::ENGINE_TCP;
+    } else if (Tmp == "dot") {
+        Engine = DNSSenderThread::ENGINE_DOT;
+        resumeSessions = !ppl7::HaveArgv(argc, argv, "--no-resume");
+    } else {
+        printf("ERROR: unknown engine \"%s\" (--engine raw|udp|tcp|dot)\n\n", (const char*)Tmp);
+        help();
+        return 1;
+    }
+    if (ppl7::HaveArgv(argc, argv, "--sockets"))
+        SocketCount = ppl7::GetArgv(argc, argv, "--sockets").toInt();
+    if (ppl7::HaveArgv(argc, argv, "--pipeline"))
+        Pipeline = ppl7::GetArgv(argc, argv, "--pipeline").toInt();
+    if (ppl7::HaveArgv(argc, argv, "--churn"))
+        Churn = ppl7::GetArgv(argc, argv, "--churn").toInt();
+    if (SocketCount < 1) {
+        printf("ERROR: number of sockets must be at least 1 (--sockets #)\n\n");
+        help();
+        return 1;
+    }
+    if (Pipeline < 1 || Pipeline > 65535 || Churn < 0) {
+        printf("ERROR: invalid TCP connection parameter (--pipeline # | --churn #)\n\n");
+        help();
+        return 1;
+    }
+    if ((Engine == DNSSenderThread::ENGINE_TCP || Engine == DNSSenderThread::ENGINE_DOT) && ignoreResponses) {
+        printf("ERROR: TCP connections need the responses, --engine %s can not be used with --ignore\n\n",
+            (const char*)Tmp);
+        help();
+        return 1;
+    }
+    if (spoofingEnabled) {
+        printf("ERROR: --engine %s can not spoof the sender address, use -q instead of -s\n\n",
+            (const char*)Tmp);
+        help();
+        return 1;
+    }
+    return 0;
+}
+
+int DNSSender::getEDNSParameter(int argc, char** argv)
+{
+    try {
+        edns.setNSID(ppl7::HaveArgv(argc, argv, "--nsid"));
+        if (ppl7::HaveArgv(argc, argv, "--cookie"))
+            edns.setCookies(ppl7::GetArgv(argc, argv, "--cookie").toInt());
+        if (ppl7::HaveArgv(argc, argv, "--padding"))
+            edns.setPadding(ppl7::GetArgv(argc, argv, "--padding").toInt());
+        if (ppl7::HaveArgv(argc, argv, "--ecs")) {
+            ppl7::Array     Tok(ppl7::GetArgv(argc, argv, "--ecs"), ",");
+            ppl7::IPNetwork net(Tok[0]);
+            int             len = (net.family() == ppl7::IPAddress::IPv6) ? 56 : 24;
+            if (Tok.size() > 1)
+                len = Tok[1].toInt();
+            edns.setClientSubnet(net, len);
+        }
+    } catch (const ppl7::Exception& e) {
+        printf("ERROR: invalid EDNS option (--ecs NET[,LEN] | --cookie # | --padding #)\n");
+        e.print();
+        printf("\n");
+        help();
+        return 1;
+    }
+    edns.compile();
+    return 0;
+}
+
+int DNSSender::getClosedLoopParameter(int argc, char** argv)
+{
+    if (ppl7::HaveArgv(argc, argv, "-o") && ppl7::HaveArgv(argc, argv, "-O")) {
+        printf("ERROR: could not use parameters -o and -O together\n\n");
+        help();
+        return 1;
+    }
+    if (!ppl7::HaveArgv(argc, argv, "-o") && !ppl7::HaveArgv(argc, argv, "-O"))
+        return 0;
+    closedLoop      = true;
+    perThreadWindow = ppl7::HaveArgv(argc, argv, "-O");
+    concurrency     = getQueryRates(ppl7::GetArgv(argc, argv, perThreadWindow ? "-O" : "-o"));
+    for (size_t i = 0; i < concurrency.size(); i++) {
+        if (concurrency[i].toInt() < 1) {
+            printf("ERROR: number of outstanding queries must be at least 1 (-o # | -O #)\n\n");
+            help();
+            return 1;
+        }
+    }
+    if (ppl7::HaveArgv(argc, argv, "-r")) {
+        printf("ERROR: closed-loop mode (-o | -O) can not be used with a query rate (-r)\n\n");
+        help();
+        return 1;
+    }
+    if (ignoreResponses) {
+        printf("ERROR: closed-loop mode (-o | -O) needs the responses, it can not be used with --ignore\n\n");
+        help();
+        return 1;
+    }
+    if (perThreadWindow && spoofFromPcap) {
+        printf("ERROR: -O needs random source ports and can not be used with -s pcap, use -o instead\n\n");
+        help();
+        return 1;
+    }
+    return 0;
+}
+
 int DNSSender::getParameter(int argc, char** argv)
 {
     if (ppl7::HaveArgv(argc, argv, "-q") && ppl7::HaveArgv(argc, argv, "-s")) {
@@ -267,7 +720,11 @@ int DNSSender::getParameter(int argc, char** argv)
     ThreadCount             = ppl7::GetArgv(argc, argv, "-n").toInt();
     ppl7::String QueryRates = ppl7::GetArgv(argc, argv, "-r");
     CSVFileName             = ppl7::GetArgv(argc, argv, "-c");
+    MetricsFileName         = ppl7::GetArgv(argc, argv, "--metrics");
+    MetricsJsonFileName     = ppl7::GetArgv(argc, argv, "--metrics-json");
+    ControlPath             = ppl7::GetArgv(argc, argv, "--control");
     QueryFilename           = ppl7::GetArgv(argc, argv, "-p");
+    QueryTemplate           = ppl7::GetArgv(argc, argv, "--generate");
     if (ppl7::HaveArgv(argc, argv, "-d")) {
         DnssecRate = ppl7::GetArgv(argc, argv, "-d").toInt();
         if (DnssecRate < 0 || DnssecRate > 100) {
@@ -282,16 +739,137 @@ int DNSSender::getParameter(int argc, char** argv)
         Runtime = 10;
     if (!Timeout)
         Timeout = 2;
-    if (QueryFilename.isEmpty()) {
-        printf("ERROR: Payload-File is missing (-p FILENAME)\n\n");
+    if (QueryFilename.isEmpty() && QueryTemplate.isEmpty()) {
+        printf("ERROR: Payload-File is missing (-p FILENAME | --generate TEMPLATE)\n\n");
+        help();
+        return 1;
+    }
+    if (QueryFilename.notEmpty() && QueryTemplate.notEmpty()) {
+        printf("ERROR: could not use parameters -p and --generate together\n\n");
+        help();
+        return 1;
+    }
+    if (ppl7::HaveArgv(argc, argv, "--zipf")) {
+        ZipfExponent = ppl7::GetArgv(argc, argv, "--zipf").toFloat();
+        if (ZipfExponent <= 0.0f) {
+            printf("ERROR: the exponent of the Zipf distribution must be greater than 0 (--zipf #)\n\n");
+            help();
+            return 1;
+        }
+    }
+    WeightsFilename = ppl7::GetArgv(argc, argv, "--weights");
+    if (ZipfExponent > 0.0f && WeightsFilename.notEmpty()) {
+        printf("ERROR: could not use parameters --zipf and --weights together\n\n");
+        help();
+        return 1;
+    }
+    if (QueryTemplate.notEmpty() && (ZipfExponent > 0.0f || WeightsFilename.notEmpty())) {
+        printf("ERROR: --zipf and --weights need a payload file (-p FILENAME)\n\n");
+        help();
+        return 1;
+    }
+    if (QueryTemplate.notEmpty() && spoofFromPcap) {
+        printf("ERROR: \"-s pcap\" needs a pcap file as payload (-p FILENAME)\n\n");
         help();
         return 1;
     }
+    if (ppl7::HaveArgv(argc, argv, "--qclass")) {
+        try {
+            qclasses.parse(ppl7::GetArgv(argc, argv, "--qclass"));
+        } catch (const ppl7::Exception& e) {
+            printf("ERROR: invalid query classes (--qclass LABEL=TYPE,...;LABEL=TYPE,...)\n");
+            e.print();
+            printf("\n");
+            help();
+            return 1;
+        }
+        classStats = true;
+    } else if (ppl7::HaveArgv(argc, argv, "--qtype-stats")) {
+        qclasses.setDefault();
+        classStats = true;
+    }
+    if (ppl7::HaveArgv(argc, argv, "--backoff"))
+        backoff = true;
+    if (ppl7::HaveArgv(argc, argv, "--phase-timing")) {
+        PhaseInterval = ppl7::GetArgv(argc, argv, "--phase-timing").toInt();
+        if (PhaseInterval < 1) {
+            printf("ERROR: interval for phase timing must be at least 1 (--phase-timing #)\n\n");
+            help();
+            return 1;
+        }
+    }
     rates = getQueryRates(QueryRates);
+    if (getEngineParameter(argc, argv) != 0)
+        return 1;
+    targets.setDefaultPort((Engine == DNSSenderThread::ENGINE_DOT) ? 853 : 53);
+    if (getEDNSParameter(argc, argv) != 0)
+        return 1;
+    if (getClosedLoopParameter(argc, argv) != 0)
+        return 1;
+    if (getWarmupParameter(argc, argv) != 0)
+        return 1;
+    return getSearchParameter(argc, argv);
+}
+
+int DNSSender::getWarmupParameter(int argc, char** argv)
+{
+    if (ppl7::HaveArgv(argc, argv, "--warmup")) {
+        Warmup = ppl7::GetArgv(argc, argv, "--warmup").toInt();
+        if (Warmup < 1) {
+            printf("ERROR: warm-up must be at least 1 second (--warmup #)\n\n");
+            help();
+            return 1;
+        }
+    }
+    if (ppl7::HaveArgv(argc, argv, "--steady")) {
+        SteadyTolerance = ppl7::GetArgv(argc, argv, "--steady").toFloat();
+        if (SteadyTolerance <= 0.0f) {
+            printf("ERROR: tolerance for the steady state must be greater than 0 (--steady #)\n\n");
+            help();
+            return 1;
+        }
+        if (!Warmup)
+            Warmup = 30;
+    }
     return 0;
 }
 
-int DNSSender::openFiles()
+int DNSSender::getSearchParameter(int argc, char** argv)
+{
+    if (!ppl7::HaveArgv(argc, argv, "--search"))
+        return 0;
+    searchMode  = true;
+    SearchRange = ppl7::GetArgv(argc, argv, "-r");
+    if (ppl7::HaveArgv(argc, argv, "--sla-loss"))
+        SlaLoss = ppl7::GetArgv(argc, argv, "--sla-loss").toFloat();
+    if (ppl7::HaveArgv(argc, argv, "--sla-p99"))
+        SlaP99 = ppl7::GetArgv(argc, argv, "--sla-p99").toFloat();
+    if (ppl7::HaveArgv(argc, argv, "--search-runs"))
+        SearchRuns = ppl7::GetArgv(argc, argv, "--search-runs").toInt();
+    if (!SearchRange.pregMatch("/^[0-9]+-[0-9]+(,[0-9]+)?$/")) {
+        printf("ERROR: --search needs a range of queryrates (-r start-end[,step])\n\n");
+        help();
+        return 1;
+    }
+    if (SlaLoss < 0.0f || SlaLoss > 100.0f || SlaP99 < 0.0f) {
+        printf("ERROR: invalid service level (--sla-loss # | --sla-p99 #)\n\n");
+        help();
+        return 1;
+    }
+    if (SearchRuns < 1) {
+        printf("ERROR: number of runs per queryrate must be at least 1 (--search-runs #)\n\n");
+        help();
+        return 1;
+    }
+    if (closedLoop || ignoreResponses) {
+        printf("ERROR: --search can not be used with closed-loop mode (-o | -O) or --ignore\n\n");
+        help();
+        return 1;
+    }
+    return 0;
+}
+
+int DNSSender::openOutputFiles()
 {
     if (CSVFileName.notEmpty()) {
         try {
@@ -302,6 +880,40 @@ int DNSSender::openFiles()
             return 1;
         }
     }
+    if (MetricsFileName.notEmpty() || MetricsJsonFileName.notEmpty()) {
+        Metrics = new MetricsWriter();
+        if (MetricsFileName.notEmpty())
+            Metrics->setOpenMetricsFile(MetricsFileName);
+        if (MetricsJsonFileName.notEmpty())
+            Metrics->setJsonFile(MetricsJsonFileName);
+    }
+    if (ControlPath.notEmpty()) {
+        Control = new ControlSocket();
+        try {
+            Control->listen(ControlPath);
+        } catch (const ppl7::Exception& e) {
+            printf("ERROR: could not create control socket\n");
+            e.print();
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int DNSSender::openFiles()
+{
+    if (openOutputFiles() != 0)
+        return 1;
+    if (QueryTemplate.notEmpty()) {
+        try {
+            generator.compile(QueryTemplate);
+        } catch (const ppl7::Exception& e) {
+            printf("ERROR: invalid query template (--generate)\n");
+            e.print();
+            return 1;
+        }
+        return 0;
+    }
     try {
         payload.openQueryFile(QueryFilename);
     } catch (const ppl7::Exception& e) {
@@ -309,51 +921,144 @@ int DNSSender::openFiles()
         e.print();
         return 1;
     }
+    try {
+        if (ZipfExponent > 0.0f)
+            payload.setZipf(ZipfExponent);
+        else if (WeightsFilename.notEmpty())
+            payload.loadWeights(WeightsFilename);
+    } catch (const ppl7::Exception& e) {
+        printf("ERROR: could not set the popularity of the queries\n");
+        e.print();
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Creates the receiver, the concurrency window and the sender threads and
+ * starts them. The threads are kept running until stopSession(), they wait
+ * for the steps in the step clock.
+ */
+int DNSSender::startSession()
+{
+    if (!ignoreResponses && Engine == DNSSenderThread::ENGINE_RAW) {
+        Receiver = new DNSReceiverThread();
+        Receiver->setTargets(targets);
+        try {
+            Receiver->setInterface(InterfaceName);
+        } catch (const ppl7::Exception& e) {
+            printf("ERROR: could not bind on device [%s]\n", (const char*)InterfaceName);
+            e.print();
+            printf("\n");
+            help();
+            return 1;
+        }
+    }
+    if (Receiver && classStats)
+        Receiver->setQueryClasses(&qclasses);
+    if (Receiver)
+        Receiver->setPhaseTiming(PhaseInterval);
+    if (closedLoop) {
+        Window = new ConcurrencyWindow(perThreadWindow ? ThreadCount : 1, Timeout);
+        if (Receiver)
+            Receiver->setConcurrencyWindow(Window);
+    }
+    prepareThreads();
+    Clock.setParties(ThreadCount);
+    if (Receiver) {
+        Receiver->setStepClock(&Clock);
+        Receiver->threadStart();
+    }
+    threadpool.startThreads();
     return 0;
 }
 
+/*
+ * Stops the threads, their counters can still be read
+ */
+void DNSSender::stopThreads()
+{
+    Clock.finish();
+    threadpool.stopThreads();
+    if (Receiver && Receiver->threadIsRunning())
+        Receiver->threadStop();
+}
+
+void DNSSender::stopSession()
+{
+    stopThreads();
+    threadpool.destroyAllThreads();
+}
+
 int DNSSender::main(int argc, char** argv)
 {
     if (ppl7::HaveArgv(argc, argv, "-h") || ppl7::HaveArgv(argc, argv, "--help") || argc < 2) {
         help();
         return 0;
     }
+    if (ppl7::HaveArgv(argc, argv, "--agent"))
+        return runAgent(argc, argv);
     if (getParameter(argc, argv) != 0)
         return 1;
+    if (ppl7::HaveArgv(argc, argv, "--agents"))
+        return coordinate(argc, argv);
     if (openFiles() != 0)
         return 1;
 
     signal(SIGINT, sighandler);
-    signal(SIGKILL, sighandler);
+    signal(SIGTERM, sighandler);
+    signal(SIGPIPE, SIG_IGN);
 
     DNSSender::Results results;
     try {
-        if (!ignoreResponses) {
-            Receiver = new DNSReceiverThread();
-            Receiver->setSource(TargetIP, TargetPort);
-            try {
-                Receiver->setInterface(InterfaceName);
-            } catch (const ppl7::Exception& e) {
-                printf("ERROR: could not bind on device [%s]\n", (const char*)InterfaceName);
-                e.print();
-                printf("\n");
-                help();
-                return 1;
+        if (startSession() != 0)
+            return 1;
+        if (searchMode) {
+            searchCapacity();
+            stopSession();
+            return 0;
+        }
+        // The next step starts right after the previous one, its results
+        // are presented as soon as the last responses had time to arrive.
+        const ppl7::Array& steps   = closedLoop ? concurrency : rates;
+        int                pending = 0;
+        for (size_t i = 0; i < steps.size(); i++) {
+            CurrentStep = (int)i;
+            bool last   = (i + 1 == steps.size());
+            int  step;
+            if (closedLoop) {
+                Outstanding = steps[i].toInt();
+                step        = startStep(0, last);
+            } else {
+                step = startStep(steps[i].toInt(), last);
             }
+            if (pending) {
+                watchStep(step, Clock.graceEnd());
+                presentStep(pending, results);
+                saveResultsToCsv(results);
+            }
+            if (Warmup)
+                step = measureStep(step, last);
+            watchStep(step, 0.0);
+            endStep(step);
+            pending = step;
         }
-        prepareThreads();
-        for (size_t i = 0; i < rates.size(); i++) {
-            results.queryrate = rates[i].toInt();
-            run(rates[i].toInt());
-            getResults(results);
-            presentResults(results);
+        if (pending) {
+            presentStep(pending, results);
             saveResultsToCsv(results);
         }
-        threadpool.destroyAllThreads();
+        stopSession();
     } catch (const ppl7::OperationInterruptedException&) {
-        getResults(results);
-        presentResults(results);
-        saveResultsToCsv(results);
+        if (ClockStep) {
+            endStep(ClockStep);
+            // an interrupted warm-up is not a measurement
+            if (!stepInfo[ClockStep & 1].warming) {
+                presentStep(ClockStep, results);
+                saveResultsToCsv(results);
+            }
+        }
+        if (searchMode)
+            presentSearchSummary();
     } catch (const ppl7::Exception& e) {
         e.print();
         return 1;
@@ -365,13 +1070,26 @@ void DNSSender::prepareThreads()
 {
     for (int i = 0; i < ThreadCount; i++) {
         DNSSenderThread* thread = new DNSSenderThread();
-        thread->setDestination(TargetIP, TargetPort);
-        thread->setRuntime(Runtime);
+        thread->setTargets(&targets);
         thread->setTimeout(Timeout);
         thread->setTimeslice(Timeslices);
         thread->setDNSSECRate(DnssecRate);
+        if (edns.enabled())
+            thread->setEDNSOptions(&edns);
         thread->setVerbose(false);
-        thread->setPayload(payload);
+        if (generator.enabled())
+            thread->setQueryGenerator(&generator, i);
+        else
+            thread->setPayload(payload);
+        thread->setConcurrencyWindow(Window, perThreadWindow ? i : 0);
+        thread->setEngine(Engine, SocketCount);
+        thread->setPipeline(Pipeline, Churn);
+        thread->setSessionResumption(resumeSessions);
+        thread->setIgnoreResponses(ignoreResponses);
+        if (classStats)
+            thread->setQueryClasses(&qclasses);
+        thread->setPhaseTiming(PhaseInterval);
+        thread->setBackoff(backoff);
         if (spoofingEnabled) {
             if (spoofFromPcap)
                 thread->setSourcePcap();
@@ -380,7 +1098,9 @@ void DNSSender::prepareThreads()
         } else {
             thread->setSourceIP(SourceIP);
         }
+        thread->setStepClock(&Clock);
         threadpool.addThread(thread);
+        thread->openSockets();
     }
 }
 
@@ -389,17 +1109,32 @@ void DNSSender::openCSVFile(const ppl7::String& Filename)
     CSVFile.open(Filename, ppl7::File::APPEND);
     if (CSVFile.size() == 0) {
         CSVFile.putsf("#QPS Send; QPS Received; QPS Errors; Lostrate; "
-                      "rtt_avg; rtt_min; rtt_max;"
+                      "rtt_avg; rtt_min; rtt_max; start; duration;"
                       "\n");
         CSVFile.flush();
     }
 }
 
-void DNSSender::showCurrentStats(ppl7::ppl_time_t start_time)
+void DNSSender::showCurrentStats(int step, ppl7::ppl_time_t start_time)
+{
+    DNSSender::Results result;
+    getResults(result, step);
+    if (Coordinator) {
+        try {
+            Coordinator->sendLine("STAT " + result.serialize());
+        } catch (const ppl7::Exception& e) {
+            // the step is finished anyway, the session ends with the result
+            e.print();
+            Coordinator = NULL;
+        }
+    }
+    showStats(result, start_time);
+}
+
+void DNSSender::showStats(const DNSSender::Results& result, ppl7::ppl_time_t start_time)
 {
-    DNSSender::Results result, diff;
+    DNSSender::Results diff;
     ppl7::ppl_time_t   runtime = ppl7::GetTime() - start_time;
-    getResults(result);
     diff             = result - vis_prev_results;
     vis_prev_results = result;
 
@@ -412,6 +1147,52 @@ void DNSSender::showCurrentStats(ppl7::ppl_time_t start_time)
         diff.counter_send, diff.counter_received);
     printf("Data send: %6llu KB, rcv: %6llu KB", diff.bytes_send / 1024, diff.bytes_received / 1024);
     printf("\n");
+    if (Metrics)
+        writeMetrics(result, (double)start_time);
+}
+
+void DNSSender::getThreadCounters(std::vector<DNSSenderThread::Counter>& counters, int step)
+{
+    ppl7::ThreadPool::iterator it;
+    counters.clear();
+    for (it = threadpool.begin(); it != threadpool.end(); ++it) {
+        DNSSenderThread::Counter counter;
+        ((DNSSenderThread*)(*it))->getCounter(counter, step);
+        counters.push_back(counter);
+    }
+}
+
+void DNSSender::getReceiveCounter(RawSocketReceiver::Counter& counter, int step)
+{
+    counter.clear();
+    if (Receiver) {
+        Receiver->getCounter(counter, step);
+        return;
+    }
+    // the socket engines receive the responses in the sender threads
+    ppl7::ThreadPool::iterator it;
+    for (it = threadpool.begin(); it != threadpool.end(); ++it) {
+        RawSocketReceiver::Counter thread_counter;
+        ((DNSSenderThread*)(*it))->getReceiveCounter(thread_counter, step);
+        counter += thread_counter;
+    }
+}
+
+void DNSSender::writeMetrics(const DNSSender::Results& result, double start_time)
+{
+    MetricsWriter::Sample sample;
+    sample.timestamp         = ppl7::GetMicrotime();
+    sample.elapsed           = sample.timestamp - start_time;
+    sample.step              = CurrentStep;
+    sample.results           = result;
+    sample.results.queryrate = CurrentRate;
+    getThreadCounters(sample.threads, ClockStep);
+    try {
+        sampleSensorData(sample.sys);
+    } catch (const ppl7::Exception&) {
+        // system statistics are optional
+    }
+    Metrics->write(sample);
 }
 
 void DNSSender::calcTimeslice(int queryrate)
@@ -422,10 +1203,30 @@ void DNSSender::calcTimeslice(int queryrate)
         Timeslices = 0.1f;
 }
 
-void DNSSender::run(int queryrate)
+/*
+ * Sets the rates of the threads and starts the next step as soon as all
+ * threads have finished the current one. With drain the threads wait for
+ * the outstanding responses at the end of the step, otherwise responses to
+ * queries of this step are still counted for it during the first Timeout
+ * seconds of the next step. Returns the number of the step.
+ *
+ * With --warmup the step started is the warm-up, measureStep() starts the
+ * step which is measured after it.
+ */
+int DNSSender::startStep(int queryrate, bool drain)
 {
+    while (!Clock.waitIdle(ppl7::GetMicrotime() + 0.1)) {
+        if (stopFlag == true) {
+            stopThreads();
+            throw ppl7::OperationInterruptedException("test aborted");
+        }
+    }
     printf("###############################################################################\n");
-    if (queryrate) {
+    if (Window) {
+        Window->reset(Outstanding);
+        printf("# Start Session with Threads: %d, closed loop with %d outstanding queries%s\n",
+            ThreadCount, Outstanding, perThreadWindow ? " per thread" : "");
+    } else if (queryrate) {
         calcTimeslice(queryrate);
         printf("# Start Session with Threads: %d, Queryrate: %d, Timeslot: %0.6f ms\n",
             ThreadCount, queryrate, Timeslices);
@@ -440,48 +1241,301 @@ void DNSSender::run(int queryrate)
         ((DNSSenderThread*)(*it))->setTimeslice(Timeslices);
     }
     vis_prev_results.clear();
-    sampleSensorData(sys1);
-    if (Receiver)
-        Receiver->threadStart();
-    threadpool.startThreads();
-    ppl7::ppl_time_t start  = ppl7::GetTime();
-    ppl7::ppl_time_t report = start + 1;
-    ppl7::MSleep(500);
-    while (threadpool.running() == true && stopFlag == false) {
-        ppl7::MSleep(100);
-        ppl7::ppl_time_t now = ppl7::GetTime();
-        if (now >= report) {
-            report = now + 1;
-            showCurrentStats(start);
-        }
-    }
-    if (Receiver)
-        Receiver->threadStop();
-    sampleSensorData(sys2);
-    if (stopFlag == true) {
-        threadpool.stopThreads();
-        throw ppl7::OperationInterruptedException("test aborted");
+    CurrentRate = queryrate;
+    if (Metrics)
+        Metrics->startStep();
+    if (Warmup) {
+        printf("# Warm-up: %d s%s\n", Warmup, SteadyTolerance > 0.0f ? " at most" : "");
+        int step                   = beginStep(Warmup, false);
+        stepInfo[step & 1].warming = true;
+        return step;
     }
+    return beginStep(Runtime, drain);
 }
 
-void DNSSender::getResults(DNSSender::Results& result)
+int DNSSender::beginStep(int duration, bool drain)
 {
-    ppl7::ThreadPool::iterator it;
-    result.clear();
+    StepInfo& info   = stepInfo[(ClockStep + 1) & 1];
+    info.queryrate   = CurrentRate;
+    info.outstanding = Outstanding;
+    // the window is not reset after the warm-up
+    info.timeouts = Window ? Window->getTimeouts() : 0;
+    info.start    = ppl7::GetTime();
+    info.warmup   = 0.0;
+    info.steady   = false;
+    info.warming  = false;
+    sampleSensorData(info.sys1);
+    ClockStep  = Clock.begin(duration, Timeout, drain);
+    info.begin = Clock.startTime();
+    info.end   = info.begin + duration;
+    return ClockStep;
+}
+
+/*
+ * Waits for the end of the warm-up step and starts the measured step with
+ * the same settings right after it. Responses to queries of the warm-up
+ * are counted for the warm-up, which is not presented.
+ */
+int DNSSender::measureStep(int step, bool drain)
+{
+    double    begin    = stepInfo[step & 1].begin;
+    bool      steady   = warmUp(step);
+    double    end      = stopTime();
+    int       measured = beginStep(Runtime, drain);
+    StepInfo& info     = stepInfo[measured & 1];
+    info.warmup        = end - begin;
+    info.steady        = steady;
+    vis_prev_results.clear();
+    printf("# Warm-up %s after %0.3f s, measuring for %d s\n",
+        steady ? "steady" : "ended", info.warmup, Runtime);
+    return measured;
+}
+
+// true if the last STEADY_SECONDS values differ by at most tolerance
+// percent of their mean
+static bool is_steady(const std::vector<double>& values, float tolerance)
+{
+    if (values.size() < STEADY_SECONDS)
+        return false;
+    double min = values.back(), max = values.back(), sum = 0.0;
+    for (size_t i = values.size() - STEADY_SECONDS; i < values.size(); i++) {
+        min = std::min(min, values[i]);
+        max = std::max(max, values[i]);
+        sum += values[i];
+    }
+    if (sum <= 0.0)
+        return false;
+    return (max - min) <= sum / STEADY_SECONDS * tolerance / 100.0;
+}
+
+/*
+ * Shows the statistics of the warm-up step until it is over. With --steady
+ * the warm-up is ended as soon as the responses per second and their
+ * average rtt are steady. Returns true in that case.
+ */
+bool DNSSender::warmUp(int step)
+{
+    const StepInfo&     info   = stepInfo[step & 1];
+    ppl7::ppl_time_t    report = info.start + 1;
+    double              sample = ppl7::GetMicrotime() + 1.0;
+    bool                steady = false;
+    DNSSender::Results  prev, now;
+    std::vector<double> qps, rtt;
+    getResults(prev, step);
+    while (stopFlag == false) {
+        if (Clock.waitIdle(ppl7::GetMicrotime() + 0.1))
+            break;
+        if (ppl7::GetTime() >= report) {
+            report = ppl7::GetTime() + 1;
+            showCurrentStats(step, info.start);
+        }
+        if (Control)
+            handleControl(step);
+        if (SteadyTolerance > 0.0f && !steady && ppl7::GetMicrotime() >= sample) {
+            sample += 1.0;
+            getResults(now, step);
+            DNSSender::Results diff = now - prev;
+            prev                    = now;
+            qps.push_back((double)diff.counter_received);
+            rtt.push_back(diff.rtt_avg);
+            if (is_steady(qps, SteadyTolerance) && is_steady(rtt, SteadyTolerance)) {
+                steady = true;
+                Clock.end();
+            }
+        }
+    }
+    if (stopFlag == true) {
+        stopThreads();
+        throw ppl7::OperationInterruptedException("test aborted");
+    }
+    return steady;
+}
+
+/*
+ * Time at which the last thread stopped sending in the current step
+ */
+double DNSSender::stopTime()
+{
+    double                     end = 0.0;
+    ppl7::ThreadPool::iterator it;
+    for (it = threadpool.begin(); it != threadpool.end(); ++it)
+        end = std::max(end, ((DNSSenderThread*)(*it))->getStopTime());
+    return end;
+}
+
+/*
+ * Shows the statistics of the step every second until the given time or,
+ * if it is 0, until all threads have finished the step.
+ */
+void DNSSender::watchStep(int step, double until)
+{
+    const StepInfo&  info   = stepInfo[step & 1];
+    ppl7::ppl_time_t report = info.start + 1;
+    while (stopFlag == false) {
+        double now = ppl7::GetMicrotime();
+        if (until > 0.0) {
+            if (now >= until)
+                break;
+            ppl7::MSleep(100);
+        } else if (Clock.waitIdle(now + 0.1)) {
+            break;
+        }
+        if (ppl7::GetTime() >= report) {
+            report = ppl7::GetTime() + 1;
+            showCurrentStats(step, info.start);
+        }
+        if (Control)
+            handleControl(step);
+    }
+    if (stopFlag == true) {
+        stopThreads();
+        throw ppl7::OperationInterruptedException("test aborted");
+    }
+}
+
+/*
+ * Executes the commands from the control socket, see control_socket.h
+ */
+void DNSSender::handleControl(int step)
+{
+    ppl7::String line;
+    while (Control->readCommand(line)) {
+        ppl7::String answer;
+        try {
+            answer = control(line, step);
+        } catch (const ppl7::Exception& e) {
+            answer = "ERROR " + e.toString();
+        }
+        Control->reply(answer);
+    }
+}
+
+ppl7::String DNSSender::control(const ppl7::String& line, int step)
+{
+    StepInfo&    info = stepInfo[step & 1];
+    ppl7::Array  tok(line, " ", 0, true);
+    ppl7::String command;
+    if (tok.size())
+        command = tok[0].toUpperCase();
+    if (command == "RATE" && tok.size() == 2) {
+        int rate = tok[1].toInt();
+        if (searchMode)
+            return "ERROR the rates are given by --search";
+        if (closedLoop) {
+            if (rate < 1)
+                return "ERROR invalid number of outstanding queries";
+            Outstanding      = rate;
+            info.outstanding = rate;
+            Window->setLimit(rate);
+        } else {
+            if (rate < 0 || (rate > 0 && rate < ThreadCount))
+                return "ERROR invalid queryrate";
+            if (rate)
+                calcTimeslice(rate);
+            Clock.setRate(rate / ThreadCount, Timeslices);
+            CurrentRate    = rate;
+            info.queryrate = rate;
+        }
+    } else if (command == "PAUSE" && tok.size() == 1) {
+        Clock.pause(true);
+    } else if (command == "RESUME" && tok.size() == 1) {
+        Clock.pause(false);
+    } else if (command == "STATS" && tok.size() == 1) {
+        DNSSender::Results result;
+        getResults(result, step);
+        result.queryrate = info.queryrate;
+        result.start     = info.begin;
+        result.duration  = ppl7::GetMicrotime() - info.begin;
+        if (Metrics)
+            writeMetrics(result, (double)info.start);
+        return "OK " + result.serialize();
+    } else if (command == "PAYLOAD" && tok.size() >= 2) {
+        if (generator.enabled())
+            return "ERROR the queries are generated (--generate)";
+        PayloadFile* file = new PayloadFile();
+        try {
+            file->openQueryFile(line.mid(tok[0].size()).trimmed());
+            if (ZipfExponent > 0.0f)
+                file->setZipf(ZipfExponent);
+        } catch (...) {
+            delete file;
+            throw;
+        }
+        if (spoofFromPcap && !file->isPcap()) {
+            delete file;
+            return "ERROR \"-s pcap\" needs a pcap file";
+        }
+        payloads.push_back(file);
+        Clock.setPayload(file);
+    } else if (command == "END" && tok.size() == 1) {
+        Clock.end();
+    } else {
+        return "ERROR unknown command: " + line;
+    }
+    printf("# Control: %s\n", (const char*)line);
+    return "OK";
+}
+
+void DNSSender::endStep(int step)
+{
+    StepInfo& info = stepInfo[step & 1];
+    sampleSensorData(info.sys2);
+    if (Window)
+        info.timeouts = Window->getTimeouts() - info.timeouts;
+    double end = stopTime();
+    if (end > info.begin)
+        info.end = end;
+}
+
+/*
+ * Runs a single step including the responses and returns its number.
+ */
+int DNSSender::runStep(int queryrate)
+{
+    int step = startStep(queryrate, true);
+    if (Warmup)
+        step = measureStep(step, true);
+    watchStep(step, 0.0);
+    endStep(step);
+    return step;
+}
+
+void DNSSender::presentStep(int step, DNSSender::Results& result)
+{
+    const StepInfo& info = stepInfo[step & 1];
+    getResults(result, step);
+    result.queryrate = info.queryrate;
+    result.start     = info.begin;
+    result.duration  = info.end - info.begin;
+    presentResults(result, step);
+    presentTargetResults(step);
+    presentClassResults(step);
+    presentPhaseResults(step);
+}
+
+void DNSSender::getResults(DNSSender::Results& result, int step)
+{
+    ppl7::ThreadPool::iterator it;
+    result.clear();
 
     for (it = threadpool.begin(); it != threadpool.end(); ++it) {
-        result.counter_send += ((DNSSenderThread*)(*it))->getPacketsSend();
-        result.bytes_send += ((DNSSenderThread*)(*it))->getBytesSend();
-        result.counter_errors += ((DNSSenderThread*)(*it))->getErrors();
-        result.counter_0bytes += ((DNSSenderThread*)(*it))->getCounter0Bytes();
+        DNSSenderThread::Counter counter;
+        ((DNSSenderThread*)(*it))->getCounter(counter, step);
+        result.counter_send += counter.packets_send;
+        result.bytes_send += counter.bytes_send;
+        result.counter_errors += counter.errors;
+        result.counter_0bytes += counter.counter_0bytes;
+        result.dropped_local += counter.dropped_local;
+        result.backoffs += counter.backoffs;
         for (int i = 0; i < 255; i++)
-            result.counter_errorcodes[i] += ((DNSSenderThread*)(*it))->getCounterErrorCode(i);
+            result.counter_errorcodes[i] += counter.errorcodes[i];
     }
-    if (Receiver) {
-        const RawSocketReceiver::Counter& counter = Receiver->getCounter();
-        result.counter_received                   = counter.num_pkgs;
-        result.bytes_received                     = counter.bytes_rcv;
-        result.rtt_total                          = counter.rtt_total;
+    if (Receiver || Engine != DNSSenderThread::ENGINE_RAW) {
+        RawSocketReceiver::Counter counter;
+        getReceiveCounter(counter, step);
+        result.counter_received = counter.num_pkgs;
+        result.bytes_received   = counter.bytes_rcv;
+        result.rtt_total        = counter.rtt_total;
         if (counter.num_pkgs)
             result.rtt_avg = counter.rtt_total / counter.num_pkgs; //NOSONAR
         else
@@ -491,6 +1545,19 @@ void DNSSender::getResults(DNSSender::Results& result)
         for (int i           = 0; i < 16; i++)
             result.rcodes[i] = counter.rcodes[i];
         result.truncated     = counter.truncated;
+        result.rtt_histogram = counter.rtt_histogram;
+    }
+    if (Engine == DNSSenderThread::ENGINE_TCP || Engine == DNSSenderThread::ENGINE_DOT) {
+        for (it = threadpool.begin(); it != threadpool.end(); ++it) {
+            TCPConnectionPool::Counter counter;
+            ((DNSSenderThread*)(*it))->getConnectionCounter(counter, step);
+            result.connects += counter.connects;
+            result.connect_errors += counter.connect_errors;
+            result.connections_closed += counter.closed_by_peer;
+            result.queries_dropped += counter.queries_dropped;
+            result.resumed += counter.resumed;
+            result.handshake_histogram += counter.handshake_histogram;
+        }
     }
 
     result.packages_lost = result.counter_send - result.counter_received;
@@ -498,37 +1565,202 @@ void DNSSender::getResults(DNSSender::Results& result)
         result.packages_lost = 0;
 }
 
+/*
+ * Results of a single target, only the query and response counters are
+ * kept per target.
+ */
+void DNSSender::getTargetResults(DNSSender::Results& result, int target, int step)
+{
+    ppl7::ThreadPool::iterator it;
+    result.clear();
+    for (it = threadpool.begin(); it != threadpool.end(); ++it) {
+        DNSSenderThread::Counter counter;
+        ((DNSSenderThread*)(*it))->getCounter(counter, step, target);
+        result.counter_send += counter.packets_send;
+        result.bytes_send += counter.bytes_send;
+        result.counter_errors += counter.errors;
+    }
+    RawSocketReceiver::Counter counter;
+    if (Receiver) {
+        Receiver->getCounter(counter, step, target);
+    } else {
+        for (it = threadpool.begin(); it != threadpool.end(); ++it) {
+            RawSocketReceiver::Counter thread_counter;
+            ((DNSSenderThread*)(*it))->getReceiveCounter(thread_counter, step, target);
+            counter += thread_counter;
+        }
+    }
+    result.counter_received = counter.num_pkgs;
+    result.bytes_received   = counter.bytes_rcv;
+    result.rtt_total        = counter.rtt_total;
+    if (counter.num_pkgs)
+        result.rtt_avg = counter.rtt_total / counter.num_pkgs; //NOSONAR
+    result.rtt_min       = counter.rtt_min;
+    result.rtt_max       = counter.rtt_max;
+    result.truncated     = counter.truncated;
+    result.rtt_histogram = counter.rtt_histogram;
+    for (int i           = 0; i < 16; i++)
+        result.rcodes[i] = counter.rcodes[i];
+    result.packages_lost = result.counter_send - result.counter_received;
+    if (result.counter_received > result.counter_send)
+        result.packages_lost = 0;
+}
+
+void DNSSender::presentTargetResults(int step)
+{
+    if (targets.size() < 2)
+        return;
+    bool responses = (Receiver || Engine != DNSSenderThread::ENGINE_RAW);
+    for (size_t t = 0; t < targets.size(); t++) {
+        DNSSender::Results result;
+        getTargetResults(result, (int)t, step);
+        printf("Target %s: send: %llu, rcv: %llu",
+            (const char*)targets[t].name, result.counter_send, result.counter_received);
+        if (responses) {
+            printf(", lost: %0.3f %%, rtt average: %0.4f ms, p50: %0.4f ms, p99: %0.4f ms",
+                result.counter_send ? (double)result.packages_lost * 100.0 / (double)result.counter_send : 0.0,
+                result.rtt_avg * 1000.0,
+                result.rtt_histogram.percentile(50.0) * 1000.0,
+                result.rtt_histogram.percentile(99.0) * 1000.0);
+        }
+        printf("\n");
+    }
+}
+
+static void print_phases(const PhaseTimer::Counter& counter, double scale, ppluint64 packets, ppluint64 responses)
+{
+    for (int p = 0; p < PhaseTimer::RECEIVE; p++) {
+        if (counter.cycles[p] && packets)
+            printf("%s: %0.1f, ", PhaseTimer::name((PhaseTimer::Phase)p),
+                (double)counter.cycles[p] * scale / (double)packets);
+    }
+    if (counter.cycles[PhaseTimer::RECEIVE] && responses)
+        printf("%s: %0.1f, ", PhaseTimer::name(PhaseTimer::RECEIVE),
+            (double)counter.cycles[PhaseTimer::RECEIVE] * scale / (double)responses);
+    printf("\n");
+}
+
+/*
+ * Nanoseconds per packet spent in the phases of the send path and per
+ * response in the receive path. Only every PhaseInterval'th pass is timed,
+ * the cycles are scaled up by the interval.
+ */
+void DNSSender::presentPhaseResults(int step)
+{
+    if (!PhaseInterval)
+        return;
+    double                     scale = (double)PhaseInterval / PhaseTimer::cyclesPerNanosecond();
+    ppl7::ThreadPool::iterator it;
+    int                        t = 0;
+    printf("Phases in ns/packet:\n");
+    for (it = threadpool.begin(); it != threadpool.end(); ++it, t++) {
+        DNSSenderThread*           thread = (DNSSenderThread*)(*it);
+        DNSSenderThread::Counter   counter;
+        RawSocketReceiver::Counter rcv;
+        PhaseTimer::Counter        phases;
+        thread->getCounter(counter, step);
+        thread->getReceiveCounter(rcv, step);
+        thread->getPhaseCounter(phases, step);
+        ppluint64 packets = counter.packets_send + counter.errors + counter.counter_0bytes + counter.dropped_local;
+        printf("    Thread %d: ", t);
+        print_phases(phases, scale, packets, rcv.num_pkgs);
+    }
+    if (Receiver) {
+        RawSocketReceiver::Counter rcv;
+        PhaseTimer::Counter        phases;
+        Receiver->getCounter(rcv, step);
+        Receiver->getPhaseCounter(phases, step);
+        printf("    Receiver: ");
+        print_phases(phases, scale, 0, rcv.num_pkgs);
+    }
+}
+
+/*
+ * Responses broken down by the query type or user defined class of the
+ * query they answer.
+ */
+void DNSSender::presentClassResults(int step)
+{
+    if (!classStats || ignoreResponses)
+        return;
+    QueryClassCounter counter;
+    if (Receiver) {
+        Receiver->getClassCounter(counter, step);
+    } else {
+        ppl7::ThreadPool::iterator it;
+        for (it = threadpool.begin(); it != threadpool.end(); ++it) {
+            QueryClassCounter thread_counter;
+            ((DNSSenderThread*)(*it))->getClassCounter(thread_counter, step);
+            counter += thread_counter;
+        }
+    }
+    ppluint64 total = 0;
+    for (int c = 0; c < qclasses.size(); c++)
+        total += counter.entry[c].num_pkgs;
+    for (int c = 0; c < qclasses.size(); c++) {
+        const QueryClassCounter::Entry& e = counter.entry[c];
+        if (!e.num_pkgs)
+            continue;
+        printf("Class %s: rcv: %llu = %0.1f %%, truncated: %0.3f %%, rtt average: %0.4f ms, "
+               "p50: %0.4f ms, p90: %0.4f ms, p99: %0.4f ms\n",
+            (const char*)qclasses.name(c), e.num_pkgs, (double)e.num_pkgs * 100.0 / (double)total,
+            (double)e.truncated * 100.0 / (double)e.num_pkgs,
+            e.rtt_total * 1000.0 / (double)e.num_pkgs,
+            e.rtt_histogram.percentile(50.0) * 1000.0,
+            e.rtt_histogram.percentile(90.0) * 1000.0,
+            e.rtt_histogram.percentile(99.0) * 1000.0);
+        printf("    RCODES: ");
+        for (int i = 0; i < 16; i++) {
+            if (e.rcodes[i])
+                printf("%s: %llu, ", getRcodeName(i), e.rcodes[i]);
+        }
+        printf("\n");
+    }
+}
+
 void DNSSender::saveResultsToCsv(const DNSSender::Results& result)
 {
 
     if (CSVFile.isOpen()) {
-        CSVFile.putsf("%llu;%llu;%llu;%0.3f;%0.4f;%0.4f;%0.4f;\n",
-            (ppluint64)((double)result.counter_send / (double)Runtime),
-            (ppluint64)((double)result.counter_received / (double)Runtime),
-            (ppluint64)((double)result.counter_errors / (double)Runtime),
+        CSVFile.putsf("%llu;%llu;%llu;%0.3f;%0.4f;%0.4f;%0.4f;%0.3f;%0.3f;\n",
+            (ppluint64)result.perSecond((double)result.counter_send),
+            (ppluint64)result.perSecond((double)result.counter_received),
+            (ppluint64)result.perSecond((double)result.counter_errors),
             (double)result.packages_lost * 100.0 / (double)result.counter_send,
             result.rtt_avg * 1000.0,
             result.rtt_min * 1000.0,
-            result.rtt_max * 1000.0);
+            result.rtt_max * 1000.0,
+            result.start, result.duration);
         CSVFile.flush();
     }
 }
 
-void DNSSender::presentResults(const DNSSender::Results& result)
+void DNSSender::presentResults(const DNSSender::Results& result, int step)
 {
+    StepInfo& info = stepInfo[step & 1];
     printf("===============================================================================\n");
-    const SystemStat::Interface& net1     = sys1.interfaces[InterfaceName];
-    const SystemStat::Interface& net2     = sys2.interfaces[InterfaceName];
-    SystemStat::Network          transmit = SystemStat::Network::getDelta(net1.transmit, net2.transmit);
-    SystemStat::Network          received = SystemStat::Network::getDelta(net1.receive, net2.receive);
-    printf("network if %s Pkt send: %lu, rcv: %lu, Data send: %lu KB, rcv: %lu KB\n",
-        (const char*)InterfaceName,
-        transmit.packets, received.packets, transmit.bytes / 1024, received.bytes / 1024);
-
-    ppluint64 qps_send     = (ppluint64)((double)result.counter_send / (double)Runtime);
-    ppluint64 bps_send     = (ppluint64)((double)result.bytes_send / (double)Runtime);
-    ppluint64 qps_received = (ppluint64)((double)result.counter_received / (double)Runtime);
-    ppluint64 bps_received = (ppluint64)((double)result.bytes_received / (double)Runtime);
+    if (!coordinatorMode) {
+        // the coordinator does not send any queries itself
+        const SystemStat::Interface& net1     = info.sys1.interfaces[InterfaceName];
+        const SystemStat::Interface& net2     = info.sys2.interfaces[InterfaceName];
+        SystemStat::Network          transmit = SystemStat::Network::getDelta(net1.transmit, net2.transmit);
+        SystemStat::Network          received = SystemStat::Network::getDelta(net1.receive, net2.receive);
+        printf("network if %s Pkt send: %lu, rcv: %lu, Data send: %lu KB, rcv: %lu KB\n",
+            (const char*)InterfaceName,
+            transmit.packets, received.packets, transmit.bytes / 1024, received.bytes / 1024);
+    }
+    // rates are averages over the time the queries were sent, the warm-up
+    // is not part of it
+    printf("Measured from %0.3f for %0.3f s", result.start, result.duration);
+    if (info.warmup > 0.0)
+        printf(" after %0.3f s warm-up%s", info.warmup,
+            info.steady ? " (steady)" : (SteadyTolerance > 0.0f ? " (not steady)" : ""));
+    printf("\n");
+
+    ppluint64 qps_send     = (ppluint64)result.perSecond((double)result.counter_send);
+    ppluint64 bps_send     = (ppluint64)result.perSecond((double)result.bytes_send);
+    ppluint64 qps_received = (ppluint64)result.perSecond((double)result.counter_received);
+    ppluint64 bps_received = (ppluint64)result.perSecond((double)result.bytes_received);
 
     printf("DNS Queries send: %10llu, Qps: %7llu, Data send: %7llu KB = %6llu MBit\n",
         result.counter_send, qps_send, result.bytes_send / 1024, bps_send / (1024 * 1024));
@@ -538,6 +1770,11 @@ void DNSSender::presentResults(const DNSSender::Results& result)
 
     printf("DNS Queries lost: %10llu = %0.3f %%\n", result.packages_lost,
         (double)result.packages_lost * 100.0 / (double)result.counter_send);
+    if (backoff) {
+        // never left this host, so they are not part of the loss above
+        printf("Local drops:      %10llu, Qps: %7llu, backoffs: %llu\n", result.dropped_local,
+            (ppluint64)result.perSecond((double)result.dropped_local), result.backoffs);
+    }
 
     printf("DNS rtt average: %0.4f ms, "
            "min: %0.4f ms, "
@@ -545,27 +1782,552 @@ void DNSSender::presentResults(const DNSSender::Results& result)
         result.rtt_avg * 1000.0,
         result.rtt_min * 1000.0,
         result.rtt_max * 1000.0);
+    printf("DNS rtt p50: %0.4f ms, p90: %0.4f ms, p99: %0.4f ms\n",
+        result.rtt_histogram.percentile(50.0) * 1000.0,
+        result.rtt_histogram.percentile(90.0) * 1000.0,
+        result.rtt_histogram.percentile(99.0) * 1000.0);
+    if (Window) {
+        printf("Closed loop: %d outstanding queries%s, timed out: %llu\n", info.outstanding,
+            perThreadWindow ? " per thread" : "", info.timeouts);
+    }
+    if (Engine == DNSSenderThread::ENGINE_TCP || Engine == DNSSenderThread::ENGINE_DOT) {
+        const char* proto = (Engine == DNSSenderThread::ENGINE_DOT) ? "TLS" : "TCP";
+        printf("TCP connections opened: %llu = %0.1f per second, failed: %llu, closed by peer: %llu, "
+               "queries dropped: %llu\n",
+            result.connects, result.perSecond((double)result.connects), result.connect_errors,
+            result.connections_closed, result.queries_dropped);
+        if (Engine == DNSSenderThread::ENGINE_DOT) {
+            printf("TLS sessions resumed: %llu of %llu handshakes = %0.1f %%\n", result.resumed,
+                result.connects, result.connects ? (double)result.resumed * 100.0 / (double)result.connects : 0.0);
+        }
+        printf("%s handshake p50: %0.4f ms, p90: %0.4f ms, p99: %0.4f ms\n", proto,
+            result.handshake_histogram.percentile(50.0) * 1000.0,
+            result.handshake_histogram.percentile(90.0) * 1000.0,
+            result.handshake_histogram.percentile(99.0) * 1000.0);
+    }
     printf("DNS truncated: %llu\nDNS RCODES: ", result.truncated);
     for (int i = 0; i < 15; i++) {
         if (result.rcodes[i]) {
-            printf("%s: %llu, ", rcode_names[i], result.rcodes[i]);
+            printf("%s: %llu, ", getRcodeName(i), result.rcodes[i]);
         }
     }
     printf("\n");
 
     if (result.counter_errors) {
         printf("Errors:           %10llu, Qps: %10llu\n", result.counter_errors,
-            (ppluint64)((double)result.counter_errors / (double)Runtime));
+            (ppluint64)result.perSecond((double)result.counter_errors));
     }
     if (result.counter_0bytes) {
         printf("Errors 0Byte:     %10llu, Qps: %10llu\n", result.counter_0bytes,
-            (ppluint64)((double)result.counter_0bytes / (double)Runtime));
+            (ppluint64)result.perSecond((double)result.counter_0bytes));
     }
     for (int i = 0; i < 255; i++) {
         if (result.counter_errorcodes[i] > 0) {
             printf("Errors %3d:       %10llu, Qps: %10llu [%s]\n", i, result.counter_errorcodes[i],
-                (ppluint64)((double)result.counter_errorcodes[i] / (double)Runtime),
+                (ppluint64)result.perSecond((double)result.counter_errorcodes[i]),
                 strerror(i));
         }
     }
 }
+
+bool DNSSender::meetsSLA(const DNSSender::Results& result, double& loss, double& p99) const
+{
+    if (result.counter_send)
+        loss = (double)result.packages_lost * 100.0 / (double)result.counter_send;
+    else
+        loss = 100.0;
+    p99 = result.rtt_histogram.percentile(99.0) * 1000.0;
+    if (loss > SlaLoss)
+        return false;
+    if (SlaP99 > 0.0f && p99 > SlaP99)
+        return false;
+    return true;
+}
+
+DNSSender::SearchProbe DNSSender::probe(int queryrate)
+{
+    SearchProbe p;
+    p.queryrate = queryrate;
+    // Every rate is measured SearchRuns times and decided by majority, a tie
+    // is broken by one more run. Runs are skipped once the majority is clear.
+    while (p.runs < SearchRuns || p.passed * 2 == p.runs) {
+        if (p.passed * 2 > SearchRuns || (p.runs - p.passed) * 2 > SearchRuns)
+            break;
+        DNSSender::Results result;
+        double             loss, p99;
+        presentStep(runStep(queryrate), result);
+        saveResultsToCsv(result);
+        CurrentStep++;
+
+        double qps  = result.perSecond((double)result.counter_send);
+        bool   pass = meetsSLA(result, loss, p99);
+        // If we could not even send the requested rate, the result says
+        // nothing about the target
+        if (qps < queryrate * 0.95) {
+            p.senderLimited = true;
+            pass            = false;
+        }
+        if (p.runs == 0 || loss < p.loss_min)
+            p.loss_min = loss;
+        if (p.runs == 0 || loss > p.loss_max)
+            p.loss_max = loss;
+        if (p.runs == 0 || p99 < p.p99_min)
+            p.p99_min = p99;
+        if (p.runs == 0 || p99 > p.p99_max)
+            p.p99_max = p99;
+        p.qps_send += qps;
+        p.runs++;
+        if (pass)
+            p.passed++;
+        printf("Search: %d qps, run %d: loss %0.3f %%, p99 %0.4f ms, %s\n",
+            queryrate, p.runs, loss, p99,
+            pass ? "within SLA" : (qps < queryrate * 0.95 ? "queryrate not reached" : "SLA violated"));
+    }
+    p.qps_send /= p.runs;
+    probes.push_back(p);
+    return p;
+}
+
+void DNSSender::searchCapacity()
+{
+    ppl7::Array matches;
+    SearchRange.pregMatch("/^([0-9]+)-([0-9]+)(,([0-9]+))?$/", matches);
+    int low  = matches[1].toInt();
+    int high = matches[2].toInt();
+    int step = matches.size() > 4 ? matches[4].toInt() : 0;
+    if (high < low)
+        std::swap(low, high);
+    if (low < 1)
+        low = 1;
+    if (step < 1)
+        step = std::max(1, (high - low) / 100);
+    probes.clear();
+    CurrentStep = 0;
+
+    // Both ends of the range are verified first, then the knee is bisected
+    // down to the given resolution.
+    if (!probe(low).ok() || probe(high).ok()) {
+        presentSearchSummary();
+        return;
+    }
+    while (high - low > step) {
+        int mid = low + (high - low) / 2;
+        if (probe(mid).ok())
+            low = mid;
+        else
+            high = mid;
+    }
+    presentSearchSummary();
+}
+
+static bool compareProbes(const DNSSender::SearchProbe& a, const DNSSender::SearchProbe& b)
+{
+    return a.queryrate < b.queryrate;
+}
+
+void DNSSender::presentSearchSummary()
+{
+    std::vector<SearchProbe> sorted = probes;
+    std::sort(sorted.begin(), sorted.end(), compareProbes);
+    const SearchProbe* good = NULL;
+    const SearchProbe* bad  = NULL;
+    for (size_t i = 0; i < sorted.size(); i++) {
+        if (sorted[i].ok())
+            good = &sorted[i];
+    }
+    for (size_t i = 0; i < sorted.size(); i++) {
+        if (!sorted[i].ok() && (good == NULL || sorted[i].queryrate > good->queryrate)) {
+            bad = &sorted[i];
+            break;
+        }
+    }
+
+    printf("###############################################################################\n");
+    printf("# Capacity search, SLA: loss <= %0.3f %%", SlaLoss);
+    if (SlaP99 > 0.0f)
+        printf(", p99 <= %0.4f ms", SlaP99);
+    printf("\n#\n");
+    printf("#  Queryrate  Runs  Passed  Qps send   Loss %% min/max    p99 ms min/max\n");
+    for (size_t i = 0; i < sorted.size(); i++) {
+        const SearchProbe& p = sorted[i];
+        printf("# %10d  %4d  %6d  %8.0f  %7.3f/%-7.3f  %7.3f/%-7.3f  %s%s\n",
+            p.queryrate, p.runs, p.passed, p.qps_send,
+            p.loss_min, p.loss_max, p.p99_min, p.p99_max,
+            p.ok() ? "ok" : "failed",
+            (p.passed > 0 && p.passed < p.runs) ? ", unstable" : "");
+    }
+    printf("#\n");
+    if (good == NULL) {
+        printf("# No queryrate in the search range meets the SLA\n");
+    } else if (bad == NULL) {
+        printf("# Highest queryrate within SLA: %d qps, the range did not reach the limit\n",
+            good->queryrate);
+    } else {
+        printf("# Highest queryrate within SLA: %d qps (loss %0.3f %%, p99 %0.4f ms)\n",
+            good->queryrate, good->loss_max, good->p99_max);
+        printf("# Lowest queryrate violating SLA: %d qps (loss %0.3f %%, p99 %0.4f ms)\n",
+            bad->queryrate, bad->loss_max, bad->p99_max);
+    }
+    if (bad != NULL && bad->senderLimited) {
+        printf("# WARNING: dnsmeter could not send %d qps, the limit may be on this host\n",
+            bad->queryrate);
+    }
+    printf("###############################################################################\n");
+}
+
+static ppl7::String option_group(const ppl7::String& option)
+{
+    // -q and -s both set the source address
+    if (option == "-s")
+        return ppl7::String("-q");
+    return option;
+}
+
+static bool has_option(const ppl7::Array& args, const ppl7::String& option)
+{
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i].left(1) == "-" && option_group(args[i]) == option)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Options on the command line of the agent take precedence over the ones
+ * of the coordinator, e.g. its own source address (-q or -s) or its
+ * interface (-e).
+ */
+static void merge_arguments(ppl7::Array& args, const ppl7::Array& local, const ppl7::Array& remote)
+{
+    for (size_t i = 0; i < local.size(); i++)
+        args.add(local[i]);
+    for (size_t i = 0; i < remote.size(); i++) {
+        const ppl7::String& arg = remote[i];
+        if (arg.left(1) == "-" && has_option(local, option_group(arg))) {
+            // skip the value of the option as well
+            if (i + 1 < remote.size() && remote[i + 1].left(1) != "-")
+                i++;
+            continue;
+        }
+        args.add(arg);
+    }
+}
+
+/*
+ * Options which write files or open sockets. An agent usually runs as
+ * root and takes them from its own command line only, the coordinator
+ * does not send them.
+ */
+static bool is_local_option(const ppl7::String& option)
+{
+    return option == "-c" || option == "--metrics" || option == "--metrics-json"
+        || option == "--control" || option == "--agent" || option == "--agents"
+        || option == "--agent-secret";
+}
+
+/*
+ * The shared secret of coordinator and agents is read from a file, so
+ * that it does not show up in the process list.
+ */
+static ppl7::String read_agent_secret(int argc, char** argv)
+{
+    ppl7::String Filename = ppl7::GetArgv(argc, argv, "--agent-secret");
+    if (Filename.isEmpty())
+        throw InvalidCommandlineParameter("shared secret of coordinator and agents is missing (--agent-secret FILE)");
+    ppl7::File   ff(Filename);
+    ppl7::String Secret;
+    ff.gets(Secret, 1024);
+    Secret.trim();
+    if (Secret.isEmpty())
+        throw InvalidCommandlineParameter("secret file is empty: %s", (const char*)Filename);
+    return Secret;
+}
+
+/*
+ * Compares in constant time, so that the secret can not be guessed from
+ * the response time.
+ */
+static bool same_secret(const ppl7::String& a, const ppl7::String& b)
+{
+    if (a.size() != b.size())
+        return false;
+    const unsigned char* pa   = (const unsigned char*)(const char*)a;
+    const unsigned char* pb   = (const unsigned char*)(const char*)b;
+    unsigned char        diff = 0;
+    for (size_t i = 0; i < a.size(); i++)
+        diff |= pa[i] ^ pb[i];
+    return diff == 0;
+}
+
+int DNSSender::runAgent(int argc, char** argv)
+{
+    ppl7::String Address = ppl7::GetArgv(argc, argv, "--agent");
+    ppl7::Array  localArgs;
+    for (int i = 1; i < argc; i++) {
+        if (ppl7::String("--agent") == argv[i] || ppl7::String("--agent-secret") == argv[i]) {
+            i++;
+            continue;
+        }
+        localArgs.add(argv[i]);
+    }
+    ppl7::String Secret;
+    AgentLink    listener;
+    try {
+        Secret = read_agent_secret(argc, argv);
+        listener.listen(Address);
+    } catch (const ppl7::Exception& e) {
+        printf("ERROR: could not listen for the coordinator (--agent [HOST:]PORT)\n");
+        e.print();
+        return 1;
+    }
+
+    signal(SIGINT, sighandler);
+    signal(SIGTERM, sighandler);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Agent waiting for coordinator on %s\n", (const char*)Address);
+    while (!stopFlag) {
+        AgentLink link;
+        try {
+            if (!listener.accept(link, 500))
+                continue;
+        } catch (const ppl7::Exception& e) {
+            e.print();
+            continue;
+        }
+        printf("Coordinator %s connected\n", (const char*)link.name());
+        // every session starts with a fresh configuration
+        DNSSender session;
+        try {
+            session.agentSession(link, localArgs, Secret);
+        } catch (const ppl7::Exception& e) {
+            e.print();
+        }
+        session.stopSession();
+        printf("Coordinator %s disconnected\n", (const char*)link.name());
+    }
+    return 0;
+}
+
+int DNSSender::agentSession(AgentLink& link, const ppl7::Array& localArgs, const ppl7::String& secret)
+{
+    ppl7::Array  remoteArgs;
+    ppl7::String line;
+    // the coordinator has to authenticate before anything else
+    if (!link.readLine(line, 10000) || line.left(5) != "AUTH " || !same_secret(line.mid(5), secret)) {
+        link.sendLine("ERROR authentication failed");
+        throw AgentProtocolError("authentication of %s failed", (const char*)link.name());
+    }
+    while (1) {
+        if (!link.readLine(line, 1000)) {
+            if (stopFlag)
+                return 1;
+            continue;
+        }
+        if (line == "END")
+            break;
+        if (line.left(4) != "ARG ")
+            throw AgentProtocolError("unexpected command from %s: %s", (const char*)link.name(), (const char*)line);
+        ppl7::String arg = line.mid(4);
+        if (is_local_option(arg)) {
+            link.sendLine("ERROR option not allowed from the coordinator: " + arg);
+            throw AgentProtocolError("option from %s not allowed: %s", (const char*)link.name(), (const char*)arg);
+        }
+        remoteArgs.add(arg);
+    }
+    ppl7::Array args;
+    args.add("dnsmeter");
+    merge_arguments(args, localArgs, remoteArgs);
+    std::vector<char*> argv;
+    for (size_t i = 0; i < args.size(); i++)
+        argv.push_back((char*)(const char*)args[i]);
+    try {
+        if (getParameter((int)argv.size(), &argv[0]) != 0 || openFiles() != 0 || startSession() != 0) {
+            link.sendLine("ERROR invalid parameters, see output of the agent");
+            return 1;
+        }
+    } catch (const ppl7::Exception& e) {
+        link.sendLine("ERROR " + e.toString());
+        throw;
+    }
+    link.sendLine("READY");
+    Coordinator = &link;
+    while (!stopFlag) {
+        if (!link.readLine(line, 1000))
+            continue;
+        if (line == "QUIT")
+            break;
+        ppl7::Array tok(line, " ");
+        if (tok.size() != 5 || tok[0] != "STEP")
+            throw AgentProtocolError("unexpected command from %s: %s", (const char*)link.name(), (const char*)line);
+        CurrentStep   = tok[1].toInt();
+        int queryrate = tok[2].toInt();
+        Outstanding   = tok[3].toInt();
+        // all agents start at the same time
+        double wait = tok[4].toDouble() - ppl7::GetMicrotime();
+        if (wait > 0.0)
+            ppl7::USleep((ppluint64)(wait * 1000000.0));
+        DNSSender::Results results;
+        presentStep(runStep(queryrate), results);
+        link.sendLine("RESULT " + results.serialize());
+    }
+    stopSession();
+    Coordinator = NULL;
+    return 0;
+}
+
+int DNSSender::coordinate(int argc, char** argv)
+{
+    if (searchMode) {
+        printf("ERROR: could not use parameters --search and --agents together\n\n");
+        help();
+        return 1;
+    }
+    if (ControlPath.notEmpty()) {
+        printf("ERROR: could not use parameters --control and --agents together\n\n");
+        help();
+        return 1;
+    }
+    ppl7::Array list(ppl7::GetArgv(argc, argv, "--agents"), ",", 0, true);
+    if (list.size() == 0) {
+        printf("ERROR: list of agents is missing (--agents HOST:PORT,...)\n\n");
+        help();
+        return 1;
+    }
+    ppl7::String Secret;
+    try {
+        Secret = read_agent_secret(argc, argv);
+    } catch (const ppl7::Exception& e) {
+        e.print();
+        return 1;
+    }
+    if (openOutputFiles() != 0)
+        return 1;
+    coordinatorMode = true;
+
+    signal(SIGINT, sighandler);
+    signal(SIGTERM, sighandler);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<AgentLink*> agents;
+    int                     ret = 0;
+    try {
+        for (size_t a = 0; a < list.size(); a++) {
+            AgentLink* link = new AgentLink();
+            agents.push_back(link);
+            link->connect(ppl7::String(list[a]).trim());
+            link->sendLine("AUTH " + Secret);
+            // the output files are written by the coordinator only
+            for (int i = 1; i < argc; i++) {
+                ppl7::String arg = argv[i];
+                if (is_local_option(arg)) {
+                    i++;
+                    continue;
+                }
+                link->sendLine("ARG " + arg);
+            }
+            link->sendLine("END");
+        }
+        for (size_t a = 0; a < agents.size(); a++) {
+            ppl7::String line;
+            if (!agents[a]->readLine(line, 120000))
+                throw AgentProtocolError("agent %s did not get ready", (const char*)agents[a]->name());
+            if (line != "READY")
+                throw AgentProtocolError("agent %s: %s", (const char*)agents[a]->name(), (const char*)line);
+        }
+        printf("%d agents ready\n", (int)agents.size());
+        const ppl7::Array& steps = closedLoop ? concurrency : rates;
+        for (size_t i = 0; i < steps.size(); i++) {
+            CurrentStep = (int)i;
+            runAgentStep(agents, (int)i, steps[i].toInt());
+        }
+        for (size_t a = 0; a < agents.size(); a++)
+            agents[a]->sendLine("QUIT");
+    } catch (const ppl7::OperationInterruptedException&) {
+        // closing the connections ends the sessions of the agents
+    } catch (const ppl7::Exception& e) {
+        e.print();
+        ret = 1;
+    }
+    for (size_t a = 0; a < agents.size(); a++)
+        delete agents[a];
+    return ret;
+}
+
+/*
+ * Starts a load step on all agents at the same time and merges their
+ * results. Every agent gets its share of the query rate or of the
+ * outstanding queries.
+ */
+void DNSSender::runAgentStep(std::vector<AgentLink*>& agents, int step, int total)
+{
+    int    n     = (int)agents.size();
+    double start = ppl7::GetMicrotime() + 2.0;
+    printf("###############################################################################\n");
+    if (closedLoop) {
+        printf("# Start Session with Agents: %d, closed loop with %d outstanding queries\n", n, total);
+    } else if (total) {
+        printf("# Start Session with Agents: %d, Queryrate: %d\n", n, total);
+    } else {
+        printf("# Start Session with Agents: %d, Queryrate: unlimited\n", n);
+    }
+    for (int a = 0; a < n; a++) {
+        int          share = total / n + (a < total % n ? 1 : 0);
+        ppl7::String cmd;
+        cmd.setf("STEP %d %d %d %0.6f", step, closedLoop ? 0 : share, closedLoop ? share : 0, start);
+        agents[a]->sendLine(cmd);
+    }
+
+    std::vector<DNSSender::Results> latest(n);
+    std::vector<bool>               done(n, false);
+    int                             finished = 0;
+    ppl7::ppl_time_t                begin    = (ppl7::ppl_time_t)start;
+    ppl7::ppl_time_t                report   = begin + 1;
+    double                          deadline = start + Warmup + Runtime + Timeout + 60;
+    ppl7::String                    line;
+    CurrentRate = closedLoop ? 0 : total;
+    vis_prev_results.clear();
+    if (Metrics)
+        Metrics->startStep();
+    while (finished < n) {
+        if (stopFlag)
+            throw ppl7::OperationInterruptedException("test aborted");
+        if (ppl7::GetMicrotime() > deadline)
+            throw AgentProtocolError("agents did not finish load step %d in time", step);
+        for (int a = 0; a < n; a++) {
+            while (!done[a] && agents[a]->readLine(line, 0)) {
+                if (line.left(5) == "STAT ") {
+                    latest[a].unserialize(line.mid(5));
+                } else if (line.left(7) == "RESULT ") {
+                    latest[a].unserialize(line.mid(7));
+                    done[a] = true;
+                    finished++;
+                } else {
+                    throw AgentProtocolError("agent %s: %s", (const char*)agents[a]->name(), (const char*)line);
+                }
+            }
+        }
+        ppl7::ppl_time_t now = ppl7::GetTime();
+        if (now >= report && finished < n) {
+            report = now + 1;
+            DNSSender::Results merged;
+            for (int a = 0; a < n; a++)
+                merged += latest[a];
+            showStats(merged, begin);
+        }
+        ppl7::MSleep(100);
+    }
+    DNSSender::Results result;
+    for (int a = 0; a < n; a++)
+        result += latest[a];
+    result.queryrate = CurrentRate;
+    presentResults(result, 0);
+    for (int a = 0; a < n; a++) {
+        const DNSSender::Results& r = latest[a];
+        printf("Agent %s: send: %llu, rcv: %llu, lost: %0.3f %%, rtt average: %0.4f ms, p99: %0.4f ms\n",
+            (const char*)agents[a]->name(), r.counter_send, r.counter_received,
+            r.counter_send ? (double)r.packages_lost * 100.0 / (double)r.counter_send : 0.0,
+            r.rtt_avg * 1000.0, r.rtt_histogram.percentile(99.0) * 1000.0);
+    }
+    saveResultsToCsv(result);
+}
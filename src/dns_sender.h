@@ -22,12 +22,24 @@
 #include "dns_receiver_thread.h"
 #include "payload_file.h"
 #include "system_stat.h"
+#include "rtt_histogram.h"
+#include "dns_sender_thread.h"
+#include "target_list.h"
+#include "query_classes.h"
+#include "step_clock.h"
 
 #include <ppl7.h>
+#include <list>
+#include <vector>
 
 #ifndef __dnsmeter_dns_sender_h
 #define __dnsmeter_dns_sender_h
 
+class MetricsWriter;
+class ConcurrencyWindow;
+class AgentLink;
+class ControlSocket;
+
 class DNSSender {
 private:
 #if defined(__GXX_EXPERIMENTAL_CXX0X__) || __cplusplus >= 201103L
@@ -47,6 +59,8 @@ public:
         ppluint64 counter_errors;
         ppluint64 packages_lost;
         ppluint64 counter_0bytes;
+        ppluint64 dropped_local;
+        ppluint64 backoffs;
         ppluint64 counter_errorcodes[255];
         ppluint64 rcodes[16];
         ppluint64 truncated;
@@ -54,51 +68,176 @@ public:
         double    rtt_avg;
         double    rtt_min;
         double    rtt_max;
+        ppluint64 connects;
+        ppluint64 connect_errors;
+        ppluint64 connections_closed;
+        ppluint64 queries_dropped;
+        ppluint64 resumed;
+        double    start;
+        double    duration;
+
+        RTTHistogram rtt_histogram;
+        RTTHistogram handshake_histogram;
         Results();
-        void clear();
+        void         clear();
+        ppl7::String serialize() const;
+        void         unserialize(const ppl7::String& data);
+        Results&     operator+=(const Results& other);
+        double       perSecond(double value) const;
+    };
+
+    class SearchProbe {
+    public:
+        int    queryrate;
+        int    runs;
+        int    passed;
+        double qps_send;
+        double loss_min, loss_max;
+        double p99_min, p99_max;
+        bool   senderLimited;
+        SearchProbe();
+        bool ok() const;
     };
 
 private:
+    /*
+     * What the results of a step need besides the counters of the
+     * threads. They are presented while the next step is running.
+     */
+    class StepInfo {
+    public:
+        int              queryrate;
+        int              outstanding;
+        ppluint64        timeouts;
+        ppl7::ppl_time_t start;
+        double           begin;
+        double           end;
+        double           warmup;
+        bool             steady;
+        bool             warming;
+        SystemStat       sys1, sys2;
+        StepInfo();
+    };
+
     ppl7::ThreadPool   threadpool;
-    ppl7::IPAddress    TargetIP;
+    StepClock          Clock;
     ppl7::IPAddress    SourceIP;
     ppl7::IPNetwork    SourceNet;
     ppl7::String       CSVFileName;
     ppl7::String       QueryFilename;
+    ppl7::String       QueryTemplate;
+    ppl7::String       WeightsFilename;
+    ppl7::String       MetricsFileName;
+    ppl7::String       MetricsJsonFileName;
+    ppl7::String       ControlPath;
     ppl7::File         CSVFile;
     ppl7::Array        rates;
+    ppl7::Array        concurrency;
+    ppl7::String       SearchRange;
     ppl7::String       InterfaceName;
     PayloadFile        payload;
+    TargetList         targets;
+    QueryClasses       qclasses;
+    QueryGenerator     generator;
+    EDNSOptions        edns;
     DNSReceiverThread* Receiver;
+    MetricsWriter*     Metrics;
+    ConcurrencyWindow* Window;
+    AgentLink*         Coordinator;
+    ControlSocket*     Control;
+
+    // payload files loaded with the control socket
+    std::list<PayloadFile*> payloads;
+
+    DNSSenderThread::SocketEngine Engine;
     DNSSender::Results vis_prev_results;
-    SystemStat         sys1, sys2;
+    StepInfo           stepInfo[2];
 
-    int   TargetPort;
+    std::vector<SearchProbe> probes;
+
+    int   CurrentStep;
+    int   CurrentRate;
+    int   ClockStep;
     int   Runtime;
+    int   Warmup;
     int   Timeout;
     int   ThreadCount;
     int   DnssecRate;
+    int   Outstanding;
+    int   SocketCount;
+    int   Pipeline;
+    int   Churn;
+    int   SearchRuns;
+    int   PhaseInterval;
     float Timeslices;
+    float SlaLoss;
+    float SlaP99;
+    float ZipfExponent;
+    float SteadyTolerance;
     bool  ignoreResponses;
     bool  spoofingEnabled;
     bool  spoofFromPcap;
+    bool  resumeSessions;
+    bool  closedLoop;
+    bool  perThreadWindow;
+    bool  searchMode;
+    bool  coordinatorMode;
+    bool  classStats;
+    bool  backoff;
 
     void openCSVFile(const ppl7::String& Filename);
-    void run(int queryrate);
-    void presentResults(const DNSSender::Results& result);
+    int  startStep(int queryrate, bool drain);
+    int  beginStep(int duration, bool drain);
+    int  measureStep(int step, bool drain);
+    bool warmUp(int step);
+    void watchStep(int step, double until);
+    void endStep(int step);
+    int  runStep(int queryrate);
+    void presentStep(int step, DNSSender::Results& result);
+    void presentResults(const DNSSender::Results& result, int step);
+    void presentTargetResults(int step);
+    void presentClassResults(int step);
+    void presentPhaseResults(int step);
     void saveResultsToCsv(const DNSSender::Results& result);
     void prepareThreads();
-    void getResults(DNSSender::Results& result);
+    void getResults(DNSSender::Results& result, int step);
+    void getThreadCounters(std::vector<DNSSenderThread::Counter>& counters, int step);
+    void getReceiveCounter(RawSocketReceiver::Counter& counter, int step);
+    void getTargetResults(DNSSender::Results& result, int target, int step);
+    double stopTime();
     ppl7::Array getQueryRates(const ppl7::String& QueryRates);
     void readSourceIPList(const ppl7::String& filename);
 
     void getTarget(int argc, char** argv);
     void getSource(int argc, char** argv);
     int getParameter(int argc, char** argv);
+    int getClosedLoopParameter(int argc, char** argv);
+    int getEngineParameter(int argc, char** argv);
+    int getEDNSParameter(int argc, char** argv);
+    int getSearchParameter(int argc, char** argv);
+    int getWarmupParameter(int argc, char** argv);
     int  openFiles();
+    int  openOutputFiles();
+    int  startSession();
+    void stopThreads();
+    void stopSession();
     void calcTimeslice(int queryrate);
 
-    void showCurrentStats(ppl7::ppl_time_t start_time);
+    void showCurrentStats(int step, ppl7::ppl_time_t start_time);
+    void showStats(const DNSSender::Results& result, ppl7::ppl_time_t start_time);
+    void writeMetrics(const DNSSender::Results& result, double start_time);
+    void handleControl(int step);
+    ppl7::String control(const ppl7::String& line, int step);
+
+    void searchCapacity();
+    SearchProbe probe(int queryrate);
+    bool meetsSLA(const DNSSender::Results& result, double& loss, double& p99) const;
+    void presentSearchSummary();
+
+    int  runAgent(int argc, char** argv);
+    int  agentSession(AgentLink& link, const ppl7::Array& localArgs, const ppl7::String& secret);
+    int  coordinate(int argc, char** argv);
+    void runAgentStep(std::vector<AgentLink*>& agents, int step, int total);
 
 public:
     DNSSender();
@@ -32,32 +32,77 @@
 #include <netinet/udp.h>
 #include <string.h>
 #include <errno.h>
+#include <sched.h>
+
+DNSSenderThread::Counter::Counter()
+{
+    clear();
+}
+
+void DNSSenderThread::Counter::clear()
+{
+    packets_send   = 0;
+    bytes_send     = 0;
+    errors         = 0;
+    counter_0bytes = 0;
+    dropped_local  = 0;
+    backoffs       = 0;
+    for (int i        = 0; i < 255; i++)
+        errorcodes[i] = 0;
+}
+
+DNSSenderThread::Counter& DNSSenderThread::Counter::operator+=(const DNSSenderThread::Counter& other)
+{
+    packets_send += other.packets_send;
+    bytes_send += other.bytes_send;
+    errors += other.errors;
+    counter_0bytes += other.counter_0bytes;
+    dropped_local += other.dropped_local;
+    backoffs += other.backoffs;
+    for (int i = 0; i < 255; i++)
+        errorcodes[i] += other.errorcodes[i];
+    return *this;
+}
 
 DNSSenderThread::DNSSenderThread()
 {
     buffer = (unsigned char*)malloc(4096);
     if (!buffer)
         throw ppl7::OutOfMemoryException();
-    Timeslice            = 0.0f;
-    runtime              = 10;
-    timeout              = 5;
-    queryrate            = 0;
-    counter_packets_send = 0;
-    counter_bytes_send   = 0;
-    errors               = 0;
-    counter_0bytes       = 0;
-    duration             = 0.0;
-    for (int i                = 0; i < 255; i++)
-        counter_errorcodes[i] = 0;
-    verbose                   = false;
-    spoofingEnabled           = false;
-    DnssecRate                = 0;
-    dnsseccounter             = 0;
-    payload                   = NULL;
-    spoofing_net_start        = 0;
-    spoofing_net_size         = 0;
-    payloadIsPcap             = false;
-    spoofingFromPcap          = false;
+    Timeslice          = 0.0f;
+    timeout            = 5;
+    queryrate          = 0;
+    deficit            = 0;
+    stopped            = 0.0;
+    verbose            = false;
+    spoofingEnabled    = false;
+    DnssecRate         = 0;
+    dnsseccounter      = 0;
+    targets            = NULL;
+    payload            = NULL;
+    generator          = NULL;
+    edns               = NULL;
+    window             = NULL;
+    lane               = 0;
+    currentTarget      = -1;
+    nextTarget         = 0;
+    spoofing_net_start = 0;
+    spoofing_net_size  = 0;
+    spoofing_prefixlen = 0;
+    spoofingIPv6       = false;
+    payloadIsPcap      = false;
+    spoofingFromPcap   = false;
+    ignoreResponses    = false;
+    resumeSessions     = true;
+    backoff            = false;
+    engine             = ENGINE_RAW;
+    sockets            = 1;
+    pipeline           = 1;
+    churn              = 0;
+    phaseInterval      = 0;
+    connected          = false;
+    clock              = NULL;
+    rcv_counter.setView(&view);
 }
 
 DNSSenderThread::~DNSSenderThread()
@@ -65,10 +110,13 @@ DNSSenderThread::~DNSSenderThread()
     free(buffer);
 }
 
-void DNSSenderThread::setDestination(const ppl7::IPAddress& ip, int port)
+void DNSSenderThread::setTargets(const TargetList* targets)
 {
-    Socket.setDestination(ip, port);
-    pkt.setDestination(ip, port);
+    this->targets = targets;
+    counter.resize(targets->size());
+    rcv_counter.resize(targets->size());
+    currentTarget = -1;
+    nextTarget    = 0;
 }
 
 void DNSSenderThread::setPayload(PayloadFile& payload)
@@ -77,9 +125,115 @@ void DNSSenderThread::setPayload(PayloadFile& payload)
     this->payloadIsPcap = payload.isPcap();
 }
 
-void DNSSenderThread::setRuntime(int seconds)
+void DNSSenderThread::setQueryGenerator(const QueryGenerator* generator, unsigned int thread)
+{
+    this->generator     = generator;
+    this->payloadIsPcap = false;
+    generatorState.seed(thread);
+}
+
+void DNSSenderThread::setEDNSOptions(const EDNSOptions* edns)
+{
+    this->edns = edns;
+}
+
+void DNSSenderThread::setConcurrencyWindow(ConcurrencyWindow* window, int lane)
+{
+    this->window = window;
+    this->lane   = lane;
+}
+
+void DNSSenderThread::setEngine(SocketEngine engine, int sockets)
+{
+    this->engine  = engine;
+    this->sockets = sockets;
+}
+
+void DNSSenderThread::setIgnoreResponses(bool ignore)
+{
+    ignoreResponses = ignore;
+}
+
+/*
+ * Responses of the socket engines are broken down by query class, the raw
+ * engine leaves this to the receiver thread.
+ */
+void DNSSenderThread::setQueryClasses(const QueryClasses* classes)
+{
+    udp.setQueryClasses(classes, class_counter);
+    tcp.setQueryClasses(classes, class_counter);
+}
+
+void DNSSenderThread::setPipeline(int pipeline, int churn)
 {
-    runtime = seconds;
+    this->pipeline = pipeline;
+    this->churn    = churn;
+}
+
+void DNSSenderThread::setSessionResumption(bool enable)
+{
+    resumeSessions = enable;
+}
+
+/*
+ * Times the phases of every nth query, the queue flushes of the UDP engine
+ * and the reads of the socket engines, 0 disables the timing.
+ */
+void DNSSenderThread::setPhaseTiming(unsigned int interval)
+{
+    phaseInterval = interval;
+    sendPhases.setInterval(interval, &phase_counter[view.slot()]);
+    flushPhases.setInterval(interval, &phase_counter[view.slot()]);
+    receivePhases.setInterval(interval, &phase_counter[view.slot()]);
+    udp.setPhaseTimer(interval ? &receivePhases : NULL);
+    tcp.setPhaseTimer(interval ? &receivePhases : NULL);
+}
+
+/*
+ * With backoff enabled a send which fails because the queue of the
+ * interface or the socket buffer is full is retried a few times after a
+ * growing wait. Queries which still could not be sent are counted as
+ * local drops instead of errors and are made up by the rate limiter.
+ */
+void DNSSenderThread::setBackoff(bool enable)
+{
+    backoff = enable;
+}
+
+/*
+ * The thread runs for the whole session and sends one step after the
+ * other, it waits for the next one in the clock.
+ */
+void DNSSenderThread::setStepClock(StepClock* clock)
+{
+    this->clock = clock;
+}
+
+/*
+ * TCP and DNS over TLS share the connection pool
+ */
+bool DNSSenderThread::isStream() const
+{
+    return (engine == ENGINE_TCP || engine == ENGINE_DOT);
+}
+
+void DNSSenderThread::openSockets()
+{
+    if (engine == ENGINE_UDP) {
+        udp.open(sourceip, *targets, sockets);
+    } else if (isStream()) {
+        tcp.open(sourceip, *targets, sockets, pipeline, churn, timeout);
+        if (engine == ENGINE_DOT)
+            tcp.enableTLS(resumeSessions);
+    } else {
+        // the socket family follows the destination, start with the
+        // first target, sendPacket() switches between them
+        const TargetList::Target& t = (*targets)[0];
+        pkt.setDestination(t.ip, t.port);
+        Socket.setDestination(t.ip, t.port);
+        currentTarget = 0;
+        Socket.open();
+    }
 }
 
 void DNSSenderThread::setTimeout(int seconds)
@@ -115,8 +269,16 @@ void DNSSenderThread::setSourceNet(const ppl7::IPNetwork& net)
 {
     sourcenet          = net;
     spoofingEnabled    = true;
+    if (net.family() == ppl7::IPAddress::IPv6) {
+        // host part of large prefixes like a /48 does not fit in a number
+        memcpy(spoofing_net6, net.first().addr(), sizeof(spoofing_net6));
+        spoofing_prefixlen = net.prefixlen();
+        spoofingIPv6       = true;
+        return;
+    }
     spoofing_net_start = ntohl(*(in_addr_t*)net.first().addr());
     spoofing_net_size  = powl(2, 32 - net.prefixlen());
+    spoofingIPv6       = false;
 }
 
 void DNSSenderThread::setSourcePcap()
@@ -130,49 +292,159 @@ void DNSSenderThread::setVerbose(bool verbose)
     this->verbose = verbose;
 }
 
-#define PCAP_HEADER_SIZE 14 + sizeof(struct ip) + sizeof(struct udphdr)
+static const int BACKOFF_ATTEMPTS = 8;
+
+static inline bool is_backpressure(int err)
+{
+    return (err == ENOBUFS || err == EAGAIN || err == EWOULDBLOCK);
+}
+
+// waits 10 microseconds on the first attempt and twice as long on each
+// of the following ones, up to 1.28 ms
+static void backoff_wait(int attempt)
+{
+    struct timespec ts;
+    ts.tv_sec  = 0;
+    ts.tv_nsec = 10000L << attempt;
+    nanosleep(&ts, NULL);
+}
+
+inline void DNSSenderThread::randomSourcePort()
+{
+    // In closed-loop mode with one window lane per thread, the receiver
+    // finds the lane of a response by its destination port
+    if (window && window->lanes() > 1)
+        pkt.randomSourcePort(window->lanes(), lane);
+    else
+        pkt.randomSourcePort();
+}
 
 void DNSSenderThread::sendPacket()
 {
     size_t query_size;
     while (1) {
+        sendPhases.begin();
         try {
-            const ppl7::ByteArrayPtr& bap = payload->getQuery();
-            query_size                    = bap.size();
+            // The UDP engine builds the query directly in its send batch
+            unsigned char*            query = (engine == ENGINE_UDP) ? udp.queryBuffer() : buffer;
+            const unsigned char*      data  = query;
+            const PayloadFile::Query* pq    = NULL;
+            if (generator) {
+                query_size = generator->build(query, generatorState);
+            } else {
+                pq         = &payload->getQuery(random);
+                query_size = pq->size();
+                data       = (const unsigned char*)pq->ptr();
+            }
+            sendPhases.mark(PhaseTimer::QUERY);
+            // Queries of the payload file which are sent unchanged are not
+            // copied, the socket engines send them from the payload with
+            // their own headers and DNS ID in front.
             if (payloadIsPcap) {
-                query_size -= PCAP_HEADER_SIZE;
-                memcpy(buffer, ((const char*)bap.ptr()) + PCAP_HEADER_SIZE, query_size);
+                // queries from pcap files keep their own OPT record
+                if (edns && ((const DNS_HEADER*)data)->add_count == 0) {
+                    memcpy(query, data, query_size);
+                    query_size = edns->append(query, 4096, query_size, false, random);
+                    data       = query;
+                }
             } else {
-                memcpy(buffer, bap.ptr(), query_size);
+                bool dnssec = false;
                 dnsseccounter += DnssecRate;
                 if (dnsseccounter >= 100) {
-                    query_size = AddDnssecToQuery(buffer, 4096, query_size);
+                    dnssec = true;
                     dnsseccounter -= 100;
                 }
+                if (pq && (edns || dnssec)) {
+                    memcpy(query, data, query_size);
+                    data = query;
+                }
+                if (edns)
+                    query_size = edns->append(query, 4096, query_size, dnssec, random);
+                else if (dnssec)
+                    query_size = AddDnssecToQuery(query, 4096, query_size);
+            }
+            sendPhases.mark(PhaseTimer::COPY);
+            int target = targets->select(nextTarget, random, data, query_size);
+            if (engine == ENGINE_UDP) {
+                unsigned short id = getQueryTimestamp();
+                if (window)
+                    window->sent(lane, id);
+                sendPhases.mark(PhaseTimer::RANDOM);
+                if (data != query) {
+                    udp.queueReference(data, query_size, id, target);
+                } else {
+                    *((unsigned short*)query) = htons(id);
+                    udp.queue(query_size, id, target);
+                }
+                if (udp.full())
+                    flushQueries();
+                return;
             }
-            pkt.setPayload(buffer, query_size);
+            if (isStream()) {
+                // the connection pool copies the query anyway
+                if (data != query)
+                    memcpy(query, data, query_size);
+                sendPhases.mark(PhaseTimer::RANDOM);
+                sendStream(query, query_size, target);
+                sendPhases.mark(PhaseTimer::SEND);
+                return;
+            }
+            if (target != currentTarget) {
+                const TargetList::Target& t = (*targets)[target];
+                pkt.setDestination(t.ip, t.port);
+                Socket.setDestination(t.ip, t.port);
+                currentTarget = target;
+            }
+            if (data != query)
+                pkt.setPayloadReference(data, query_size);
+            else
+                pkt.setPayload(query, query_size);
+            sendPhases.mark(PhaseTimer::COPY);
             if (spoofingEnabled) {
                 if (spoofingFromPcap) {
-                    pkt.useSourceFromPcap((const char*)bap.ptr(), bap.size());
+                    pkt.useSourceFromPcap(pq->family, pq->source, pq->port);
                 } else {
-                    pkt.randomSourceIP(spoofing_net_start, spoofing_net_size);
-                    pkt.randomSourcePort();
+                    if (spoofingIPv6)
+                        pkt.randomSourceIPv6(spoofing_net6, spoofing_prefixlen);
+                    else
+                        pkt.randomSourceIP(spoofing_net_start, spoofing_net_size);
+                    randomSourcePort();
                 }
             } else {
-                pkt.randomSourcePort();
+                randomSourcePort();
+            }
+            unsigned short id = getQueryTimestamp();
+            pkt.setDnsId(id);
+            if (window)
+                window->sent(lane, id);
+            sendPhases.mark(PhaseTimer::RANDOM);
+            pkt.finalize();
+            sendPhases.mark(PhaseTimer::CHECKSUM);
+            ssize_t n        = Socket.send(pkt);
+            int     attempts = 0;
+            while (backoff && n < 0 && is_backpressure(errno) && attempts < BACKOFF_ATTEMPTS) {
+                backoff_wait(attempts++);
+                n = Socket.send(pkt);
             }
-            pkt.setDnsId(getQueryTimestamp());
-            ssize_t n = Socket.send(pkt);
+            if (window && (n < 0 || (size_t)n != pkt.size()))
+                window->release(lane, id);
+            Counter& c = counter[view.slot()][target].beginUpdate();
+            c.backoffs += attempts;
             if (n > 0 && (size_t)n == pkt.size()) {
-                counter_packets_send++;
-                counter_bytes_send += pkt.size();
+                c.packets_send++;
+                c.bytes_send += pkt.size();
+            } else if (n < 0 && backoff && is_backpressure(errno)) {
+                c.dropped_local++;
+                deficit++;
             } else if (n < 0) {
                 if (errno < 255)
-                    counter_errorcodes[errno]++;
-                errors++;
+                    c.errorcodes[errno]++;
+                c.errors++;
             } else {
-                counter_0bytes++;
+                c.counter_0bytes++;
             }
+            counter[view.slot()][target].endUpdate();
+            sendPhases.mark(PhaseTimer::SEND);
             return;
         } catch (const UnknownRRType& exp) {
             continue;
@@ -182,46 +454,222 @@ void DNSSenderThread::sendPacket()
     }
 }
 
+void DNSSenderThread::sendStream(unsigned char* query, size_t query_size, int target)
+{
+    unsigned short id         = getQueryTimestamp();
+    *((unsigned short*)query) = htons(id);
+    if (window)
+        window->sent(lane, id);
+    bool queued   = tcp.send(query, query_size, target);
+    int  attempts = 0;
+    while (!queued && backoff && attempts < BACKOFF_ATTEMPTS) {
+        // give the connections a chance to get rid of their queries
+        tcp.flush(conn_counter[view.slot()], window, lane);
+        backoff_wait(attempts++);
+        receiveResponses(0);
+        queued = tcp.send(query, query_size, target);
+    }
+    Counter& c = counter[view.slot()][target].beginUpdate();
+    c.backoffs += attempts;
+    if (queued) {
+        c.packets_send++;
+        c.bytes_send += query_size + 2;
+    } else if (backoff) {
+        c.dropped_local++;
+        deficit++;
+    } else {
+        // no connection is open or all have the maximum of outstanding
+        // queries
+        c.errorcodes[EAGAIN]++;
+        c.errors++;
+    }
+    counter[view.slot()][target].endUpdate();
+    if (window && !queued)
+        window->release(lane, id);
+}
+
+void DNSSenderThread::flushQueries()
+{
+    if (isStream()) {
+        tcp.flush(conn_counter[view.slot()], window, lane);
+        return;
+    }
+    if (engine != ENGINE_UDP)
+        return;
+    int queued = udp.queued();
+    if (!queued)
+        return;
+    flushPhases.begin();
+    int sent     = udp.flush();
+    int err      = errno;
+    int attempts = 0;
+    while (backoff && sent < queued && is_backpressure(err) && attempts < BACKOFF_ATTEMPTS) {
+        backoff_wait(attempts++);
+        sent = udp.flush(sent);
+        err  = errno;
+    }
+    flushPhases.mark(PhaseTimer::SEND);
+    for (int i = 0; i < queued; i++) {
+        Counter& c = counter[view.slot()][udp.target(i)].beginUpdate();
+        if (i == 0)
+            c.backoffs += attempts;
+        if (i < sent) {
+            c.packets_send++;
+            c.bytes_send += udp.size(i);
+        } else if (backoff && is_backpressure(err)) {
+            c.dropped_local++;
+            deficit++;
+        } else {
+            if (err < 255)
+                c.errorcodes[err]++;
+            c.errors++;
+        }
+        counter[view.slot()][udp.target(i)].endUpdate();
+    }
+    if (window) {
+        for (int i = sent; i < queued; i++)
+            window->release(lane, udp.id(i));
+    }
+    udp.clear();
+}
+
+void DNSSenderThread::receiveResponses(int timeout_ms)
+{
+    if (isStream())
+        tcp.receive(rcv_counter, conn_counter[view.slot()], window, lane, timeout_ms);
+    else if (engine == ENGINE_UDP && !ignoreResponses)
+        udp.receive(rcv_counter, window, lane, timeout_ms);
+}
+
+/*
+ * Clears the counters of the new step. Those of the previous step are
+ * kept, its late responses are still counted there.
+ */
+void DNSSenderThread::beginStep()
+{
+    int slot = view.slot();
+    counter[slot].clear();
+    rcv_counter[slot].clear();
+    conn_counter[slot].clear();
+    class_counter[slot].clear();
+    phase_counter[slot].clear();
+    sendPhases.setInterval(phaseInterval, &phase_counter[slot]);
+    flushPhases.setInterval(phaseInterval, &phase_counter[slot]);
+    receivePhases.setInterval(phaseInterval, &phase_counter[slot]);
+    dnsseccounter = 0;
+    deficit       = 0;
+    applyControl();
+}
+
+/*
+ * Takes over the changes of the running session from the step clock
+ */
+void DNSSenderThread::applyControl()
+{
+    if (view.queryrate >= 0) {
+        queryrate = view.queryrate;
+        if (queryrate > 0)
+            setTimeslice(view.timeslice);
+    }
+    if (view.payload && view.payload != payload)
+        setPayload(*view.payload);
+}
+
 void DNSSenderThread::run()
 {
-    if (!payload)
+    if (!payload && !generator)
         throw ppl7::NullPointerException("payload not set!");
+    if (!targets)
+        throw ppl7::NullPointerException("targets not set!");
+    if (!clock)
+        throw ppl7::NullPointerException("step clock not set!");
     if (!spoofingEnabled) {
         pkt.setSource(sourceip, 0x4567);
     }
-    dnsseccounter        = 0;
-    counter_packets_send = 0;
-    counter_bytes_send   = 0;
-    counter_0bytes       = 0;
-    errors               = 0;
-    duration             = 0.0;
-    for (int i                = 0; i < 255; i++)
-        counter_errorcodes[i] = 0;
-    double start              = ppl7::GetMicrotime();
-    if (queryrate > 0) {
-        runWithRateLimit();
-    } else {
-        runWithoutRateLimit();
+    while (clock->await(view)) {
+        beginStep();
+        // connections are kept open from one step to the next
+        if (isStream() && !connected) {
+            tcp.connect(conn_counter[view.slot()]);
+            connected = true;
+        }
+        double end = view.start + view.duration;
+        // the loops return on every change of the step and continue with
+        // the new settings
+        while (!view.ended) {
+            int control = view.control;
+            if (view.paused) {
+                runPaused(end);
+            } else if (window) {
+                runClosedLoop(end);
+            } else if (queryrate > 0) {
+                runWithRateLimit(end);
+            } else {
+                runWithoutRateLimit(end);
+            }
+            if (view.control == control)
+                break;
+            applyControl();
+        }
+        flushQueries();
+        stopped = ppl7::GetMicrotime();
+        if (view.drain)
+            waitForTimeout();
     }
-    duration = ppl7::GetMicrotime() - start;
-    waitForTimeout();
 }
 
-void DNSSenderThread::runWithoutRateLimit()
+void DNSSenderThread::runWithoutRateLimit(double end)
 {
-    double start = ppl7::GetMicrotime();
-    double end   = start + (double)runtime;
     double now;
     int    pc = 0;
     while (1) {
         sendPacket();
         pc++;
+        if ((pc % UDPSocketPool::BATCH) == 0) {
+            flushQueries();
+            receiveResponses(0);
+        }
         if (pc > 10000) {
             pc = 0;
             if (this->threadShouldStop())
                 break;
             now = ppl7::GetMicrotime();
-            if (now > end)
+            view.tick(now);
+            if (now > end || clock->update(view))
+                break;
+        }
+    }
+}
+
+void DNSSenderThread::runClosedLoop(double end)
+{
+    int pc = 0;
+    while (1) {
+        if (window->acquire(lane)) {
+            sendPacket();
+        } else if (engine != ENGINE_RAW) {
+            // window is full, send what is queued and wait for responses
+            flushQueries();
+            window->expire(lane);
+            receiveResponses(1);
+        } else {
+            // window is full, give timed out queries back and wait for
+            // the receiver to release the next one
+            window->expire(lane);
+            sched_yield();
+        }
+        pc++;
+        if ((pc % UDPSocketPool::BATCH) == 0) {
+            flushQueries();
+            receiveResponses(0);
+        }
+        if (pc > 1000) {
+            pc = 0;
+            if (this->threadShouldStop())
+                break;
+            double now = ppl7::GetMicrotime();
+            view.tick(now);
+            if (now > end || clock->update(view))
                 break;
         }
     }
@@ -234,26 +682,34 @@ static inline double getNsec()
     return (double)ts.tv_sec + ((double)ts.tv_nsec / 1000000000.0);
 }
 
-void DNSSenderThread::runWithRateLimit()
+void DNSSenderThread::runWithRateLimit(double end)
 {
     struct timespec ts;
-    ppluint64       total_timeslices = runtime * 1000 / (Timeslice * 1000.0);
-    ppluint64       queries_rest     = runtime * queryrate;
-    ppl7::SockAddr  addr             = Socket.getSockAddr();
-    verbose                          = true;
+    double          now              = getNsec();
+    double          rest             = end - ppl7::GetMicrotime();
+    if (rest <= 0.0)
+        return;
+    ppluint64 total_timeslices = rest / Timeslice;
+    ppluint64 queries_rest     = rest * queryrate;
+    verbose                    = true;
+    if (total_timeslices == 0)
+        total_timeslices = 1;
     if (verbose) {
-        //printf ("qps=%d, runtime=%d\n",queryrate, runtime);
-        printf("runtime: %d s, timeslice: %0.6f s, total timeslices: %llu, Qpts: %llu, Source: %s:%d\n",
-            runtime, Timeslice, total_timeslices,
+        // only the raw socket has an address of its own, the other
+        // engines have one socket per target
+        ppl7::String source = sourceip.toString();
+        if (engine == ENGINE_RAW) {
+            ppl7::SockAddr addr = Socket.getSockAddr();
+            source.setf("%s:%d", (const char*)addr.toIPAddress().toString(), addr.port());
+        }
+        printf("runtime: %0.1f s, timeslice: %0.6f s, total timeslices: %llu, Qpts: %llu, Source: %s\n",
+            rest, Timeslice, total_timeslices,
             queries_rest / total_timeslices,
-            (const char*)addr.toIPAddress().toString(), addr.port());
+            (const char*)source);
     }
-    double now            = getNsec();
     double next_timeslice = now;
     double next_checktime = now + 0.1;
 
-    double start      = ppl7::GetMicrotime();
-    double end        = start + (double)runtime;
     double total_idle = 0.0;
 
     for (ppluint64 z = 0; z < total_timeslices; z++) {
@@ -265,10 +721,22 @@ void DNSSenderThread::runWithRateLimit()
         for (ppluint64 i = 0; i < queries_per_timeslice; i++) {
             sendPacket();
         }
+        flushQueries();
+        receiveResponses(0);
 
         queries_rest -= queries_per_timeslice;
+        if (deficit) {
+            // queries dropped by the backoff are sent again in the
+            // following timeslices, at most one timeslice worth at once
+            queries_rest += (deficit < queries_per_timeslice) ? deficit : queries_per_timeslice;
+            deficit = 0;
+        }
         while ((now = getNsec()) < next_timeslice) {
-            if (now < next_timeslice) {
+            if (engine != ENGINE_RAW && !ignoreResponses && next_timeslice - now > 0.001) {
+                // wait for responses instead of sleeping
+                total_idle += next_timeslice - now;
+                receiveResponses((int)((next_timeslice - now) * 1000.0));
+            } else if (now < next_timeslice) {
                 total_idle += next_timeslice - now;
                 ts.tv_sec  = 0;
                 ts.tv_nsec = (next_timeslice - now) * 1000000000;
@@ -277,9 +745,10 @@ void DNSSenderThread::runWithRateLimit()
         }
         if (now > next_checktime) {
             next_checktime = now + 0.1;
+            view.tick(now);
             if (this->threadShouldStop())
                 break;
-            if (ppl7::GetMicrotime() >= end)
+            if (ppl7::GetMicrotime() >= end || clock->update(view))
                 break;
             //printf ("Zeitscheiben rest: %llu\n", z);
         }
@@ -289,6 +758,24 @@ void DNSSenderThread::runWithRateLimit()
     }
 }
 
+/*
+ * Sends nothing while the session is paused, responses are still received
+ */
+void DNSSenderThread::runPaused(double end)
+{
+    double now;
+    flushQueries();
+    while ((now = ppl7::GetMicrotime()) < end) {
+        view.tick(now);
+        if (this->threadShouldStop() || clock->update(view))
+            break;
+        if (engine != ENGINE_RAW && !ignoreResponses)
+            receiveResponses(10);
+        else
+            ppl7::MSleep(10);
+    }
+}
+
 void DNSSenderThread::waitForTimeout()
 {
     double start = ppl7::GetMicrotime();
@@ -297,36 +784,56 @@ void DNSSenderThread::waitForTimeout()
     while ((now = ppl7::GetMicrotime()) < end) {
         if (now > next_checktime) {
             next_checktime = now + 0.1;
+            view.tick(now);
             if (this->threadShouldStop())
                 break;
         }
-        ppl7::MSleep(10);
+        if (engine != ENGINE_RAW && !ignoreResponses)
+            receiveResponses(10);
+        else
+            ppl7::MSleep(10);
     }
 }
 
-ppluint64 DNSSenderThread::getPacketsSend() const
+void DNSSenderThread::getCounter(DNSSenderThread::Counter& snapshot, int step) const
+{
+    counter[step & 1].snapshot(snapshot);
+}
+
+void DNSSenderThread::getCounter(DNSSenderThread::Counter& snapshot, int step, int target) const
 {
-    return counter_packets_send;
+    counter[step & 1][target].snapshot(snapshot);
 }
 
-ppluint64 DNSSenderThread::getBytesSend() const
+void DNSSenderThread::getReceiveCounter(RawSocketReceiver::Counter& snapshot, int step) const
 {
-    return counter_bytes_send;
+    rcv_counter[step & 1].snapshot(snapshot);
 }
 
-ppluint64 DNSSenderThread::getErrors() const
+void DNSSenderThread::getReceiveCounter(RawSocketReceiver::Counter& snapshot, int step, int target) const
 {
-    return errors;
+    rcv_counter[step & 1][target].snapshot(snapshot);
 }
 
-ppluint64 DNSSenderThread::getCounter0Bytes() const
+void DNSSenderThread::getConnectionCounter(TCPConnectionPool::Counter& snapshot, int step) const
 {
-    return counter_0bytes;
+    conn_counter[step & 1].snapshot(snapshot);
 }
 
-ppluint64 DNSSenderThread::getCounterErrorCode(int err) const
+void DNSSenderThread::getClassCounter(QueryClassCounter& snapshot, int step) const
+{
+    class_counter[step & 1].snapshot(snapshot);
+}
+
+void DNSSenderThread::getPhaseCounter(PhaseTimer::Counter& snapshot, int step) const
+{
+    phase_counter[step & 1].snapshot(snapshot);
+}
+
+/*
+ * Time at which the thread stopped sending in the last step
+ */
+double DNSSenderThread::getStopTime() const
 {
-    if (err < 255)
-        return counter_errorcodes[err];
-    return 0;
+    return stopped;
 }
@@ -20,7 +20,17 @@
  */
 
 #include "raw_socket_sender.h"
+#include "raw_socket_receiver.h"
+#include "udp_socket_pool.h"
+#include "tcp_connection_pool.h"
 #include "payload_file.h"
+#include "seqlock.h"
+#include "concurrency_window.h"
+#include "edns_options.h"
+#include "query_generator.h"
+#include "target_list.h"
+#include "phase_timer.h"
+#include "step_clock.h"
 
 #include <ppl7.h>
 
@@ -28,6 +38,28 @@
 #define __dnsmeter_dns_sender_thread_h
 
 class DNSSenderThread : public ppl7::Thread {
+public:
+    class Counter {
+    public:
+        Counter();
+        void      clear();
+        Counter&  operator+=(const Counter& other);
+        ppluint64 packets_send;
+        ppluint64 bytes_send;
+        ppluint64 errors;
+        ppluint64 counter_0bytes;
+        ppluint64 dropped_local;
+        ppluint64 backoffs;
+        ppluint64 errorcodes[255];
+    };
+
+    enum SocketEngine {
+        ENGINE_RAW,
+        ENGINE_UDP,
+        ENGINE_TCP,
+        ENGINE_DOT
+    };
+
 private:
 #if defined(__GXX_EXPERIMENTAL_CXX0X__) || __cplusplus >= 201103L
     DNSSenderThread& operator=(const DNSSenderThread& other);
@@ -35,63 +67,118 @@ private:
     DNSSenderThread const & operator=(DNSSenderThread &&other);
 #endif
 
-    RawSocketSender Socket;
-    Packet          pkt;
+    RawSocketSender   Socket;
+    UDPSocketPool     udp;
+    TCPConnectionPool tcp;
+    Packet            pkt;
+    SocketEngine      engine;
 
-    ppl7::IPAddress destination;
     ppl7::IPAddress sourceip;
     ppl7::IPNetwork sourcenet;
 
-    PayloadFile*   payload;
-    unsigned char* buffer;
+    StepCounters<Counter>                    counter;
+    StepCounters<RawSocketReceiver::Counter> rcv_counter;
+    CounterBlock<TCPConnectionPool::Counter> conn_counter[2];
+    CounterBlock<QueryClassCounter>          class_counter[2];
+    CounterBlock<PhaseTimer::Counter>        phase_counter[2];
+
+    PhaseTimer sendPhases;
+    PhaseTimer flushPhases;
+    PhaseTimer receivePhases;
+
+    StepClock* clock;
+    StepView   view;
+
+    const TargetList*     targets;
+    PayloadFile*          payload;
+    const QueryGenerator* generator;
+    QueryGenerator::State generatorState;
+    FastRandom            random;
+    const EDNSOptions*    edns;
+    ConcurrencyWindow*    window;
+    unsigned char*        buffer;
     ppluint64      queryrate;
-    ppluint64      counter_packets_send, errors, counter_0bytes;
-    ppluint64      counter_bytes_send;
-    ppluint64      counter_errorcodes[255];
+    ppluint64      deficit;
+    unsigned int   phaseInterval;
 
-    unsigned int spoofing_net_start;
-    unsigned int spoofing_net_size;
+    unsigned int  spoofing_net_start;
+    unsigned int  spoofing_net_size;
+    unsigned char spoofing_net6[16];
+    int           spoofing_prefixlen;
 
-    int    runtime;
-    int    timeout;
-    int    DnssecRate;
-    int    dnsseccounter;
-    double Timeslice;
+    int          lane;
+    int          currentTarget;
+    unsigned int nextTarget;
+    int          sockets;
+    int          pipeline;
+    int          churn;
+    int          timeout;
+    int          DnssecRate;
+    int          dnsseccounter;
+    double       Timeslice;
 
-    double duration;
+    double stopped;
     bool   spoofingEnabled;
+    bool   spoofingIPv6;
     bool   verbose;
     bool   payloadIsPcap;
     bool   spoofingFromPcap;
+    bool   ignoreResponses;
+    bool   resumeSessions;
+    bool   backoff;
+    bool   connected;
 
+    bool isStream() const;
+    void randomSourcePort();
     void sendPacket();
+    void sendStream(unsigned char* query, size_t query_size, int target);
+    void flushQueries();
+    void receiveResponses(int timeout_ms);
     void waitForTimeout();
     bool socketReady();
+    void beginStep();
+    void applyControl();
 
-    void runWithoutRateLimit();
-    void runWithRateLimit();
+    void runWithoutRateLimit(double end);
+    void runWithRateLimit(double end);
+    void runClosedLoop(double end);
+    void runPaused(double end);
 
 public:
     DNSSenderThread();
     ~DNSSenderThread();
-    void setDestination(const ppl7::IPAddress& ip, int port);
+    void setTargets(const TargetList* targets);
     void setSourceIP(const ppl7::IPAddress& ip);
     void setSourceNet(const ppl7::IPNetwork& net);
     void setSourcePcap();
     void setRandomSource(const ppl7::IPNetwork& net);
-    void setRuntime(int seconds);
     void setTimeout(int seconds);
     void setDNSSECRate(int rate);
     void setQueryRate(ppluint64 qps);
     void setTimeslice(float ms);
     void setVerbose(bool verbose);
     void setPayload(PayloadFile& payload);
-    void      run();
-    ppluint64 getPacketsSend() const;
-    ppluint64 getBytesSend() const;
-    ppluint64 getErrors() const;
-    ppluint64 getCounter0Bytes() const;
-    ppluint64 getCounterErrorCode(int err) const;
+    void setQueryGenerator(const QueryGenerator* generator, unsigned int thread);
+    void setConcurrencyWindow(ConcurrencyWindow* window, int lane);
+    void setEDNSOptions(const EDNSOptions* edns);
+    void setEngine(SocketEngine engine, int sockets);
+    void setIgnoreResponses(bool ignore);
+    void setQueryClasses(const QueryClasses* classes);
+    void setPipeline(int pipeline, int churn);
+    void setSessionResumption(bool enable);
+    void setPhaseTiming(unsigned int interval);
+    void setBackoff(bool enable);
+    void setStepClock(StepClock* clock);
+    void openSockets();
+    void run();
+    void getCounter(Counter& snapshot, int step) const;
+    void getCounter(Counter& snapshot, int step, int target) const;
+    void getReceiveCounter(RawSocketReceiver::Counter& snapshot, int step) const;
+    void getReceiveCounter(RawSocketReceiver::Counter& snapshot, int step, int target) const;
+    void getConnectionCounter(TCPConnectionPool::Counter& snapshot, int step) const;
+    void getClassCounter(QueryClassCounter& snapshot, int step) const;
+    void getPhaseCounter(PhaseTimer::Counter& snapshot, int step) const;
+    double getStopTime() const;
 };
 
 #endif
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "edns_options.h"
+#include "query.h"
+#include "exceptions.h"
+
+#include <netinet/in.h>
+#include <string.h>
+#include <stdlib.h>
+
+// Option codes, RFC 5001, RFC 7871, RFC 7873 and RFC 7830
+#define EDNS_NSID 3
+#define EDNS_CLIENT_SUBNET 8
+#define EDNS_COOKIE 10
+#define EDNS_PADDING 12
+
+#define OPT_HEADER_SIZE 11
+#define OPT_FLAGS_OFFSET 7
+#define OPT_RDLEN_OFFSET 9
+
+static unsigned char* put_option(unsigned char* p, unsigned short code, unsigned short len)
+{
+    p[0] = code >> 8;
+    p[1] = code & 0xff;
+    p[2] = len >> 8;
+    p[3] = len & 0xff;
+    return p + 4;
+}
+
+EDNSOptions::EDNSOptions()
+{
+    memset(opt, 0, sizeof(opt));
+    memset(ecsMask, 0, sizeof(ecsMask));
+    size           = 0;
+    udpPayloadSize = 4096;
+    nsid           = false;
+    cookieClients  = 0;
+    cookies        = NULL;
+    cookieOffset   = 0;
+    ecsEnabled     = false;
+    ecsSourceLen   = 0;
+    ecsFirstByte   = 0;
+    ecsBytes       = 0;
+    ecsOffset      = 0;
+    paddingBlock   = 0;
+}
+
+EDNSOptions::~EDNSOptions()
+{
+    free(cookies);
+}
+
+void EDNSOptions::setUdpPayloadSize(int size)
+{
+    udpPayloadSize = size;
+}
+
+void EDNSOptions::setNSID(bool enable)
+{
+    nsid = enable;
+}
+
+void EDNSOptions::setCookies(int clients)
+{
+    if (clients < 0)
+        throw ppl7::InvalidArgumentsException();
+    cookieClients = clients;
+}
+
+void EDNSOptions::setClientSubnet(const ppl7::IPNetwork& net, int source_prefixlen)
+{
+    int maxlen = (net.family() == ppl7::IPAddress::IPv6) ? 128 : 32;
+    if (source_prefixlen < net.prefixlen() || source_prefixlen > maxlen)
+        throw InvalidCommandlineParameter("ECS source prefix length must be between %d and %d",
+            net.prefixlen(), maxlen);
+    ecsNet       = net;
+    ecsSourceLen = source_prefixlen;
+    ecsEnabled   = true;
+}
+
+void EDNSOptions::setPadding(int blocksize)
+{
+    if (blocksize < 0 || blocksize > 512)
+        throw ppl7::InvalidArgumentsException();
+    paddingBlock = blocksize;
+}
+
+bool EDNSOptions::enabled() const
+{
+    return (nsid || cookieClients > 0 || ecsEnabled || paddingBlock > 0);
+}
+
+/*
+ * Builds the OPT record without the padding option, which depends on the
+ * size of the query and is added by append().
+ */
+void EDNSOptions::compile()
+{
+    memset(opt, 0, sizeof(opt));
+    // root name, type OPT, udp payload size, extended rcode, version and
+    // flags are 0, the length is set by append()
+    opt[2]           = 41;
+    opt[3]           = udpPayloadSize >> 8;
+    opt[4]           = udpPayloadSize & 0xff;
+    unsigned char* p = opt + OPT_HEADER_SIZE;
+    if (nsid)
+        p = put_option(p, EDNS_NSID, 0);
+    if (cookieClients > 0) {
+        // every simulated client has its own client cookie, server
+        // cookies are not sent back, so every query is a first contact
+        free(cookies);
+        cookies = (unsigned char*)malloc(cookieClients * 8);
+        if (!cookies)
+            throw ppl7::OutOfMemoryException();
+        for (int i = 0; i < cookieClients * 8; i++)
+            cookies[i] = ppl7::rand(0, 255);
+        p            = put_option(p, EDNS_COOKIE, 8);
+        cookieOffset = p - opt;
+        memcpy(p, cookies, 8);
+        p += 8;
+    }
+    if (ecsEnabled) {
+        bool v6      = (ecsNet.family() == ppl7::IPAddress::IPv6);
+        ecsBytes     = (ecsSourceLen + 7) / 8;
+        ecsFirstByte = ecsNet.prefixlen() / 8;
+        p            = put_option(p, EDNS_CLIENT_SUBNET, 4 + ecsBytes);
+        p[0]         = 0;
+        p[1]         = v6 ? 2 : 1;
+        p[2]         = ecsSourceLen;
+        p[3]         = 0;
+        p += 4;
+        ecsOffset = p - opt;
+        memcpy(p, ecsNet.first().addr(), ecsBytes);
+        // bits between the network prefix and the source prefix length
+        // are random, bits behind the source prefix length must be zero
+        for (int i = 0; i < ecsBytes; i++) {
+            int           bit    = i * 8;
+            unsigned char random = 0xff;
+            unsigned char keep   = 0xff;
+            if (ecsNet.prefixlen() > bit)
+                random = (ecsNet.prefixlen() - bit >= 8) ? 0 : (0xff >> (ecsNet.prefixlen() - bit));
+            if (ecsSourceLen < bit + 8)
+                keep = 0xff << (bit + 8 - ecsSourceLen);
+            ecsMask[i] = random & keep;
+            p[i] &= keep & ~random;
+        }
+        p += ecsBytes;
+    }
+    size = p - opt;
+}
+
+int EDNSOptions::append(unsigned char* buffer, size_t buffersize, int querysize, bool dnssec, FastRandom& random) const
+{
+    size_t total   = querysize + size;
+    size_t padding = 0;
+    if (paddingBlock) {
+        total += 4;
+        padding = (paddingBlock - total % paddingBlock) % paddingBlock;
+        total += padding;
+    }
+    if (total > buffersize)
+        throw BufferOverflow("%zd > %zd", total, buffersize);
+    unsigned char* p = buffer + querysize;
+    memcpy(p, opt, size);
+    size_t rdlen            = total - querysize - OPT_HEADER_SIZE;
+    p[OPT_RDLEN_OFFSET]     = rdlen >> 8;
+    p[OPT_RDLEN_OFFSET + 1] = rdlen & 0xff;
+    if (dnssec) {
+        p[OPT_FLAGS_OFFSET] |= 0x80; // DO-bit
+        ((DNS_HEADER*)buffer)->ad = 1;
+    }
+    if (cookieClients > 0)
+        memcpy(p + cookieOffset, cookies + random.below(cookieClients) * 8, 8);
+    if (ecsEnabled) {
+        unsigned char* addr = p + ecsOffset;
+        unsigned int   r    = 0;
+        for (int i = ecsFirstByte; i < ecsBytes; i++) {
+            if (((i - ecsFirstByte) & 3) == 0)
+                r = (unsigned int)(random.next() >> 32);
+            addr[i] |= (r & ecsMask[i]);
+            r >>= 8;
+        }
+    }
+    if (paddingBlock) {
+        unsigned char* pad = put_option(p + size, EDNS_PADDING, padding);
+        memset(pad, 0, padding);
+    }
+    ((DNS_HEADER*)buffer)->add_count = htons(1);
+    return total;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fast_random.h"
+
+#include <ppl7.h>
+#include <ppl7-inet.h>
+
+#ifndef __dnsmeter_edns_options_h
+#define __dnsmeter_edns_options_h
+
+/*
+ * Builds the OPT record which is appended to every query.
+ *
+ * The record with all options is compiled once with compile(), append()
+ * only copies it behind the query and patches the variable parts: a
+ * random client subnet, the client cookie of a random simulated client,
+ * the DO bit and the length of the padding. The random parts are drawn
+ * from the generator of the calling sender thread.
+ */
+class EDNSOptions {
+private:
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || __cplusplus >= 201103L
+    EDNSOptions& operator=(const EDNSOptions& other);
+    EDNSOptions(EDNSOptions &&other) noexcept;
+    EDNSOptions const & operator=(EDNSOptions &&other);
+#endif
+
+    unsigned char   opt[128];
+    size_t          size;
+    int             udpPayloadSize;
+    bool            nsid;
+    int             cookieClients;
+    unsigned char*  cookies;
+    size_t          cookieOffset;
+    ppl7::IPNetwork ecsNet;
+    int             ecsSourceLen;
+    int             ecsFirstByte;
+    int             ecsBytes;
+    unsigned char   ecsMask[16];
+    size_t          ecsOffset;
+    int             paddingBlock;
+    bool            ecsEnabled;
+
+public:
+    EDNSOptions();
+    ~EDNSOptions();
+    void setUdpPayloadSize(int size);
+    void setNSID(bool enable);
+    void setCookies(int clients);
+    void setClientSubnet(const ppl7::IPNetwork& net, int source_prefixlen);
+    void setPadding(int blocksize);
+    void compile();
+    bool enabled() const;
+    int  append(unsigned char* buffer, size_t buffersize, int querysize, bool dnssec, FastRandom& random) const;
+};
+
+#endif
@@ -35,5 +35,7 @@ PPL7EXCEPTION(UnsupportedIPFamily, Exception);
 PPL7EXCEPTION(FailedToInitializePacketfilter, Exception);
 PPL7EXCEPTION(KernelAccessFailed, Exception);
 PPL7EXCEPTION(SystemCallFailed, Exception);
+PPL7EXCEPTION(UnsupportedEngine, Exception);
+PPL7EXCEPTION(AgentProtocolError, Exception);
 
 #endif
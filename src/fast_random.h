@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ppl7.h>
+
+#ifndef __dnsmeter_fast_random_h
+#define __dnsmeter_fast_random_h
+
+/*
+ * Small xorshift64* generator for the send path. Every sender thread
+ * has its own instance, so drawing a number needs neither a lock nor a
+ * system call.
+ */
+class FastRandom {
+private:
+    ppluint64 state;
+
+public:
+    FastRandom()
+    {
+        seed();
+    }
+
+    void seed()
+    {
+        state = ((ppluint64)ppl7::rand(1, 0xffffffff) << 32) | ppl7::rand(0, 0xffffffff);
+    }
+
+    inline ppluint64 next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1DULL;
+    }
+
+    // uniformly distributed in [0, n)
+    inline unsigned int below(unsigned int n)
+    {
+        return (unsigned int)(((next() >> 32) * n) >> 32);
+    }
+};
+
+#endif
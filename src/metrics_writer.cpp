@@ -0,0 +1,396 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "metrics_writer.h"
+#include "query.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+// Upper bounds of the exported histogram buckets in seconds
+static const double rtt_buckets[] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+    0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0,
+    0.0
+};
+
+static const double rtt_quantiles[] = {
+    50.0, 90.0, 95.0, 99.0, 99.9,
+    0.0
+};
+
+MetricsWriter::Sample::Sample()
+{
+    timestamp = 0.0;
+    elapsed   = 0.0;
+    step      = 0;
+}
+
+MetricsWriter::MetricsWriter()
+{
+    json_fd      = -1;
+    havePrevious = false;
+}
+
+MetricsWriter::~MetricsWriter()
+{
+    if (json_fd >= 0)
+        close(json_fd);
+}
+
+void MetricsWriter::setOpenMetricsFile(const ppl7::String& Filename)
+{
+    OpenMetricsFileName = Filename;
+}
+
+void MetricsWriter::setJsonFile(const ppl7::String& Filename)
+{
+    JsonFileName = Filename;
+    openJsonStream();
+}
+
+void MetricsWriter::openJsonStream()
+{
+    if (json_fd >= 0 || JsonFileName.isEmpty())
+        return;
+    // Non blocking, so a FIFO without a reader or a slow reader never
+    // stalls the reporting loop. Lines which do not fit are dropped.
+    json_fd = open((const char*)JsonFileName, O_WRONLY | O_CREAT | O_APPEND | O_NONBLOCK, 0644);
+}
+
+/*
+ * Writes the rest of a line which only fit partially into the FIFO.
+ * Returns false as long as a part of it is pending.
+ */
+bool MetricsWriter::flushJsonStream()
+{
+    while (JsonPending.notEmpty()) {
+        ssize_t n = ::write(json_fd, JsonPending.c_str(), JsonPending.size());
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EPIPE) {
+            // reader of the FIFO went away, reopen on next sample
+            close(json_fd);
+            json_fd = -1;
+            JsonPending.clear();
+            return false;
+        }
+        if (n <= 0)
+            return false;
+        JsonPending = JsonPending.mid(n);
+    }
+    return true;
+}
+
+void MetricsWriter::startStep()
+{
+    havePrevious = false;
+}
+
+void MetricsWriter::write(const MetricsWriter::Sample& sample)
+{
+    double interval = 0.0;
+    if (havePrevious && previous.step == sample.step)
+        interval = sample.timestamp - previous.timestamp;
+    if (OpenMetricsFileName.notEmpty())
+        writeOpenMetrics(sample, interval);
+    if (JsonFileName.notEmpty())
+        writeJsonLine(sample, interval);
+    previous     = sample;
+    havePrevious = true;
+}
+
+static double rate(ppluint64 now, ppluint64 before, double interval)
+{
+    if (interval <= 0.0 || now < before)
+        return 0.0;
+    return (double)(now - before) / interval;
+}
+
+static void om_family(ppl7::String& out, const char* name, const char* type, const char* help)
+{
+    out.appendf("# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+static unsigned long network_value(const SystemStat::Interface& nif, int field)
+{
+    const SystemStat::Network& n = field < 4 ? nif.receive : nif.transmit;
+    if (field % 4 == 0)
+        return n.bytes;
+    if (field % 4 == 1)
+        return n.packets;
+    if (field % 4 == 2)
+        return n.errs;
+    return n.drop;
+}
+
+static const char* network_fields[] = {
+    "receive_bytes", "receive_packets", "receive_errors", "receive_drops",
+    "transmit_bytes", "transmit_packets", "transmit_errors", "transmit_drops",
+    NULL
+};
+
+static void om_network(ppl7::String& out, const SystemStat& sys)
+{
+    for (int f = 0; network_fields[f] != NULL; f++) {
+        ppl7::String name, help;
+        name.setf("dnsmeter_network_%s", network_fields[f]);
+        help.setf("Interface counter %s", network_fields[f]);
+        om_family(out, name, "counter", help);
+        out.appendf("%s_total{interface=\"all\"} %lu\n", (const char*)name, network_value(sys.net_total, f));
+        std::map<ppl7::String, SystemStat::Interface>::const_iterator it;
+        for (it = sys.interfaces.begin(); it != sys.interfaces.end(); ++it) {
+            out.appendf("%s_total{interface=\"%s\"} %lu\n", (const char*)name,
+                (const char*)it->second.Name, network_value(it->second, f));
+        }
+    }
+}
+
+void MetricsWriter::writeOpenMetrics(const MetricsWriter::Sample& sample, double interval)
+{
+    const DNSSender::Results& r = sample.results;
+    ppl7::String              out;
+
+    om_family(out, "dnsmeter_step", "gauge", "Index of the current load step");
+    out.appendf("dnsmeter_step %d\n", sample.step);
+    om_family(out, "dnsmeter_target_qps", "gauge", "Configured query rate of the current step, 0 is unlimited");
+    out.appendf("dnsmeter_target_qps %d\n", r.queryrate);
+    om_family(out, "dnsmeter_step_elapsed_seconds", "gauge", "Time since start of the current step");
+    out.appendf("dnsmeter_step_elapsed_seconds %0.3f\n", sample.elapsed);
+
+    om_family(out, "dnsmeter_queries_sent", "counter", "Queries sent in the current step");
+    out.appendf("dnsmeter_queries_sent_total %llu\n", r.counter_send);
+    om_family(out, "dnsmeter_queries_received", "counter", "Responses received in the current step");
+    out.appendf("dnsmeter_queries_received_total %llu\n", r.counter_received);
+    om_family(out, "dnsmeter_queries_lost", "gauge", "Queries without response in the current step");
+    out.appendf("dnsmeter_queries_lost %llu\n", r.packages_lost);
+    om_family(out, "dnsmeter_sent_bytes", "counter", "Bytes sent in the current step");
+    out.appendf("dnsmeter_sent_bytes_total %llu\n", r.bytes_send);
+    om_family(out, "dnsmeter_received_bytes", "counter", "Bytes received in the current step");
+    out.appendf("dnsmeter_received_bytes_total %llu\n", r.bytes_received);
+    om_family(out, "dnsmeter_send_zero_bytes", "counter", "Send calls which did not send anything");
+    out.appendf("dnsmeter_send_zero_bytes_total %llu\n", r.counter_0bytes);
+    om_family(out, "dnsmeter_send_errors", "counter", "Failed send calls");
+    out.appendf("dnsmeter_send_errors_total %llu\n", r.counter_errors);
+    om_family(out, "dnsmeter_send_dropped_local", "counter", "Queries dropped after backoff because the send queue was full");
+    out.appendf("dnsmeter_send_dropped_local_total %llu\n", r.dropped_local);
+    om_family(out, "dnsmeter_send_backoffs", "counter", "Send retries after waiting for the send queue");
+    out.appendf("dnsmeter_send_backoffs_total %llu\n", r.backoffs);
+    om_family(out, "dnsmeter_send_errno", "counter", "Failed send calls by errno");
+    for (int i = 0; i < 255; i++) {
+        if (r.counter_errorcodes[i])
+            out.appendf("dnsmeter_send_errno_total{errno=\"%d\"} %llu\n", i, r.counter_errorcodes[i]);
+    }
+    om_family(out, "dnsmeter_responses", "counter", "Responses by rcode");
+    for (int i = 0; i < 16; i++) {
+        out.appendf("dnsmeter_responses_total{rcode=\"%s\"} %llu\n", getRcodeName(i), r.rcodes[i]);
+    }
+    om_family(out, "dnsmeter_responses_truncated", "counter", "Responses with TC bit set");
+    out.appendf("dnsmeter_responses_truncated_total %llu\n", r.truncated);
+
+    if (havePrevious && interval > 0.0) {
+        const DNSSender::Results& p = previous.results;
+        om_family(out, "dnsmeter_send_rate", "gauge", "Queries per second sent in the last interval");
+        out.appendf("dnsmeter_send_rate %0.1f\n", rate(r.counter_send, p.counter_send, interval));
+        om_family(out, "dnsmeter_receive_rate", "gauge", "Responses per second received in the last interval");
+        out.appendf("dnsmeter_receive_rate %0.1f\n", rate(r.counter_received, p.counter_received, interval));
+        if (sample.threads.size() == previous.threads.size()) {
+            om_family(out, "dnsmeter_thread_send_rate", "gauge", "Queries per second sent by each sender thread in the last interval");
+            for (size_t i = 0; i < sample.threads.size(); i++) {
+                out.appendf("dnsmeter_thread_send_rate{thread=\"%zu\"} %0.1f\n", i,
+                    rate(sample.threads[i].packets_send, previous.threads[i].packets_send, interval));
+            }
+        }
+    }
+    om_family(out, "dnsmeter_thread_queries_sent", "counter", "Queries sent by each sender thread in the current step");
+    for (size_t i = 0; i < sample.threads.size(); i++) {
+        out.appendf("dnsmeter_thread_queries_sent_total{thread=\"%zu\"} %llu\n", i, sample.threads[i].packets_send);
+    }
+
+    om_family(out, "dnsmeter_rtt_seconds", "histogram", "Round trip time of responses in the current step");
+    for (int i = 0; rtt_buckets[i] > 0.0; i++) {
+        out.appendf("dnsmeter_rtt_seconds_bucket{le=\"%g\"} %llu\n", rtt_buckets[i], r.rtt_histogram.countBelow(rtt_buckets[i]));
+    }
+    out.appendf("dnsmeter_rtt_seconds_bucket{le=\"+Inf\"} %llu\n", r.rtt_histogram.count());
+    out.appendf("dnsmeter_rtt_seconds_count %llu\n", r.rtt_histogram.count());
+    out.appendf("dnsmeter_rtt_seconds_sum %0.6f\n", r.rtt_total);
+    om_family(out, "dnsmeter_rtt_quantile_seconds", "gauge", "Round trip time quantiles in the current step");
+    for (int i = 0; rtt_quantiles[i] > 0.0; i++) {
+        out.appendf("dnsmeter_rtt_quantile_seconds{quantile=\"%g\"} %0.6f\n", rtt_quantiles[i] / 100.0,
+            r.rtt_histogram.percentile(rtt_quantiles[i]));
+    }
+    om_family(out, "dnsmeter_rtt_min_seconds", "gauge", "Minimum round trip time in the current step");
+    out.appendf("dnsmeter_rtt_min_seconds %0.6f\n", r.rtt_min);
+    om_family(out, "dnsmeter_rtt_max_seconds", "gauge", "Maximum round trip time in the current step");
+    out.appendf("dnsmeter_rtt_max_seconds %0.6f\n", r.rtt_max);
+    om_family(out, "dnsmeter_rtt_avg_seconds", "gauge", "Average round trip time in the current step");
+    out.appendf("dnsmeter_rtt_avg_seconds %0.6f\n", r.rtt_avg);
+
+    if (r.connects || r.connect_errors) {
+        om_family(out, "dnsmeter_connections_opened", "counter", "Connections established in the current step");
+        out.appendf("dnsmeter_connections_opened_total %llu\n", r.connects);
+        om_family(out, "dnsmeter_connection_errors", "counter", "Connections which could not be established");
+        out.appendf("dnsmeter_connection_errors_total %llu\n", r.connect_errors);
+        om_family(out, "dnsmeter_connections_closed", "counter", "Connections closed by the target or failed");
+        out.appendf("dnsmeter_connections_closed_total %llu\n", r.connections_closed);
+        om_family(out, "dnsmeter_connection_queries_dropped", "counter", "Outstanding queries lost with a connection");
+        out.appendf("dnsmeter_connection_queries_dropped_total %llu\n", r.queries_dropped);
+        om_family(out, "dnsmeter_tls_sessions_resumed", "counter", "TLS handshakes which resumed a session");
+        out.appendf("dnsmeter_tls_sessions_resumed_total %llu\n", r.resumed);
+        om_family(out, "dnsmeter_handshake_seconds", "histogram", "Connection handshake time in the current step");
+        for (int i = 0; rtt_buckets[i] > 0.0; i++) {
+            out.appendf("dnsmeter_handshake_seconds_bucket{le=\"%g\"} %llu\n", rtt_buckets[i],
+                r.handshake_histogram.countBelow(rtt_buckets[i]));
+        }
+        out.appendf("dnsmeter_handshake_seconds_bucket{le=\"+Inf\"} %llu\n", r.handshake_histogram.count());
+        out.appendf("dnsmeter_handshake_seconds_count %llu\n", r.handshake_histogram.count());
+    }
+
+    if (havePrevious) {
+        om_family(out, "dnsmeter_cpu_usage_percent", "gauge", "System CPU usage in the last interval");
+        out.appendf("dnsmeter_cpu_usage_percent %0.2f\n", SystemStat::Cpu::getUsage(previous.sys.cpu, sample.sys.cpu));
+    }
+    om_family(out, "dnsmeter_memory_free_bytes", "gauge", "Free system memory");
+    out.appendf("dnsmeter_memory_free_bytes %ld\n", sample.sys.sysinfo.freeram);
+    om_family(out, "dnsmeter_memory_total_bytes", "gauge", "Total system memory");
+    out.appendf("dnsmeter_memory_total_bytes %ld\n", sample.sys.sysinfo.totalram);
+
+    om_network(out, sample.sys);
+    out.append("# EOF\n");
+
+    // Write to a temporary file and rename it, readers never see a
+    // partially written file
+    ppl7::String tmpname;
+    tmpname.setf("%s.tmp", (const char*)OpenMetricsFileName);
+    try {
+        ppl7::File ff;
+        ff.open(tmpname, ppl7::File::WRITE);
+        ff.write(out.c_str(), out.size());
+        ff.close();
+        if (rename((const char*)tmpname, (const char*)OpenMetricsFileName) != 0) {
+            printf("WARNING: could not rename metrics file [%s]: %s\n",
+                (const char*)tmpname, strerror(errno));
+        }
+    } catch (const ppl7::Exception& e) {
+        printf("WARNING: could not write metrics file [%s]\n", (const char*)tmpname);
+        e.print();
+    }
+}
+
+static void json_network(ppl7::String& out, const char* name, const SystemStat::Interface& nif)
+{
+    out.appendf("\"%s\":{\"receive\":{\"bytes\":%lu,\"packets\":%lu,\"errs\":%lu,\"drop\":%lu},"
+                "\"transmit\":{\"bytes\":%lu,\"packets\":%lu,\"errs\":%lu,\"drop\":%lu}}",
+        name,
+        nif.receive.bytes, nif.receive.packets, nif.receive.errs, nif.receive.drop,
+        nif.transmit.bytes, nif.transmit.packets, nif.transmit.errs, nif.transmit.drop);
+}
+
+void MetricsWriter::writeJsonLine(const MetricsWriter::Sample& sample, double interval)
+{
+    const DNSSender::Results& r = sample.results;
+    ppl7::String              out;
+
+    out.appendf("{\"timestamp\":%0.6f,\"step\":%d,\"queryrate\":%d,\"elapsed\":%0.3f,",
+        sample.timestamp, sample.step, r.queryrate, sample.elapsed);
+    out.appendf("\"counter_send\":%llu,\"counter_received\":%llu,\"bytes_send\":%llu,"
+                "\"bytes_received\":%llu,\"counter_errors\":%llu,\"packages_lost\":%llu,"
+                "\"counter_0bytes\":%llu,\"truncated\":%llu,\"dropped_local\":%llu,\"backoffs\":%llu,",
+        r.counter_send, r.counter_received, r.bytes_send, r.bytes_received,
+        r.counter_errors, r.packages_lost, r.counter_0bytes, r.truncated,
+        r.dropped_local, r.backoffs);
+    if (havePrevious && interval > 0.0) {
+        const DNSSender::Results& p = previous.results;
+        out.appendf("\"interval\":%0.6f,\"send_rate\":%0.1f,\"receive_rate\":%0.1f,", interval,
+            rate(r.counter_send, p.counter_send, interval),
+            rate(r.counter_received, p.counter_received, interval));
+    }
+
+    out.append("\"errorcodes\":{");
+    bool first = true;
+    for (int i = 0; i < 255; i++) {
+        if (!r.counter_errorcodes[i])
+            continue;
+        out.appendf("%s\"%d\":%llu", first ? "" : ",", i, r.counter_errorcodes[i]);
+        first = false;
+    }
+    out.append("},\"rcodes\":{");
+    for (int i = 0; i < 16; i++) {
+        out.appendf("%s\"%s\":%llu", i ? "," : "", getRcodeName(i), r.rcodes[i]);
+    }
+    out.appendf("},\"rtt\":{\"total\":%0.6f,\"avg\":%0.6f,\"min\":%0.6f,\"max\":%0.6f",
+        r.rtt_total, r.rtt_avg, r.rtt_min, r.rtt_max);
+    for (int i = 0; rtt_quantiles[i] > 0.0; i++) {
+        out.appendf(",\"p%g\":%0.6f", rtt_quantiles[i], r.rtt_histogram.percentile(rtt_quantiles[i]));
+    }
+    out.append(",\"histogram\":[");
+    first = true;
+    for (int i = 0; i < RTTHistogram::BUCKETS; i++) {
+        if (!r.rtt_histogram.bucketCount(i))
+            continue;
+        out.appendf("%s[%0.6f,%llu]", first ? "" : ",", RTTHistogram::bucketUpperBound(i),
+            r.rtt_histogram.bucketCount(i));
+        first = false;
+    }
+    out.appendf("]},\"connections\":{\"opened\":%llu,\"errors\":%llu,\"closed\":%llu,\"queries_dropped\":%llu,"
+                "\"resumed\":%llu",
+        r.connects, r.connect_errors, r.connections_closed, r.queries_dropped, r.resumed);
+    for (int i = 0; rtt_quantiles[i] > 0.0; i++) {
+        out.appendf(",\"handshake_p%g\":%0.6f", rtt_quantiles[i], r.handshake_histogram.percentile(rtt_quantiles[i]));
+    }
+    out.append("},\"threads\":[");
+    for (size_t i = 0; i < sample.threads.size(); i++) {
+        out.appendf("%s{\"counter_send\":%llu,\"bytes_send\":%llu,\"errors\":%llu", i ? "," : "",
+            sample.threads[i].packets_send, sample.threads[i].bytes_send, sample.threads[i].errors);
+        if (havePrevious && interval > 0.0 && sample.threads.size() == previous.threads.size()) {
+            out.appendf(",\"send_rate\":%0.1f",
+                rate(sample.threads[i].packets_send, previous.threads[i].packets_send, interval));
+        }
+        out.append("}");
+    }
+    out.append("],\"system\":{");
+    if (havePrevious)
+        out.appendf("\"cpu_usage\":%0.2f,", SystemStat::Cpu::getUsage(previous.sys.cpu, sample.sys.cpu));
+    out.appendf("\"freeram\":%ld,\"totalram\":%ld,\"network\":{",
+        sample.sys.sysinfo.freeram, sample.sys.sysinfo.totalram);
+    json_network(out, "all", sample.sys.net_total);
+    std::map<ppl7::String, SystemStat::Interface>::const_iterator it;
+    for (it = sample.sys.interfaces.begin(); it != sample.sys.interfaces.end(); ++it) {
+        out.append(",");
+        json_network(out, (const char*)it->second.Name, it->second);
+    }
+    out.append("}}}\n");
+
+    openJsonStream();
+    if (json_fd < 0)
+        return;
+    // A new line is dropped until the previous one is complete, so that
+    // the reader never sees a torn line.
+    if (!flushJsonStream())
+        return;
+    JsonPending = out;
+    flushJsonStream();
+}
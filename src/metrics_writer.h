@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dns_sender.h"
+#include "dns_sender_thread.h"
+#include "system_stat.h"
+
+#include <ppl7.h>
+#include <vector>
+
+#ifndef __dnsmeter_metrics_writer_h
+#define __dnsmeter_metrics_writer_h
+
+/*
+ * Publishes live metrics once per report interval. It is only called from
+ * the reporting (main) thread with snapshots of the thread counters, so it
+ * never touches the sender or receiver hot path.
+ */
+class MetricsWriter {
+private:
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || __cplusplus >= 201103L
+    MetricsWriter& operator=(const MetricsWriter& other);
+    MetricsWriter(MetricsWriter &&other) noexcept;
+    MetricsWriter const & operator=(MetricsWriter &&other);
+#endif
+
+public:
+    class Sample {
+    public:
+        double             timestamp;
+        double             elapsed;
+        int                step;
+        DNSSender::Results results;
+        SystemStat         sys;
+
+        std::vector<DNSSenderThread::Counter> threads;
+        Sample();
+    };
+
+private:
+    ppl7::String OpenMetricsFileName;
+    ppl7::String JsonFileName;
+    ppl7::String JsonPending;
+    int          json_fd;
+    bool         havePrevious;
+    Sample       previous;
+
+    void writeOpenMetrics(const Sample& sample, double interval);
+    void writeJsonLine(const Sample& sample, double interval);
+    void openJsonStream();
+    bool flushJsonStream();
+
+public:
+    MetricsWriter();
+    ~MetricsWriter();
+    void setOpenMetricsFile(const ppl7::String& Filename);
+    void setJsonFile(const ppl7::String& Filename);
+    void startStep();
+    void write(const Sample& sample);
+};
+
+#endif
@@ -22,6 +22,7 @@
 #include "config.h"
 
 #include "packet.h"
+#include "checksum.h"
 #include "exceptions.h"
 #include "query.h"
 
@@ -29,79 +30,58 @@
 #include <netinet/in.h>
 #include <string.h>
 #include <netinet/ip.h>
+#include <netinet/ip6.h>
 #include <netinet/udp.h>
 #include <math.h>
 
 #define USZ sizeof(struct udphdr)
 #define ISZ sizeof(struct ip)
-#define HDRSZ ISZ + USZ
+#define I6SZ sizeof(struct ip6_hdr)
 #define MAXPACKETSIZE 4096
 
-static unsigned short in_cksum(unsigned short* addr, int len)
+static unsigned short in_cksum(const void* addr, int len)
 {
-    int             nleft  = len;
-    unsigned short* w      = addr;
-    int             sum    = 0;
-    unsigned short  answer = 0;
-    while (nleft > 1) {
-        sum += *w++;
-        nleft -= 2;
-    }
-    if (nleft == 1) {
-        *(unsigned char*)(&answer) = *(unsigned char*)w;
-        sum += answer;
-    }
-    sum = (sum >> 16) + (sum & 0xffff);
-    sum += (sum >> 16);
-    answer = ~sum;
-    return (answer);
-}
-
-static unsigned short udp_cksum(const struct ip* iphdr, const struct udphdr* udp, const unsigned char* payload, size_t payload_size)
-{
-    unsigned char cbuf[MAXPACKETSIZE];
-    memset(cbuf, 0, sizeof(cbuf));
-    unsigned char* p  = (unsigned char*)cbuf;
-    *(unsigned int*)p = iphdr->ip_src.s_addr;
-    p += sizeof(unsigned int);
-    *(unsigned int*)p = iphdr->ip_dst.s_addr;
-    p += sizeof(unsigned int);
-    *(unsigned char*)p++ = 0;
-    *(unsigned char*)p++ = iphdr->ip_p;
-    *(unsigned short*)p  = udp->uh_ulen;
-    p += sizeof(unsigned short);
-    memcpy(p, udp, USZ);
-    p += USZ;
-    memcpy(p, payload, payload_size);
-    return in_cksum((unsigned short*)cbuf, sizeof(uint) * 3 + sizeof(struct udphdr) + payload_size + (payload_size % 2));
+    return (unsigned short)~Checksum::fold(Checksum::add(0, addr, len));
+}
+
+static unsigned short cksum_fold(unsigned int sum)
+{
+    unsigned short answer = ~Checksum::fold(sum);
+    // 0 means "no checksum" for UDP, which is not allowed for IPv6
+    return answer ? answer : 0xffff;
+}
+
+/*
+ * The pseudo header is summed up in place instead of copying the whole
+ * packet into a scratch buffer. Protocol and length are in network byte
+ * order, padded with zeros to 16 and 32 bit in the IPv4 and IPv6 pseudo
+ * headers, which does not change the sum.
+ */
+static unsigned short udp_cksum(const struct ip* iphdr, const struct udphdr* udp, unsigned int payload_sum)
+{
+    unsigned int sum = Checksum::add(payload_sum, &iphdr->ip_src, 2 * sizeof(struct in_addr));
+    sum += htons(IPPROTO_UDP) + udp->uh_ulen;
+    return cksum_fold(Checksum::add(sum, udp, USZ));
+}
+
+static unsigned short udp6_cksum(const struct ip6_hdr* ip6hdr, const struct udphdr* udp, unsigned int payload_sum)
+{
+    unsigned int sum = Checksum::add(payload_sum, &ip6hdr->ip6_src, 2 * sizeof(struct in6_addr));
+    sum += htons(IPPROTO_UDP) + udp->uh_ulen;
+    return cksum_fold(Checksum::add(sum, udp, USZ));
 }
 
 Packet::Packet()
 {
     buffersize   = MAXPACKETSIZE;
     payload_size = 0;
+    family       = 0;
+    l3size       = 0;
+    reference    = NULL;
     buffer       = (unsigned char*)calloc(1, buffersize);
     if (!buffer)
         throw ppl7::OutOfMemoryException();
-
-    struct ip*     iphdr = (struct ip*)buffer;
-    struct udphdr* udp   = (struct udphdr*)(buffer + ISZ);
-
-    iphdr->ip_hl         = ISZ >> 2;
-    iphdr->ip_v          = IPVERSION;
-    iphdr->ip_tos        = 0;
-    iphdr->ip_off        = 0;
-    iphdr->ip_ttl        = 64;
-    iphdr->ip_p          = IPPROTO_UDP;
-    iphdr->ip_sum        = 0;
-    iphdr->ip_id         = 0;
-    iphdr->ip_src.s_addr = 0;
-    iphdr->ip_dst.s_addr = 0;
-    iphdr->ip_len        = htons(HDRSZ + payload_size);
-    iphdr->ip_sum        = in_cksum((unsigned short*)iphdr, ISZ);
-
-    udp->uh_ulen = htons(USZ + payload_size);
-    chksum_valid = false;
+    setFamily(ppl7::IPAddress::IPv4);
 }
 
 Packet::~Packet()
@@ -109,24 +89,85 @@ Packet::~Packet()
     free(buffer);
 }
 
+/*
+ * Switches between the IPv4 and IPv6 header layout. The payload is moved
+ * behind the new header, addresses have to be set again.
+ */
+void Packet::setFamily(int family)
+{
+    if (family == this->family)
+        return;
+    size_t newsize = (family == ppl7::IPAddress::IPv6) ? I6SZ : ISZ;
+    if (payload_size)
+        memmove(buffer + newsize + USZ, buffer + l3size + USZ, reference ? 2 : payload_size);
+    memset(buffer, 0, newsize + USZ);
+    this->family = family;
+    l3size       = newsize;
+    if (family == ppl7::IPAddress::IPv6) {
+        struct ip6_hdr* ip6hdr = (struct ip6_hdr*)buffer;
+        ip6hdr->ip6_flow       = htonl(6 << 28);
+        ip6hdr->ip6_nxt        = IPPROTO_UDP;
+        ip6hdr->ip6_hlim       = 64;
+    } else if (family == ppl7::IPAddress::IPv4) {
+        struct ip* iphdr = (struct ip*)buffer;
+        iphdr->ip_hl     = ISZ >> 2;
+        iphdr->ip_v      = IPVERSION;
+        iphdr->ip_tos    = 0;
+        iphdr->ip_off    = 0;
+        iphdr->ip_ttl    = 64;
+        iphdr->ip_p      = IPPROTO_UDP;
+    } else {
+        throw UnsupportedIPFamily();
+    }
+    updateLength();
+}
+
+void Packet::updateLength()
+{
+    struct udphdr* udp = (struct udphdr*)(buffer + l3size);
+    if (family == ppl7::IPAddress::IPv6)
+        ((struct ip6_hdr*)buffer)->ip6_plen = htons(USZ + payload_size);
+    else
+        ((struct ip*)buffer)->ip_len = htons(l3size + USZ + payload_size);
+    udp->uh_ulen = htons(USZ + payload_size);
+    chksum_valid = false;
+}
+
 void Packet::setSource(const ppl7::IPAddress& ip_addr, int port)
 {
-    struct ip*     iphdr = (struct ip*)buffer;
-    struct udphdr* udp   = (struct udphdr*)(buffer + ISZ);
-    iphdr->ip_src.s_addr = *(in_addr_t*)ip_addr.addr();
-    udp->uh_sport        = htons(port);
-    chksum_valid         = false;
+    setFamily(ip_addr.family());
+    struct udphdr* udp = (struct udphdr*)(buffer + l3size);
+    if (family == ppl7::IPAddress::IPv6)
+        memcpy(&((struct ip6_hdr*)buffer)->ip6_src, ip_addr.addr(), sizeof(struct in6_addr));
+    else
+        ((struct ip*)buffer)->ip_src.s_addr = *(in_addr_t*)ip_addr.addr();
+    udp->uh_sport = htons(port);
+    chksum_valid  = false;
 }
 
 void Packet::randomSourcePort()
 {
-    struct udphdr* udp = (struct udphdr*)(buffer + ISZ);
+    struct udphdr* udp = (struct udphdr*)(buffer + l3size);
     udp->uh_sport      = htons(ppl7::rand(1024, 65535));
     chksum_valid       = false;
 }
 
+void Packet::randomSourcePort(unsigned int modulo, unsigned int remainder)
+{
+    struct udphdr* udp  = (struct udphdr*)(buffer + l3size);
+    unsigned int   port = ppl7::rand((1024 + modulo - 1) / modulo, 65535 / modulo) * modulo + remainder;
+    if (port > 65535)
+        port -= modulo;
+    udp->uh_sport = htons(port);
+    chksum_valid  = false;
+}
+
 void Packet::randomSourceIP(const ppl7::IPNetwork& net)
 {
+    if (net.family() == ppl7::IPAddress::IPv6) {
+        randomSourceIPv6((const unsigned char*)net.first().addr(), net.prefixlen());
+        return;
+    }
     struct ip* iphdr     = (struct ip*)buffer;
     in_addr_t  start     = ntohl(*(in_addr_t*)net.first().addr());
     size_t     size      = powl(2, 32 - net.prefixlen());
@@ -141,27 +182,62 @@ void Packet::randomSourceIP(unsigned int start, unsigned int size)
     chksum_valid         = false;
 }
 
-void Packet::useSourceFromPcap(const char* pkt, size_t size)
+/*
+ * Keeps the first prefixlen bits of prefix and randomizes the rest, one
+ * random number per 32 bit word which is not completely covered by the
+ * prefix. A /64 needs two of them.
+ */
+void Packet::randomSourceIPv6(const unsigned char* prefix, int prefixlen)
 {
-    const struct ip*     s_iphdr = (const struct ip*)(pkt + 14);
-    const struct udphdr* s_udp   = (const struct udphdr*)(pkt + 14 + sizeof(struct ip));
-    struct ip*           iphdr   = (struct ip*)buffer;
-    struct udphdr*       udp     = (struct udphdr*)(buffer + ISZ);
-    iphdr->ip_src.s_addr         = s_iphdr->ip_src.s_addr;
-    udp->uh_sport                = s_udp->uh_sport;
+    unsigned int*       src = (unsigned int*)&((struct ip6_hdr*)buffer)->ip6_src;
+    const unsigned int* net = (const unsigned int*)prefix;
+    for (int i = 0; i < 4; i++) {
+        int bits = prefixlen - i * 32;
+        if (bits >= 32) {
+            src[i] = net[i];
+            continue;
+        }
+        unsigned int hostmask = (bits <= 0) ? 0xffffffff : (0xffffffff >> bits);
+        src[i]                = htonl((ntohl(net[i]) & ~hostmask) | (ppl7::rand(0, 0xffffffff) & hostmask));
+    }
+    chksum_valid = false;
+}
+
+/*
+ * Sets the source address and port of a query from a pcap file, the port
+ * is in network byte order.
+ */
+void Packet::useSourceFromPcap(int family, const void* addr, unsigned short port)
+{
+    // queries of the other address family keep the previous source
+    if (family != this->family)
+        return;
+    struct udphdr* udp = (struct udphdr*)(buffer + l3size);
+    if (family == ppl7::IPAddress::IPv6)
+        memcpy(&((struct ip6_hdr*)buffer)->ip6_src, addr, sizeof(struct in6_addr));
+    else
+        memcpy(&((struct ip*)buffer)->ip_src, addr, sizeof(struct in_addr));
+    udp->uh_sport = port;
+    chksum_valid  = false;
 }
 
 void Packet::setDestination(const ppl7::IPAddress& ip_addr, int port)
 {
-    struct ip*     iphdr = (struct ip*)buffer;
-    struct udphdr* udp   = (struct udphdr*)(buffer + ISZ);
-    iphdr->ip_dst.s_addr = *(in_addr_t*)ip_addr.addr();
-    udp->uh_dport        = htons(port);
-    chksum_valid         = false;
+    setFamily(ip_addr.family());
+    struct udphdr* udp = (struct udphdr*)(buffer + l3size);
+    if (family == ppl7::IPAddress::IPv6)
+        memcpy(&((struct ip6_hdr*)buffer)->ip6_dst, ip_addr.addr(), sizeof(struct in6_addr));
+    else
+        ((struct ip*)buffer)->ip_dst.s_addr = *(in_addr_t*)ip_addr.addr();
+    udp->uh_dport = htons(port);
+    chksum_valid  = false;
 }
 
 void Packet::setIpId(unsigned short id)
 {
+    // IPv6 has no identification field outside of fragments
+    if (family != ppl7::IPAddress::IPv4)
+        return;
     struct ip* iphdr = (struct ip*)buffer;
     iphdr->ip_id     = htons(id);
     chksum_valid     = false;
@@ -169,52 +245,107 @@ void Packet::setIpId(unsigned short id)
 
 void Packet::setDnsId(unsigned short id)
 {
-    *((unsigned short*)(buffer + HDRSZ)) = htons(id);
-    chksum_valid                         = false;
+    *((unsigned short*)(buffer + l3size + USZ)) = htons(id);
+    chksum_valid                                = false;
 }
 
 void Packet::setPayload(const void* payload, size_t size)
 {
-    if (size + HDRSZ > MAXPACKETSIZE)
-        throw BufferOverflow("%zd > %zd", size, MAXPACKETSIZE - HDRSZ);
-    memcpy(buffer + HDRSZ, payload, size);
-    payload_size         = size;
-    struct ip*     iphdr = (struct ip*)buffer;
-    struct udphdr* udp   = (struct udphdr*)(buffer + ISZ);
-    iphdr->ip_len        = htons(HDRSZ + payload_size);
-    udp->uh_ulen         = htons(USZ + payload_size);
-    chksum_valid         = false;
+    if (size + l3size + USZ > MAXPACKETSIZE)
+        throw BufferOverflow("%zd > %zd", size, MAXPACKETSIZE - l3size - USZ);
+    memcpy(buffer + l3size + USZ, payload, size);
+    payload_size = size;
+    reference    = NULL;
+    updateLength();
+}
+
+/*
+ * Uses the payload in place instead of copying it, it must not change or
+ * go away until the packet is sent. Only the DNS ID is copied into the
+ * packet, so that setDnsId() does not touch the payload. The packet is
+ * sent from two pieces with gather().
+ */
+void Packet::setPayloadReference(const void* payload, size_t size)
+{
+    if (size + l3size + USZ > MAXPACKETSIZE)
+        throw BufferOverflow("%zd > %zd", size, MAXPACKETSIZE - l3size - USZ);
+    if (size < 2)
+        throw ppl7::InvalidArgumentsException();
+    memcpy(buffer + l3size + USZ, payload, 2);
+    payload_size = size;
+    reference    = (const unsigned char*)payload;
+    updateLength();
 }
 
 void Packet::setPayloadDNSQuery(const ppl7::String& query, bool dnssec)
 {
-    payload_size         = MakeQuery(query, buffer + HDRSZ, buffersize - HDRSZ, dnssec);
-    struct ip*     iphdr = (struct ip*)buffer;
-    struct udphdr* udp   = (struct udphdr*)(buffer + ISZ);
-    iphdr->ip_len        = htons(HDRSZ + payload_size);
-    udp->uh_ulen         = htons(USZ + payload_size);
-    chksum_valid         = false;
+    payload_size = MakeQuery(query, buffer + l3size + USZ, buffersize - l3size - USZ, dnssec);
+    reference    = NULL;
+    updateLength();
 }
 
 void Packet::updateChecksums()
 {
-    struct ip*     iphdr = (struct ip*)buffer;
-    struct udphdr* udp   = (struct udphdr*)(buffer + ISZ);
-    iphdr->ip_sum        = 0;
-    iphdr->ip_sum        = in_cksum((unsigned short*)iphdr, ISZ);
-    udp->uh_sum          = 0;
-    udp->uh_sum          = udp_cksum(iphdr, udp, buffer + HDRSZ, payload_size);
-    chksum_valid         = true;
+    struct udphdr*       udp     = (struct udphdr*)(buffer + l3size);
+    const unsigned char* payload = buffer + l3size + USZ;
+    unsigned int         sum;
+    // the DNS ID is in the packet, the rest of a referenced payload not
+    if (reference)
+        sum = Checksum::add(Checksum::add(0, payload, 2), reference + 2, payload_size - 2);
+    else
+        sum = Checksum::add(0, payload, payload_size);
+    udp->uh_sum = 0;
+    if (family == ppl7::IPAddress::IPv6) {
+        udp->uh_sum = udp6_cksum((struct ip6_hdr*)buffer, udp, sum);
+    } else {
+        struct ip* iphdr = (struct ip*)buffer;
+        iphdr->ip_sum    = 0;
+        iphdr->ip_sum    = in_cksum(iphdr, ISZ);
+        udp->uh_sum      = udp_cksum(iphdr, udp, sum);
+    }
+    chksum_valid = true;
+}
+
+void Packet::finalize()
+{
+    if (!chksum_valid)
+        updateChecksums();
 }
 
 size_t Packet::size() const
 {
-    return HDRSZ + payload_size;
+    return l3size + USZ + payload_size;
 }
 
+/*
+ * Returns the whole packet in one piece, a referenced payload is copied
+ * into the packet for this.
+ */
 unsigned char* Packet::ptr()
 {
-    if (!chksum_valid)
-        updateChecksums();
+    if (reference) {
+        memcpy(buffer + l3size + USZ + 2, reference + 2, payload_size - 2);
+        reference = NULL;
+    }
+    finalize();
     return buffer;
 }
+
+/*
+ * Fills iov with the pieces of the packet for sendmsg() and returns their
+ * number: headers and DNS ID from the packet and the rest of a referenced
+ * payload, or the whole packet if the payload was copied.
+ */
+int Packet::gather(struct iovec* iov)
+{
+    finalize();
+    iov[0].iov_base = buffer;
+    if (!reference) {
+        iov[0].iov_len = l3size + USZ + payload_size;
+        return 1;
+    }
+    iov[0].iov_len  = l3size + USZ + 2;
+    iov[1].iov_base = (void*)(reference + 2);
+    iov[1].iov_len  = payload_size - 2;
+    return 2;
+}
@@ -21,6 +21,7 @@
 
 #include <ppl7.h>
 #include <ppl7-inet.h>
+#include <sys/uio.h>
 
 #ifndef __dnsmeter_packet_h
 #define __dnsmeter_packet_h
@@ -33,11 +34,16 @@ private:
     Packet const & operator=(Packet &&other);
 #endif
 
-    unsigned char* buffer;
-    int            buffersize;
-    int            payload_size;
-    bool           chksum_valid;
+    unsigned char*       buffer;
+    const unsigned char* reference;
+    int                  buffersize;
+    int                  payload_size;
+    int                  family;
+    size_t               l3size;
+    bool                 chksum_valid;
 
+    void setFamily(int family);
+    void updateLength();
     void updateChecksums();
 
 public:
@@ -46,17 +52,22 @@ public:
     void setSource(const ppl7::IPAddress& ip_addr, int port);
     void setDestination(const ppl7::IPAddress& ip_addr, int port);
     void setPayload(const void* payload, size_t size);
+    void setPayloadReference(const void* payload, size_t size);
     void setPayloadDNSQuery(const ppl7::String& query, bool dnssec = false);
     void setDnsId(unsigned short id);
     void setIpId(unsigned short id);
 
     void randomSourceIP(const ppl7::IPNetwork& net);
     void randomSourceIP(unsigned int start, unsigned int size);
+    void randomSourceIPv6(const unsigned char* prefix, int prefixlen);
     void randomSourcePort();
-    void useSourceFromPcap(const char* pkt, size_t size);
+    void randomSourcePort(unsigned int modulo, unsigned int remainder);
+    void useSourceFromPcap(int family, const void* addr, unsigned short port);
 
     size_t         size() const;
     unsigned char* ptr();
+    void           finalize();
+    int            gather(struct iovec* iov);
 };
 
 #endif
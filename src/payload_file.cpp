@@ -30,16 +30,169 @@
 #include <arpa/inet.h>
 #include <pcap/pcap.h>
 #include <netinet/ip.h>
+#include <netinet/ip6.h>
 #include <netinet/udp.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
 
-#pragma pack(push) /* push current alignment to stack */
-#pragma pack(1) /* set alignment to 1 byte boundary */
-struct ETHER {
-    unsigned char  destination[6];
-    unsigned char  source[6];
-    unsigned short type;
+// A query must fit into a packet with IPv6 and UDP header
+#define MAX_QUERY_SIZE (4096 - 40 - 8)
+
+/*
+ * A DNS query found in a captured packet
+ */
+struct PcapQuery {
+    const u_char*  dns;
+    size_t         size;
+    int            family;
+    const void*    source;
+    unsigned short port;
 };
-#pragma pack(pop) /* restore original alignment from stack */
+
+static bool supported_link_type(int linktype)
+{
+    switch (linktype) {
+    case DLT_EN10MB:
+    case DLT_LINUX_SLL:
+#ifdef DLT_LINUX_SLL2
+    case DLT_LINUX_SLL2:
+#endif
+    case DLT_NULL:
+    case DLT_LOOP:
+    case DLT_RAW:
+#ifdef DLT_IPV4
+    case DLT_IPV4:
+#endif
+#ifdef DLT_IPV6
+    case DLT_IPV6:
+#endif
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Returns the size of the link layer header in front of the IP header, or
+ * -1 if the frame does not carry IPv4 or IPv6. Ethernet frames can have
+ * stacked 802.1Q and 802.1ad VLAN tags.
+ */
+static int link_header_size(int linktype, const u_char* pkt, size_t caplen)
+{
+    size_t         offset = 0;
+    unsigned short type   = 0;
+    switch (linktype) {
+    case DLT_EN10MB:
+        offset = 14;
+        if (caplen < offset)
+            return -1;
+        type = (pkt[12] << 8) | pkt[13];
+        while (type == 0x8100 || type == 0x88a8 || type == 0x9100) {
+            if (caplen < offset + 4)
+                return -1;
+            type = (pkt[offset + 2] << 8) | pkt[offset + 3];
+            offset += 4;
+        }
+        break;
+    case DLT_LINUX_SLL:
+        offset = 16;
+        if (caplen < offset)
+            return -1;
+        type = (pkt[14] << 8) | pkt[15];
+        break;
+#ifdef DLT_LINUX_SLL2
+    case DLT_LINUX_SLL2:
+        offset = 20;
+        if (caplen < offset)
+            return -1;
+        type = (pkt[0] << 8) | pkt[1];
+        break;
+#endif
+    case DLT_NULL:
+    case DLT_LOOP:
+        // the address family differs between systems, the IP version
+        // tells the protocol
+        offset = 4;
+        if (caplen < offset)
+            return -1;
+        break;
+    default:
+        // raw IPv4 or IPv6
+        break;
+    }
+    if (type != 0 && type != 0x0800 && type != 0x86dd)
+        return -1;
+    return (int)offset;
+}
+
+/*
+ * Finds a complete DNS query to port 53 in the IP packet at pkt. IPv4
+ * options and IPv6 hop-by-hop, routing and destination options are
+ * skipped, fragments and queries cut off by the capture are ignored.
+ */
+static bool find_dns_query(const u_char* pkt, size_t len, PcapQuery& q)
+{
+    size_t offset;
+    if (len < 20)
+        return false;
+    if ((pkt[0] >> 4) == 4) {
+        const struct ip* iphdr = (const struct ip*)pkt;
+        offset                 = iphdr->ip_hl * 4;
+        if (offset < 20 || iphdr->ip_p != IPPROTO_UDP)
+            return false;
+        if (ntohs(iphdr->ip_off) & (IP_MF | IP_OFFMASK))
+            return false;
+        // the capture can contain link layer padding after the packet
+        size_t total = ntohs(iphdr->ip_len);
+        if (total < len)
+            len = total;
+        q.family = ppl7::IPAddress::IPv4;
+        q.source = &iphdr->ip_src;
+    } else if ((pkt[0] >> 4) == 6) {
+        if (len < 40)
+            return false;
+        const struct ip6_hdr* ip6hdr = (const struct ip6_hdr*)pkt;
+        unsigned char         next   = ip6hdr->ip6_nxt;
+        size_t                total  = 40 + ntohs(ip6hdr->ip6_plen);
+        if (total < len)
+            len = total;
+        offset = 40;
+        while (next == IPPROTO_HOPOPTS || next == IPPROTO_ROUTING || next == IPPROTO_DSTOPTS) {
+            if (len < offset + 8)
+                return false;
+            next = pkt[offset];
+            offset += (pkt[offset + 1] + 1) * 8;
+        }
+        if (next != IPPROTO_UDP)
+            return false;
+        q.family = ppl7::IPAddress::IPv6;
+        q.source = &ip6hdr->ip6_src;
+    } else {
+        return false;
+    }
+    if (len < offset + sizeof(struct udphdr))
+        return false;
+    const struct udphdr* udp  = (const struct udphdr*)(pkt + offset);
+    size_t               ulen = ntohs(udp->uh_ulen);
+    if (udp->uh_dport != htons(53) || ulen < sizeof(struct udphdr))
+        return false;
+    q.dns  = pkt + offset + sizeof(struct udphdr);
+    q.size = ulen - sizeof(struct udphdr);
+    q.port = udp->uh_sport;
+    if (len < offset + ulen || q.size < sizeof(struct DNS_HEADER) || q.size > MAX_QUERY_SIZE)
+        return false;
+    const struct DNS_HEADER* dns = (const struct DNS_HEADER*)q.dns;
+    return dns->qr == 0 && dns->opcode == 0;
+}
+
+PayloadFile::Query::Query(const void* dns, size_t size)
+    : dns(dns, size)
+{
+    family = ppl7::IPAddress::UNKNOWN;
+    port   = 0;
+    memset(source, 0, sizeof(source));
+}
 
 PayloadFile::PayloadFile()
 {
@@ -60,6 +213,9 @@ bool PayloadFile::detectPcap(ppl7::File& ff)
         return true;
     if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1)
         return true;
+    // pcapng section header block, the same in both byte orders
+    if (magic == 0x0a0d0d0a)
+        return true;
     return false;
 }
 
@@ -80,6 +236,11 @@ void PayloadFile::openQueryFile(const ppl7::String& Filename)
     }
     printf("INFO: %llu queries loaded\n", validLinesInQueryFile);
     it = querycache.begin();
+    queries.clear();
+    queries.reserve(querycache.size());
+    for (std::list<Query>::const_iterator q = querycache.begin(); q != querycache.end(); ++q)
+        queries.push_back(&(*q));
+    popularity.clear();
 }
 
 void PayloadFile::loadAndCompile(ppl7::File& ff)
@@ -101,7 +262,7 @@ void PayloadFile::loadAndCompile(ppl7::File& ff)
             try {
                 // Precompile Query
                 int size = MakeQuery(buffer, compiled_query, 4096, false);
-                querycache.push_back(ppl7::ByteArray(compiled_query, size));
+                querycache.push_back(Query(compiled_query, size));
                 validLinesInQueryFile++;
             } catch (...) {
                 // ignore invalid queries
@@ -116,6 +277,11 @@ void PayloadFile::loadAndCompile(ppl7::File& ff)
     }
 }
 
+/*
+ * Loads the DNS queries of a pcap or pcapng file. Every packet is parsed
+ * once here, so the senders get the query without any headers in front
+ * and the source address and port for "-s pcap".
+ */
 void PayloadFile::loadAndCompilePcapFile(const ppl7::String& Filename)
 {
     char               errorbuffer[PCAP_ERRBUF_SIZE];
@@ -125,26 +291,28 @@ void PayloadFile::loadAndCompilePcapFile(const ppl7::String& Filename)
     pcap_t* pp            = pcap_open_offline((const char*)Filename, errorbuffer);
     if (!pp)
         throw InvalidQueryFile("%s", errorbuffer);
+    int linktype = pcap_datalink(pp);
+    if (!supported_link_type(linktype)) {
+        const char* name = pcap_datalink_val_to_name(linktype);
+        pcap_close(pp);
+        throw InvalidQueryFile("Unsupported link type %s in pcap file [%s]",
+            name ? name : "unknown", (const char*)Filename);
+    }
     ppluint64     pkts_total = 0;
     const u_char* pkt;
     while ((pkt = pcap_next(pp, &hdr)) != NULL) {
         pkts_total++;
-        //printf ("len=%d, caplen=%d\n",hdr.len,hdr.caplen);
-        const struct ETHER* eth = (const struct ETHER*)pkt;
-        if (hdr.caplen > 4096)
-            continue;
-        if (eth->type != htons(0x0800))
-            continue;
-        const struct ip* iphdr = (const struct ip*)(pkt + 14);
-        if (iphdr->ip_v != 4)
-            continue;
-        const struct udphdr* udp = (const struct udphdr*)(pkt + 14 + sizeof(struct ip));
-        if (udp->uh_dport != htons(53))
+        int header = link_header_size(linktype, pkt, hdr.caplen);
+        if (header < 0)
             continue;
-        const struct DNS_HEADER* dns = (const struct DNS_HEADER*)(pkt + 14 + sizeof(struct ip) + sizeof(struct udphdr));
-        if (dns->qr != 0 || dns->opcode != 0)
+        PcapQuery q;
+        if (!find_dns_query(pkt + header, hdr.caplen - header, q))
             continue;
-        querycache.push_back(ppl7::ByteArray(pkt, hdr.caplen));
+        querycache.push_back(Query(q.dns, q.size));
+        Query& entry = querycache.back();
+        entry.family = q.family;
+        entry.port   = q.port;
+        memcpy(entry.source, q.source, q.family == ppl7::IPAddress::IPv6 ? 16 : 4);
         validLinesInQueryFile++;
     }
     printf("Packets read from pcap file: %llu, valid UDP DNS queries: %llu\n",
@@ -155,18 +323,90 @@ void PayloadFile::loadAndCompilePcapFile(const ppl7::String& Filename)
     }
 }
 
-const ppl7::ByteArrayPtr& PayloadFile::getQuery()
+const PayloadFile::Query& PayloadFile::getQuery()
 {
     QueryMutex.lock();
-    const ppl7::ByteArrayPtr& bap = *it;
+    const Query& q = *it;
     ++it;
     if (it == querycache.end())
         it = querycache.begin();
     QueryMutex.unlock();
-    return bap;
+    return q;
 }
 
 bool PayloadFile::isPcap()
 {
     return payloadIsPcap;
 }
+
+/*
+ * Draws the queries from a Zipf distribution instead of using them in
+ * turn. The first query of the file is the most popular one.
+ */
+void PayloadFile::setZipf(double exponent)
+{
+    if (queries.empty())
+        throw InvalidQueryFile("No queries loaded");
+    std::vector<double> weights(queries.size());
+    for (size_t i = 0; i < weights.size(); i++)
+        weights[i] = 1.0 / pow((double)(i + 1), exponent);
+    popularity.build(weights);
+    printPopularity(weights);
+}
+
+/*
+ * Loads one weight per line for the queries in the order they were
+ * loaded. Empty lines and comments starting with "#" are skipped.
+ */
+void PayloadFile::loadWeights(const ppl7::String& Filename)
+{
+    if (queries.empty())
+        throw InvalidQueryFile("No queries loaded");
+    ppl7::File          ff(Filename, ppl7::File::READ);
+    ppl7::String        buffer;
+    std::vector<double> weights;
+    size_t              line = 0;
+    weights.reserve(queries.size());
+    while (!ff.eof()) {
+        try {
+            ff.gets(buffer, 1024);
+        } catch (const ppl7::EndOfFileException&) {
+            break;
+        }
+        line++;
+        buffer.trim();
+        if (buffer.isEmpty() || buffer.c_str()[0] == '#')
+            continue;
+        if (!buffer.pregMatch("/^[0-9]*\\.?[0-9]+([eE][-+]?[0-9]+)?$/"))
+            throw InvalidQueryFile("Invalid weight in line %zu of [%s]: %s",
+                line, (const char*)Filename, (const char*)buffer);
+        weights.push_back(buffer.toDouble());
+    }
+    if (weights.size() != queries.size())
+        throw InvalidQueryFile("%zu weights given for %zu queries [%s]",
+            weights.size(), queries.size(), (const char*)Filename);
+    popularity.build(weights);
+    printPopularity(weights);
+}
+
+/*
+ * Prints the share of the most popular queries, which is an upper bound
+ * for the cache hit ratio of a resolver with a cache of that size.
+ */
+void PayloadFile::printPopularity(std::vector<double> weights) const
+{
+    const size_t n = weights.size();
+    if (n < 100)
+        return;
+    std::sort(weights.begin(), weights.end(), std::greater<double>());
+    double total = 0.0, top1 = 0.0, top10 = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        if (i < n / 100)
+            top1 += weights[i];
+        if (i < n / 10)
+            top10 += weights[i];
+        total += weights[i];
+    }
+    printf("INFO: top 1%% of the queries make %0.1f%%, top 10%% make %0.1f%% of the traffic\n",
+        100.0 * top1 / total, 100.0 * top10 / total);
+}
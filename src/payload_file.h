@@ -19,28 +19,72 @@
  * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "alias_table.h"
+#include "fast_random.h"
+
 #include <ppl7.h>
 #include <list>
+#include <vector>
 
 #ifndef __dnsmeter_payload_file_h
 #define __dnsmeter_payload_file_h
 
 class PayloadFile {
+public:
+    /*
+     * A query of the payload file. Queries from a pcap file are stored
+     * without their link, IP and UDP headers, the source address and port
+     * they were captured with are kept next to them.
+     */
+    class Query {
+    public:
+        ppl7::ByteArray dns;
+        int             family;
+        unsigned short  port;
+        unsigned char   source[16];
+
+        Query(const void* dns, size_t size);
+        inline const void* ptr() const
+        {
+            return dns.ptr();
+        }
+        inline size_t size() const
+        {
+            return dns.size();
+        }
+    };
+
 private:
-    ppl7::Mutex                                QueryMutex;
-    ppluint64                                  validLinesInQueryFile;
-    std::list<ppl7::ByteArray>                 querycache;
-    std::list<ppl7::ByteArray>::const_iterator it;
-    bool                                       payloadIsPcap;
+    ppl7::Mutex                      QueryMutex;
+    ppluint64                        validLinesInQueryFile;
+    std::list<Query>                 querycache;
+    std::list<Query>::const_iterator it;
+    std::vector<const Query*>        queries;
+    AliasTable                       popularity;
+    bool                             payloadIsPcap;
     bool detectPcap(ppl7::File& ff);
     void loadAndCompile(ppl7::File& ff);
     void loadAndCompilePcapFile(const ppl7::String& Filename);
+    void printPopularity(std::vector<double> weights) const;
 
 public:
     PayloadFile();
-    void openQueryFile(const ppl7::String& Filename);
-    const ppl7::ByteArrayPtr& getQuery();
-    bool                      isPcap();
+    void         openQueryFile(const ppl7::String& Filename);
+    void         setZipf(double exponent);
+    void         loadWeights(const ppl7::String& Filename);
+    const Query& getQuery();
+    bool         isPcap();
+
+    /*
+     * Draws a query from the popularity distribution set with setZipf()
+     * or loadWeights(). Without one, the queries are used in turn.
+     */
+    inline const Query& getQuery(FastRandom& random)
+    {
+        if (popularity.empty())
+            return getQuery();
+        return *queries[popularity.sample(random)];
+    }
 };
 
 #endif
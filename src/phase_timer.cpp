@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "phase_timer.h"
+
+PhaseTimer::Counter::Counter()
+{
+    clear();
+}
+
+void PhaseTimer::Counter::clear()
+{
+    for (int i = 0; i < PHASES; i++)
+        cycles[i] = 0;
+}
+
+PhaseTimer::Counter& PhaseTimer::Counter::operator+=(const PhaseTimer::Counter& other)
+{
+    for (int i = 0; i < PHASES; i++)
+        cycles[i] += other.cycles[i];
+    return *this;
+}
+
+/*
+ * The rate of the cycle counter, measured once against the monotonic
+ * clock over 50 ms.
+ */
+double PhaseTimer::cyclesPerNanosecond()
+{
+    static double rate = 0.0;
+    if (rate > 0.0)
+        return rate;
+    struct timespec t1, t2;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    ppluint64 c1 = cycles();
+    ppl7::MSleep(50);
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+    ppluint64 c2   = cycles();
+    double    nsec = (double)(t2.tv_sec - t1.tv_sec) * 1000000000.0 + (double)(t2.tv_nsec - t1.tv_nsec);
+    rate           = (double)(c2 - c1) / nsec;
+    return rate;
+}
+
+const char* PhaseTimer::name(PhaseTimer::Phase phase)
+{
+    static const char* names[] = { "query", "copy", "random", "checksum", "send", "receive" };
+    if (phase < 0 || phase >= PHASES)
+        return "unknown";
+    return names[phase];
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "seqlock.h"
+
+#include <ppl7.h>
+#include <time.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#ifndef __dnsmeter_phase_timer_h
+#define __dnsmeter_phase_timer_h
+
+/*
+ * Cycle counter based timing of the phases of the send and receive path.
+ * Only every Nth pass is timed, for all others begin() just decrements a
+ * counter and mark() returns at once. The cycles of the timed passes are
+ * multiplied by N, which estimates the cycles of all passes.
+ */
+class PhaseTimer {
+public:
+    enum Phase {
+        QUERY,
+        COPY,
+        RANDOM,
+        CHECKSUM,
+        SEND,
+        RECEIVE,
+        PHASES
+    };
+
+    class Counter {
+    public:
+        ppluint64 cycles[PHASES];
+        Counter();
+        void     clear();
+        Counter& operator+=(const Counter& other);
+    };
+
+private:
+    CounterBlock<Counter>* block;
+    ppluint64              last;
+    unsigned int           interval;
+    unsigned int           countdown;
+    bool                   timing;
+
+public:
+    PhaseTimer()
+    {
+        block     = NULL;
+        last      = 0;
+        interval  = 0;
+        countdown = 0;
+        timing    = false;
+    }
+
+    // time every nth pass, 0 disables the timer
+    void setInterval(unsigned int n, CounterBlock<Counter>* block)
+    {
+        interval    = n;
+        countdown   = n;
+        timing      = false;
+        this->block = block;
+    }
+
+    static inline ppluint64 cycles()
+    {
+#if defined(__i386__) || defined(__x86_64__)
+        return __rdtsc();
+#elif defined(__aarch64__)
+        ppluint64 v;
+        __asm__ __volatile__("mrs %0, cntvct_el0"
+                             : "=r"(v));
+        return v;
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (ppluint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+    }
+
+    // starts a pass, returns true if it is timed
+    inline bool begin()
+    {
+        if (!interval || --countdown) {
+            timing = false;
+            return false;
+        }
+        countdown = interval;
+        timing    = true;
+        last      = cycles();
+        return true;
+    }
+
+    // adds the cycles since begin() or the last mark() to phase
+    inline void mark(Phase phase)
+    {
+        if (!timing)
+            return;
+        ppluint64 now = cycles();
+        block->beginUpdate().cycles[phase] += now - last;
+        block->endUpdate();
+        last = now;
+    }
+
+    static double      cyclesPerNanosecond();
+    static const char* name(Phase phase);
+};
+
+#endif
@@ -46,6 +46,13 @@ static int rr_code[] = {
     0
 };
 
+static const char* rcode_names[] = {
+    "OK", "FORMAT", "SRVFAIL", "NAME", "NOTIMPL", "REFUSED",
+    "YXDOMAIN", "YXRRSET", "NXRRSET", "NOTAUTH", "NOTZONE",
+    "11", "12", "13", "14", "15",
+    NULL
+};
+
 #pragma pack(push) /* push current alignment to stack */
 #pragma pack(1) /* set alignment to 1 byte boundary */
 struct DNS_OPT {
@@ -64,26 +71,27 @@ int MakeQuery(const ppl7::String& query, unsigned char* buffer, size_t buffersiz
     ppl7::Array tok(query, " ");
     if (tok.size() != 2)
         throw InvalidDNSQuery(query);
-    ppl7::String Type = tok[1].toUpperCase();
+    int bytes = res_mkquery(QUERY,
+        (const char*)tok[0],
+        C_IN,
+        getQueryType(tok[1]),
+        NULL, 0, NULL, buffer, (int)buffersize);
+    if (bytes < 0)
+        throw InvalidDNSQuery("%s", hstrerror(h_errno));
+    if (!dnssec)
+        return bytes;
+    return AddDnssecToQuery(buffer, buffersize, bytes, udp_payload_size);
+}
 
-    int         t   = 0;
-    const char* str = Type.c_str();
-    while (rr_types[t] != NULL) {
-        if (!strcmp(str, rr_types[t])) {
-            int bytes = res_mkquery(QUERY,
-                (const char*)tok[0],
-                C_IN,
-                rr_code[t],
-                NULL, 0, NULL, buffer, (int)buffersize);
-            if (bytes < 0)
-                throw InvalidDNSQuery("%s", hstrerror(h_errno));
-            if (!dnssec)
-                return bytes;
-            return AddDnssecToQuery(buffer, buffersize, bytes, udp_payload_size);
-        }
-        t++;
+int getQueryType(const ppl7::String& type)
+{
+    ppl7::String Type = type.toUpperCase();
+    const char*  str  = Type.c_str();
+    for (int t = 0; rr_types[t] != NULL; t++) {
+        if (!strcmp(str, rr_types[t]))
+            return rr_code[t];
     }
-    throw UnknownRRType(tok[1]);
+    throw UnknownRRType(type);
 }
 
 int AddDnssecToQuery(unsigned char* buffer, size_t buffersize, int querysize, int udp_payload_size)
@@ -99,6 +107,13 @@ int AddDnssecToQuery(unsigned char* buffer, size_t buffersize, int querysize, in
     return querysize + 11;
 }
 
+const char* getRcodeName(int rcode)
+{
+    if (rcode < 0 || rcode > 15)
+        return "unknown";
+    return rcode_names[rcode];
+}
+
 unsigned short getQueryTimestamp()
 {
     struct timeval tp;
@@ -46,7 +46,9 @@ struct DNS_HEADER {
 };
 
 int MakeQuery(const ppl7::String& query, unsigned char* buffer, size_t buffersize, bool dnssec = false, int udp_payload_size = 4096);
+int getQueryType(const ppl7::String& type);
 int AddDnssecToQuery(unsigned char* buffer, size_t buffersize, int querysize, int udp_payload_size = 4096);
+const char* getRcodeName(int rcode);
 unsigned short getQueryTimestamp();
 double getQueryRTT(unsigned short start);
 
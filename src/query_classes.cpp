@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "query_classes.h"
+#include "exceptions.h"
+
+#include <string.h>
+
+static const char* default_types[] = {
+    "A", "AAAA", "MX", "NS", "DS", "DNSKEY", "TXT", "SOA", "NAPTR",
+    "PTR", "SRV", "CNAME", "ANY",
+    NULL
+};
+
+QueryClassCounter::QueryClassCounter()
+{
+    clear();
+}
+
+void QueryClassCounter::clear()
+{
+    for (int c = 0; c < QueryClasses::MAX_CLASSES; c++) {
+        Entry& e    = entry[c];
+        e.num_pkgs  = 0;
+        e.truncated = 0;
+        e.rtt_total = 0.0;
+        for (int i      = 0; i < 16; i++)
+            e.rcodes[i] = 0;
+        e.rtt_histogram.clear();
+    }
+}
+
+QueryClassCounter& QueryClassCounter::operator+=(const QueryClassCounter& other)
+{
+    for (int c = 0; c < QueryClasses::MAX_CLASSES; c++) {
+        Entry&       e = entry[c];
+        const Entry& o = other.entry[c];
+        e.num_pkgs += o.num_pkgs;
+        e.truncated += o.truncated;
+        e.rtt_total += o.rtt_total;
+        for (int i = 0; i < 16; i++)
+            e.rcodes[i] += o.rcodes[i];
+        e.rtt_histogram += o.rtt_histogram;
+    }
+    return *this;
+}
+
+QueryClasses::QueryClasses()
+{
+    numHigh = 0;
+    count   = 1;
+    other   = 0;
+    names[0].set("other");
+    memset(typeClass, 0, sizeof(typeClass));
+}
+
+void QueryClasses::assign(int qtype, int c)
+{
+    if (qtype < 256) {
+        typeClass[qtype] = (unsigned char)c;
+        return;
+    }
+    for (int i = 0; i < numHigh; i++) {
+        if (highType[i] == qtype) {
+            highClass[i] = (unsigned char)c;
+            return;
+        }
+    }
+    if (numHigh == MAX_CLASSES)
+        throw InvalidCommandlineParameter("--qclass, too many query types above 255");
+    highType[numHigh]  = (unsigned short)qtype;
+    highClass[numHigh] = (unsigned char)c;
+    numHigh++;
+}
+
+/*
+ * One class per common query type.
+ */
+void QueryClasses::setDefault()
+{
+    numHigh = 0;
+    for (count = 0; default_types[count] != NULL; count++)
+        names[count].set(default_types[count]);
+    other = count;
+    names[count++].set("other");
+    memset(typeClass, other, sizeof(typeClass));
+    for (int c = 0; c < other; c++)
+        assign(getQueryType(names[c]), c);
+}
+
+/*
+ * Parses user defined classes: LABEL=TYPE,TYPE,...;LABEL=TYPE,...
+ * Types can be given by name or number.
+ */
+void QueryClasses::parse(const ppl7::String& definition)
+{
+    ppl7::Array defs(definition, ";", 0, true);
+    if (defs.size() == 0)
+        throw InvalidCommandlineParameter("--qclass, no classes given");
+    if (defs.size() >= MAX_CLASSES)
+        throw InvalidCommandlineParameter("--qclass, not more than %d classes are possible", MAX_CLASSES - 1);
+    numHigh = 0;
+    count   = (int)defs.size();
+    other   = count;
+    names[other].set("other");
+    memset(typeClass, other, sizeof(typeClass));
+    for (int c = 0; c < count; c++) {
+        ppl7::Array matches;
+        if (!ppl7::String(defs[c]).trim().pregMatch("/^([^=]+)=(.+)$/", matches))
+            throw InvalidCommandlineParameter("--qclass LABEL=TYPE,..., invalid class: %s", (const char*)defs[c]);
+        names[c] = matches[1].trimmed();
+        ppl7::Array types(matches[2], ",", 0, true);
+        for (size_t i = 0; i < types.size(); i++) {
+            ppl7::String Type = types[i].trimmed();
+            int          qtype;
+            if (Type.pregMatch("/^[0-9]+$/"))
+                qtype = Type.toInt();
+            else if (Type.pregMatch("/^type[0-9]+$/i"))
+                qtype = Type.mid(4).toInt();
+            else
+                qtype = getQueryType(Type);
+            if (qtype < 1 || qtype > 65535)
+                throw InvalidCommandlineParameter("--qclass, invalid query type: %s", (const char*)Type);
+            assign(qtype, c);
+        }
+    }
+    count++;
+}
+
+int QueryClasses::size() const
+{
+    return count;
+}
+
+const ppl7::String& QueryClasses::name(int c) const
+{
+    return names[c];
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rtt_histogram.h"
+#include "query.h"
+
+#include <ppl7.h>
+
+#ifndef __dnsmeter_query_classes_h
+#define __dnsmeter_query_classes_h
+
+/*
+ * Maps the query type of a response to a class for the result breakdown.
+ * By default every common query type has its own class, user defined
+ * classes group several types under a label. Types without a class are
+ * counted as "other".
+ *
+ * The query type is taken from the question section of the response, so
+ * no state of the query is needed.
+ */
+class QueryClasses {
+public:
+    enum {
+        MAX_CLASSES = 16
+    };
+
+private:
+    unsigned char  typeClass[256];
+    unsigned short highType[MAX_CLASSES];
+    unsigned char  highClass[MAX_CLASSES];
+    int            numHigh;
+    int            count;
+    int            other;
+    ppl7::String   names[MAX_CLASSES];
+
+    void assign(int qtype, int c);
+
+public:
+    QueryClasses();
+    void                setDefault();
+    void                parse(const ppl7::String& definition);
+    int                 size() const;
+    const ppl7::String& name(int c) const;
+
+    static inline int questionType(const unsigned char* payload, size_t size)
+    {
+        const struct DNS_HEADER* dns = (const struct DNS_HEADER*)payload;
+        if (size < sizeof(struct DNS_HEADER) + 5 || dns->q_count == 0)
+            return -1;
+        size_t p = sizeof(struct DNS_HEADER);
+        while (p < size && payload[p]) {
+            // the question is never compressed
+            if (payload[p] & 0xc0)
+                return -1;
+            p += payload[p] + 1;
+        }
+        if (p + 2 >= size)
+            return -1;
+        return (payload[p + 1] << 8) | payload[p + 2];
+    }
+
+    inline int classify(const unsigned char* payload, size_t size) const
+    {
+        int qtype = questionType(payload, size);
+        if (qtype < 0)
+            return other;
+        if (qtype < 256)
+            return typeClass[qtype];
+        for (int i = 0; i < numHigh; i++) {
+            if (highType[i] == qtype)
+                return highClass[i];
+        }
+        return other;
+    }
+};
+
+/*
+ * Response counters per query class, with fixed size so the receivers
+ * never allocate.
+ */
+class QueryClassCounter {
+public:
+    class Entry {
+    public:
+        ppluint64    num_pkgs;
+        ppluint64    truncated;
+        ppluint64    rcodes[16];
+        double       rtt_total;
+        RTTHistogram rtt_histogram;
+    };
+
+    Entry entry[QueryClasses::MAX_CLASSES];
+
+    QueryClassCounter();
+    void               clear();
+    QueryClassCounter& operator+=(const QueryClassCounter& other);
+
+    inline void add(int c, const unsigned char* payload, double rtt)
+    {
+        const struct DNS_HEADER* dns = (const struct DNS_HEADER*)payload;
+        Entry&                   e   = entry[c];
+        e.num_pkgs++;
+        e.rtt_total += rtt;
+        e.rtt_histogram.add(rtt);
+        if (dns->rcode < 16)
+            e.rcodes[dns->rcode]++;
+        if (dns->tc)
+            e.truncated++;
+    }
+};
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "query_generator.h"
+#include "query.h"
+#include "exceptions.h"
+
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <netinet/in.h>
+#include <string.h>
+
+// Widest possible expansion of {seq} and {thread}, used to check the
+// label and name length limits when compiling a template
+#define SEQ_MAX_DIGITS 20
+#define THREAD_MAX_DIGITS 10
+
+static const char rand_chars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+
+static inline unsigned char* put_decimal(unsigned char* p, ppluint64 value)
+{
+    unsigned char digits[SEQ_MAX_DIGITS];
+    int           n = 0;
+    do {
+        digits[n++] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    while (n)
+        *p++ = digits[--n];
+    return p;
+}
+
+QueryGenerator::State::State()
+{
+    sequence = 0;
+    thread   = 0;
+    next     = 0;
+}
+
+void QueryGenerator::State::seed(unsigned int thread)
+{
+    this->thread = thread;
+    sequence     = 0;
+    next         = 0;
+    random.seed();
+}
+
+QueryGenerator::QueryGenerator()
+{
+}
+
+/*
+ * Compiles one or more templates separated by ";". Throws InvalidDNSQuery
+ * or UnknownRRType if a template can not be used.
+ */
+void QueryGenerator::compile(const ppl7::String& definition)
+{
+    segments.clear();
+    templates.clear();
+    literals.clear();
+    ppl7::Array list(definition, ";", 0, true);
+    for (size_t i = 0; i < list.size(); i++) {
+        ppl7::String def = list[i].trimmed();
+        if (def.notEmpty())
+            compileTemplate(def);
+    }
+    if (templates.empty())
+        throw InvalidDNSQuery("query template is empty");
+}
+
+void QueryGenerator::compileTemplate(const ppl7::String& definition)
+{
+    ppl7::Array tok(definition, " ", 0, true);
+    if (tok.size() != 2)
+        throw InvalidDNSQuery("invalid query template: %s", (const char*)definition);
+    int qtype = getQueryType(tok[1]);
+
+    Template t;
+    t.first    = segments.size();
+    t.qtype[0] = qtype >> 8;
+    t.qtype[1] = qtype & 0xff;
+    t.qtype[2] = 0;
+    t.qtype[3] = C_IN;
+
+    ppl7::String name = tok[0];
+    if (name.hasSuffix("."))
+        name.chopRight();
+    ppl7::Array labels(name, ".");
+    // length bytes of all labels plus the root label
+    size_t maxsize = labels.size() + 1;
+    for (size_t i = 0; i < labels.size(); i++) {
+        size_t first = segments.size();
+        compileLabel(labels[i], definition);
+        size_t labelsize = 0;
+        for (size_t s = first; s < segments.size(); s++) {
+            const Segment& seg = segments[s];
+            if (seg.type == SEGMENT_SEQ)
+                labelsize += SEQ_MAX_DIGITS;
+            else if (seg.type == SEGMENT_THREAD)
+                labelsize += THREAD_MAX_DIGITS;
+            else
+                labelsize += seg.length;
+        }
+        if (labelsize == 0)
+            throw InvalidDNSQuery("empty label in query template: %s", (const char*)definition);
+        if (labelsize > 63)
+            throw InvalidDNSQuery("label may exceed 63 characters in query template: %s", (const char*)definition);
+        maxsize += labelsize;
+        Segment end;
+        end.type   = SEGMENT_LABEL_END;
+        end.offset = 0;
+        end.length = 0;
+        segments.push_back(end);
+    }
+    if (maxsize > 255)
+        throw InvalidDNSQuery("name may exceed 255 bytes in query template: %s", (const char*)definition);
+    t.count = segments.size() - t.first;
+    templates.push_back(t);
+}
+
+void QueryGenerator::compileLabel(const ppl7::String& label, const ppl7::String& definition)
+{
+    size_t      len = label.size();
+    const char* str = label.c_str();
+    size_t      pos = 0;
+    while (pos < len) {
+        Segment seg;
+        seg.offset = 0;
+        seg.length = 0;
+        if (str[pos] == '{') {
+            ssize_t close = label.instr("}", pos);
+            if (close < 0)
+                throw InvalidDNSQuery("missing '}' in query template: %s", (const char*)definition);
+            ppl7::String  placeholder = label.mid(pos + 1, close - pos - 1);
+            ppl7::Array   m;
+            if (placeholder == "seq") {
+                seg.type = SEGMENT_SEQ;
+            } else if (placeholder == "thread") {
+                seg.type = SEGMENT_THREAD;
+            } else if (placeholder.pregMatch("/^rand:([0-9]+)$/", m)) {
+                seg.type   = SEGMENT_RAND;
+                seg.length = m[1].toInt();
+                if (seg.length < 1 || seg.length > 63)
+                    throw InvalidDNSQuery("invalid length for {rand} in query template: %s", (const char*)definition);
+            } else {
+                throw InvalidDNSQuery("unknown placeholder {%s} in query template: %s",
+                    (const char*)placeholder, (const char*)definition);
+            }
+            pos = close + 1;
+        } else {
+            size_t start = pos;
+            while (pos < len && str[pos] != '{')
+                pos++;
+            seg.type   = SEGMENT_LITERAL;
+            seg.offset = literals.size();
+            seg.length = pos - start;
+            literals.append(str + start, seg.length);
+        }
+        segments.push_back(seg);
+    }
+}
+
+bool QueryGenerator::enabled() const
+{
+    return !templates.empty();
+}
+
+/*
+ * Writes the next query into buffer, which must hold at least 512 bytes,
+ * and returns its size. The DNS ID is left at zero.
+ */
+size_t QueryGenerator::build(unsigned char* buffer, State& state) const
+{
+    const Template& t = templates[state.next];
+    if (++state.next == templates.size())
+        state.next = 0;
+
+    DNS_HEADER* dns = (DNS_HEADER*)buffer;
+    memset(buffer, 0, sizeof(DNS_HEADER));
+    dns->rd      = 1;
+    dns->q_count = htons(1);
+
+    const char*    lit   = literals.c_str();
+    unsigned char* label = buffer + sizeof(DNS_HEADER);
+    unsigned char* p     = label + 1;
+    for (size_t s = t.first; s < t.first + t.count; s++) {
+        const Segment& seg = segments[s];
+        switch (seg.type) {
+        case SEGMENT_LITERAL:
+            memcpy(p, lit + seg.offset, seg.length);
+            p += seg.length;
+            break;
+        case SEGMENT_RAND:
+            for (size_t i = 0; i < seg.length; i++)
+                *p++ = rand_chars[state.random.below(36)];
+            break;
+        case SEGMENT_SEQ:
+            p = put_decimal(p, state.sequence);
+            break;
+        case SEGMENT_THREAD:
+            p = put_decimal(p, state.thread);
+            break;
+        case SEGMENT_LABEL_END:
+            *label = (unsigned char)(p - label - 1);
+            label  = p++;
+            break;
+        }
+    }
+    // root label
+    *label = 0;
+    memcpy(p, t.qtype, 4);
+    state.sequence++;
+    return (p + 4) - buffer;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fast_random.h"
+
+#include <ppl7.h>
+#include <vector>
+
+#ifndef __dnsmeter_query_generator_h
+#define __dnsmeter_query_generator_h
+
+/*
+ * Synthesizes queries from name templates at send time.
+ *
+ * A template is a query name with placeholders followed by the query type,
+ * e.g. "{rand:12}.{seq}.example.com A". Supported placeholders are
+ * {rand:N} (N random characters out of [a-z0-9]), {seq} (the sequence
+ * number of the sending thread) and {thread} (the number of the sending
+ * thread). Several templates separated by ";" are used in turn.
+ *
+ * Templates are compiled once into a list of segments, build() writes
+ * the query directly in wire format into the send buffer without any
+ * allocation. All variable state lives in a State object owned by the
+ * sender thread, so a generator can be shared by all threads.
+ */
+class QueryGenerator {
+private:
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || __cplusplus >= 201103L
+    QueryGenerator& operator=(const QueryGenerator& other);
+    QueryGenerator(QueryGenerator &&other) noexcept;
+    QueryGenerator const & operator=(QueryGenerator &&other);
+#endif
+
+    enum SegmentType {
+        SEGMENT_LITERAL,
+        SEGMENT_RAND,
+        SEGMENT_SEQ,
+        SEGMENT_THREAD,
+        SEGMENT_LABEL_END
+    };
+
+    class Segment {
+    public:
+        SegmentType type;
+        size_t      offset;
+        size_t      length;
+    };
+
+    class Template {
+    public:
+        size_t        first;
+        size_t        count;
+        unsigned char qtype[4];
+    };
+
+    std::vector<Segment>  segments;
+    std::vector<Template> templates;
+    ppl7::String          literals;
+
+    void compileTemplate(const ppl7::String& definition);
+    void compileLabel(const ppl7::String& label, const ppl7::String& definition);
+
+public:
+    class State {
+    public:
+        ppluint64    sequence;
+        FastRandom   random;
+        unsigned int thread;
+        size_t       next;
+        State();
+        void seed(unsigned int thread);
+    };
+
+    QueryGenerator();
+    void   compile(const ppl7::String& definition);
+    bool   enabled() const;
+    size_t build(unsigned char* buffer, State& state) const;
+};
+
+#endif
@@ -32,6 +32,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <netinet/ip.h>
+#include <netinet/ip6.h>
 #include <netinet/udp.h>
 #include <errno.h>
 
@@ -46,6 +47,8 @@
 #include <net/bpf.h>
 #include <net/ethernet.h>
 #include <machine/atomic.h>
+#else
+#include <netpacket/packet.h>
 #endif
 
 #pragma pack(push) /* push current alignment to stack */
@@ -128,14 +131,7 @@ void initBufferedMode(int sd, unsigned int buflen)
 
 RawSocketReceiver::Counter::Counter()
 {
-    num_pkgs  = 0;
-    bytes_rcv = 0;
-    truncated = 0;
-    for (int i    = 0; i < 15; i++)
-        rcodes[i] = 0;
-    rtt_total     = 0.0f;
-    rtt_min       = 0.0f;
-    rtt_max       = 0.0f;
+    clear();
 }
 
 void RawSocketReceiver::Counter::clear()
@@ -143,20 +139,40 @@ void RawSocketReceiver::Counter::clear()
     num_pkgs  = 0;
     bytes_rcv = 0;
     truncated = 0;
-    for (int i    = 0; i < 15; i++)
+    for (int i    = 0; i < 16; i++)
         rcodes[i] = 0;
     rtt_total     = 0.0f;
     rtt_min       = 0.0f;
     rtt_max       = 0.0f;
+    rtt_histogram.clear();
+}
+
+RawSocketReceiver::Counter& RawSocketReceiver::Counter::operator+=(const RawSocketReceiver::Counter& other)
+{
+    num_pkgs += other.num_pkgs;
+    bytes_rcv += other.bytes_rcv;
+    truncated += other.truncated;
+    for (int i = 0; i < 16; i++)
+        rcodes[i] += other.rcodes[i];
+    rtt_total += other.rtt_total;
+    if (other.rtt_min > 0 && (other.rtt_min < rtt_min || rtt_min == 0))
+        rtt_min = other.rtt_min;
+    if (other.rtt_max > rtt_max)
+        rtt_max = other.rtt_max;
+    rtt_histogram += other.rtt_histogram;
+    return *this;
 }
 
 RawSocketReceiver::RawSocketReceiver()
 {
-    SourceIP.set("0.0.0.0");
-    SourcePort = 0;
-    buflen     = 4096;
-    sd         = -1;
-    buffer     = NULL;
+    targets      = NULL;
+    family       = ppl7::IPAddress::IPv4;
+    window       = NULL;
+    classes      = NULL;
+    classCounter = NULL;
+    buflen       = 4096;
+    sd           = -1;
+    buffer       = NULL;
 #ifdef DNSMETER_USE_BPF
     useZeroCopyBuffer = false;
     sd                = open_bpf();
@@ -244,45 +260,153 @@ void RawSocketReceiver::initInterface(const ppl7::String& Device)
 #endif
 }
 
-void RawSocketReceiver::setSource(const ppl7::IPAddress& ip_addr, int port)
+void RawSocketReceiver::setTargets(const TargetList& targets)
+{
+    if (targets.family() != ppl7::IPAddress::IPv4 && targets.family() != ppl7::IPAddress::IPv6)
+        throw UnsupportedIPFamily();
+    this->targets = &targets;
+    family        = targets.family();
+    // With a single target the packet filter only passes its responses,
+    // with several targets it passes all UDP packets and the responses are
+    // attributed to their target in countPacket
+    const TargetList::Target* target = (targets.size() == 1) ? &targets[0] : NULL;
+    if (family == ppl7::IPAddress::IPv6)
+        setFilterIPv6(target);
+    else
+        setFilter(target);
+}
+
+void RawSocketReceiver::setFilter(const TargetList::Target* target)
 {
-    SourceIP   = ip_addr;
-    SourcePort = htons(port);
 #ifdef DNSMETER_USE_BPF
-    // Install packet filter in bpf
-    int             sip     = htonl(*(int*)SourceIP.addr());
+    struct bpf_program bpf_program;
+    if (target) {
+        // Install packet filter in bpf
+        int             sip     = htonl(*(int*)target->ip.addr());
+        int             port    = target->port;
+        struct bpf_insn insns[] = {
+            // load halfword at position 12 from packet into register
+            BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 12),
+            // is it 0x800? if no, jump over 5 instructions, else jump over 0
+            BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0x0800, 0, 7),
+            // source ip
+            BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 26),
+            BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, (unsigned int)sip, 0, 5),
+
+            // udp?
+            BPF_STMT(BPF_LD + BPF_B + BPF_ABS, 23),
+            BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 17, 0, 3),
+
+            // source port
+            BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 34),
+            BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, (unsigned int)port, 0, 1),
+
+            /* if we reach here, return -1 which will allow the packet to be read */
+            BPF_STMT(BPF_RET + BPF_K, (u_int)-1),
+            /* if we reach here, return 0 which will ignore the packet */
+            BPF_STMT(BPF_RET + BPF_K, 0),
+        };
+        bpf_program.bf_len   = 10;
+        bpf_program.bf_insns = insns;
+        if (ioctl(sd, BIOCSETF, (struct bpf_program*)&bpf_program) < 0)
+            throw FailedToInitializePacketfilter();
+        return;
+    }
     struct bpf_insn insns[] = {
-        // load halfword at position 12 from packet into register
+        // IPv4 and udp
         BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 12),
-        // is it 0x800? if no, jump over 5 instructions, else jump over 0
-        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0x0800, 0, 7),
-        // source ip
-        BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 26),
-        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, (unsigned int)sip, 0, 5),
-
-        // udp?
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0x0800, 0, 3),
         BPF_STMT(BPF_LD + BPF_B + BPF_ABS, 23),
-        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 17, 0, 3),
-
-        // source port
-        BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 34),
-        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, (unsigned int)port, 0, 1),
-
-        /* if we reach here, return -1 which will allow the packet to be read */
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 17, 0, 1),
         BPF_STMT(BPF_RET + BPF_K, (u_int)-1),
-        /* if we reach here, return 0 which will ignore the packet */
         BPF_STMT(BPF_RET + BPF_K, 0),
     };
-    struct bpf_program bpf_program = {
-        10,
-        (struct bpf_insn*)&insns
-    };
-    if (ioctl(sd, BIOCSETF, (struct bpf_program*)&bpf_program) < 0) {
+    bpf_program.bf_len   = 6;
+    bpf_program.bf_insns = insns;
+    if (ioctl(sd, BIOCSETF, (struct bpf_program*)&bpf_program) < 0)
         throw FailedToInitializePacketfilter();
+#endif
+}
+
+void RawSocketReceiver::setFilterIPv6(const TargetList::Target* target)
+{
+#ifdef DNSMETER_USE_BPF
+    struct bpf_program bpf_program;
+    if (target) {
+        const unsigned int* sip     = (const unsigned int*)target->addr;
+        int                 port    = target->port;
+        struct bpf_insn     insns[] = {
+            // ethertype IPv6
+            BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 12),
+            BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0x86dd, 0, 13),
+
+            // udp without extension headers?
+            BPF_STMT(BPF_LD + BPF_B + BPF_ABS, 20),
+            BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 17, 0, 11),
+
+            // source ip, 4 words
+            BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 22),
+            BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ntohl(sip[0]), 0, 9),
+            BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 26),
+            BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ntohl(sip[1]), 0, 7),
+            BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 30),
+            BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ntohl(sip[2]), 0, 5),
+            BPF_STMT(BPF_LD + BPF_W + BPF_ABS, 34),
+            BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ntohl(sip[3]), 0, 3),
+
+            // source port
+            BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 54),
+            BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, (unsigned int)port, 0, 1),
+
+            BPF_STMT(BPF_RET + BPF_K, (u_int)-1),
+            BPF_STMT(BPF_RET + BPF_K, 0),
+        };
+        bpf_program.bf_len   = 16;
+        bpf_program.bf_insns = insns;
+        if (ioctl(sd, BIOCSETF, (struct bpf_program*)&bpf_program) < 0)
+            throw FailedToInitializePacketfilter();
+        return;
     }
+    struct bpf_insn insns[] = {
+        // IPv6 and udp without extension headers
+        BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 12),
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0x86dd, 0, 3),
+        BPF_STMT(BPF_LD + BPF_B + BPF_ABS, 20),
+        BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 17, 0, 1),
+        BPF_STMT(BPF_RET + BPF_K, (u_int)-1),
+        BPF_STMT(BPF_RET + BPF_K, 0),
+    };
+    bpf_program.bf_len   = 6;
+    bpf_program.bf_insns = insns;
+    if (ioctl(sd, BIOCSETF, (struct bpf_program*)&bpf_program) < 0)
+        throw FailedToInitializePacketfilter();
+#else
+    // the socket was opened for IPv4, switch it to IPv6 on all interfaces
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family   = AF_PACKET;
+    sll.sll_protocol = htons(0x86dd);
+    sll.sll_ifindex  = 0;
+    if (bind(sd, (const struct sockaddr*)&sll, sizeof(sll)) < 0)
+        ppl7::throwExceptionFromErrno(errno, "Could not bind RawReceiverSocket to IPv6");
 #endif
 }
 
+/*
+ * counter points to the class counters of two steps, responses are
+ * counted in the slot of the step of their query, see StepCounters.
+ */
+void RawSocketReceiver::setQueryClasses(const QueryClasses* classes, CounterBlock<QueryClassCounter>* counter)
+{
+    this->classes = classes;
+    classCounter  = counter;
+}
+
+void RawSocketReceiver::setConcurrencyWindow(ConcurrencyWindow* window)
+{
+    this->window = window;
+}
+
 bool RawSocketReceiver::socketReady()
 {
 // #ifdef DNSMETER_USE_BPF
@@ -303,21 +427,42 @@ bool RawSocketReceiver::socketReady()
     return false;
 }
 
-static void count_packet(RawSocketReceiver::Counter& counter, unsigned char* buffer, size_t size)
+/*
+ * Counts one received ethernet frame. It is static and gets everything it
+ * needs in ctx, so that it can be benchmarked without a raw socket.
+ */
+void RawSocketReceiver::countPacket(const RawSocketReceiver::Context& ctx, StepCounters<RawSocketReceiver::Counter>& block, unsigned char* buffer, size_t size)
 {
-    counter.num_pkgs++;
-    counter.bytes_rcv += size;
-    struct DNS_HEADER* dns = (struct DNS_HEADER*)(buffer + 14 + sizeof(struct ip) + sizeof(struct udphdr));
-    double             rd  = getQueryRTT(ntohs(dns->id));
-    counter.rtt_total += rd;
-    if (rd < counter.rtt_min || counter.rtt_min == 0)
-        counter.rtt_min = rd;
-    if (rd > counter.rtt_max)
-        counter.rtt_max = rd;
-    if (dns->rcode < 16)
-        counter.rcodes[dns->rcode]++;
-    if (dns->tc)
-        counter.truncated++;
+    const void* src;
+    size_t      l3size;
+    if (((struct ETHER*)buffer)->type == htons(0x86dd)) {
+        l3size = sizeof(struct ip6_hdr);
+        src    = &((struct ip6_hdr*)(buffer + 14))->ip6_src;
+    } else {
+        l3size = sizeof(struct ip);
+        src    = &((struct ip*)(buffer + 14))->ip_src;
+    }
+    struct udphdr* udp = (struct udphdr*)(buffer + 14 + l3size);
+    int            t   = ctx.targets->find(src, udp->uh_sport);
+    if (t < 0)
+        return;
+    size_t             offset  = 14 + l3size + sizeof(struct udphdr);
+    unsigned char*     payload = buffer + offset;
+    struct DNS_HEADER* dns     = (struct DNS_HEADER*)payload;
+    unsigned short     id      = ntohs(dns->id);
+    double             rd      = getQueryRTT(id);
+    if (ctx.window) {
+        // closed-loop mode, let the sender thread send the next query
+        ctx.window->release(ctx.window->laneFromPort(ntohs(udp->uh_dport)), id);
+    }
+    int s = block.slot(id);
+    block[s][t].beginUpdate().add(payload, size, rd);
+    block[s][t].endUpdate();
+    if (ctx.classes && size > offset) {
+        int c = ctx.classes->classify(payload, size - offset);
+        ctx.class_counter[s].beginUpdate().add(c, payload, rd);
+        ctx.class_counter[s].endUpdate();
+    }
 }
 
 #ifdef DNSMETER_USE_BPF
@@ -334,7 +479,7 @@ static int buffer_check(struct bpf_zbuf_header* bzh)
     return (bzh->bzh_user_gen != atomic_load_acq_int(&bzh->bzh_kernel_gen));
 }
 
-static void read_buffer(unsigned char* ptr, size_t size, RawSocketReceiver::Counter& counter)
+static void read_buffer(const RawSocketReceiver::Context& ctx, unsigned char* ptr, size_t size, StepCounters<RawSocketReceiver::Counter>& counter)
 {
     size_t done = 0;
     while (done < size) {
@@ -342,42 +487,43 @@ static void read_buffer(unsigned char* ptr, size_t size, RawSocketReceiver::Coun
         if (bpfh->bh_caplen == 0 || bpfh->bh_hdrlen == 0)
             break;
         size_t chunk_size = BPF_WORDALIGN(bpfh->bh_caplen + bpfh->bh_hdrlen);
-        count_packet(counter, ptr + bpfh->bh_hdrlen, chunk_size - bpfh->bh_datalen);
+        RawSocketReceiver::countPacket(ctx, counter, ptr + bpfh->bh_hdrlen, bpfh->bh_caplen);
         ptr += chunk_size;
         done += chunk_size;
     }
 }
 
-static void read_zbuffer(struct bpf_zbuf_header* zhdr, RawSocketReceiver::Counter& counter)
+static void read_zbuffer(const RawSocketReceiver::Context& ctx, struct bpf_zbuf_header* zhdr, StepCounters<RawSocketReceiver::Counter>& counter)
 {
     size_t         size = zhdr->bzh_kernel_len - sizeof(struct bpf_zbuf_header);
     unsigned char* ptr  = (unsigned char*)zhdr + sizeof(struct bpf_zbuf_header);
-    read_buffer(ptr, size, counter);
+    read_buffer(ctx, ptr, size, counter);
     buffer_acknowledge(zhdr);
 }
-void RawSocketReceiver::receive(RawSocketReceiver::Counter& counter)
+void RawSocketReceiver::receive(StepCounters<RawSocketReceiver::Counter>& counter)
 {
+    Context ctx = { targets, window, classes, classCounter };
     if (useZeroCopyBuffer) {
         struct bpf_zbuf*        zbuf = (struct bpf_zbuf*)buffer;
         struct bpf_zbuf_header* zhdr = NULL;
         if (buffer_check((struct bpf_zbuf_header*)zbuf->bz_bufa)) {
             zhdr = ((struct bpf_zbuf_header*)zbuf->bz_bufa);
-            read_zbuffer(zhdr, counter);
+            read_zbuffer(ctx, zhdr, counter);
         }
         if (buffer_check((struct bpf_zbuf_header*)zbuf->bz_bufb)) {
             zhdr = ((struct bpf_zbuf_header*)zbuf->bz_bufb);
-            read_zbuffer(zhdr, counter);
+            read_zbuffer(ctx, zhdr, counter);
         }
     } else {
         ssize_t bufused = read(sd, buffer, buflen);
         if (bufused < 34)
             return;
-        read_buffer(buffer, bufused, counter);
+        read_buffer(ctx, buffer, bufused, counter);
     }
 }
 
 #else
-void RawSocketReceiver::receive(Counter& counter)
+void RawSocketReceiver::receive(StepCounters<Counter>& counter)
 {
     unsigned char* ptr     = buffer;
     ssize_t        bufused = recvfrom(sd, buffer, buflen, 0, NULL, NULL);
@@ -386,17 +532,22 @@ void RawSocketReceiver::receive(Counter& counter)
     struct ETHER* eth = (struct ETHER*)ptr;
     //ppl7::HexDump(ptr,bufused);
     //printf ("sizeof ETHER=%d, type=%X\n",sizeof(struct ETHER),eth->type);
-    if (eth->type != htons(0x0800))
-        return;
-    struct ip* iphdr = (struct ip*)(ptr + 14);
-    if (iphdr->ip_v != 4)
-        return;
-    if (iphdr->ip_src.s_addr != *(in_addr_t*)SourceIP.addr())
-        return;
-
-    struct udphdr* udp = (struct udphdr*)(ptr + 14 + sizeof(struct ip));
-    if (udp->uh_sport != SourcePort)
-        return;
-    count_packet(counter, ptr, bufused);
+    if (family == ppl7::IPAddress::IPv6) {
+        if (eth->type != htons(0x86dd) || bufused < (ssize_t)(14 + sizeof(struct ip6_hdr) + sizeof(struct udphdr) + sizeof(struct DNS_HEADER)))
+            return;
+        struct ip6_hdr* ip6hdr = (struct ip6_hdr*)(ptr + 14);
+        // responses with extension headers are not counted
+        if (ip6hdr->ip6_nxt != IPPROTO_UDP)
+            return;
+    } else {
+        if (eth->type != htons(0x0800))
+            return;
+        struct ip* iphdr = (struct ip*)(ptr + 14);
+        if (iphdr->ip_v != 4 || iphdr->ip_p != IPPROTO_UDP)
+            return;
+    }
+    // countPacket only counts responses from a target
+    Context ctx = { targets, window, classes, classCounter };
+    countPacket(ctx, counter, ptr, bufused);
 }
 #endif
@@ -19,6 +19,14 @@
  * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "seqlock.h"
+#include "step_clock.h"
+#include "rtt_histogram.h"
+#include "concurrency_window.h"
+#include "query.h"
+#include "target_list.h"
+#include "query_classes.h"
+
 #include <ppl7.h>
 #include <ppl7-inet.h>
 
@@ -33,33 +41,72 @@ private:
     RawSocketReceiver const & operator=(RawSocketReceiver &&other);
 #endif
 
-    ppl7::IPAddress SourceIP;
-    unsigned char*  buffer;
-    int             buflen;
-    int             sd;
-    unsigned short  SourcePort;
+    const TargetList*                targets;
+    ConcurrencyWindow*               window;
+    const QueryClasses*              classes;
+    CounterBlock<QueryClassCounter>* classCounter;
+    unsigned char*                   buffer;
+    int                              buflen;
+    int                              sd;
+    int                              family;
 #ifdef __FreeBSD__
     bool useZeroCopyBuffer;
 #endif
 
+    void setFilter(const TargetList::Target* target);
+    void setFilterIPv6(const TargetList::Target* target);
+
 public:
     class Counter {
     public:
         Counter();
-        void      clear();
-        ppluint64 num_pkgs;
-        ppluint64 bytes_rcv;
-        ppluint64 rcodes[16];
-        ppluint64 truncated;
-        double    rtt_total, rtt_min, rtt_max;
+        void         clear();
+        ppluint64    num_pkgs;
+        ppluint64    bytes_rcv;
+        ppluint64    rcodes[16];
+        ppluint64    truncated;
+        double       rtt_total, rtt_min, rtt_max;
+        RTTHistogram rtt_histogram;
+
+        inline void add(const unsigned char* payload, size_t size, double rtt)
+        {
+            const struct DNS_HEADER* dns = (const struct DNS_HEADER*)payload;
+            num_pkgs++;
+            bytes_rcv += size;
+            rtt_total += rtt;
+            if (rtt < rtt_min || rtt_min == 0)
+                rtt_min = rtt;
+            if (rtt > rtt_max)
+                rtt_max = rtt;
+            rtt_histogram.add(rtt);
+            if (dns->rcode < 16)
+                rcodes[dns->rcode]++;
+            if (dns->tc)
+                truncated++;
+        }
+        Counter& operator+=(const Counter& other);
+    };
+
+    /*
+     * Everything countPacket needs besides the counters of the targets
+     */
+    struct Context {
+        const TargetList*                targets;
+        ConcurrencyWindow*               window;
+        const QueryClasses*              classes;
+        CounterBlock<QueryClassCounter>* class_counter;
     };
 
     RawSocketReceiver();
     ~RawSocketReceiver();
     void initInterface(const ppl7::String& Device);
     bool socketReady();
-    void setSource(const ppl7::IPAddress& ip_addr, int port);
-    void receive(Counter& counter);
+    void setTargets(const TargetList& targets);
+    void setConcurrencyWindow(ConcurrencyWindow* window);
+    void setQueryClasses(const QueryClasses* classes, CounterBlock<QueryClassCounter>* counter);
+    void receive(StepCounters<Counter>& counter);
+
+    static void countPacket(const Context& ctx, StepCounters<Counter>& counter, unsigned char* buffer, size_t size);
 };
 
 #endif
@@ -27,53 +27,92 @@
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <string.h>
 #include <errno.h>
 
 RawSocketSender::RawSocketSender()
 {
-    buffer = calloc(1, sizeof(struct sockaddr_in));
+    buffer = calloc(1, sizeof(struct sockaddr_in6));
     if (!buffer)
         throw ppl7::OutOfMemoryException();
-    struct sockaddr_in* dest = (struct sockaddr_in*)buffer;
-    dest->sin_addr.s_addr    = -1;
+    addrlen = 0;
+    sd      = -1;
+}
+
+RawSocketSender::~RawSocketSender()
+{
+    if (sd >= 0)
+        close(sd);
+    free(buffer);
+}
+
+void RawSocketSender::open()
+{
+    if (sd >= 0)
+        return;
+    if (!addrlen)
+        throw UnknownDestination();
+    unsigned int set = 1;
+    if (addrlen == sizeof(struct sockaddr_in6)) {
+#ifdef IPV6_HDRINCL
+        if ((sd = socket(AF_INET6, SOCK_RAW, IPPROTO_RAW)) == -1) {
+            ppl7::throwExceptionFromErrno(errno, "Could not create RawSocket");
+        }
+        if (setsockopt(sd, IPPROTO_IPV6, IPV6_HDRINCL, &set, sizeof(set)) < 0) {
+            int e = errno;
+            close(sd);
+            sd = -1;
+            ppl7::throwExceptionFromErrno(e, "Could not set socket option IPV6_HDRINCL");
+        }
+        return;
+#else
+        throw UnsupportedIPFamily("raw IPv6 sockets are not supported on this system, use --engine udp");
+#endif
+    }
     if ((sd = socket(AF_INET, SOCK_RAW, IPPROTO_RAW)) == -1) {
-        free(buffer);
         ppl7::throwExceptionFromErrno(errno, "Could not create RawSocket");
     }
-    unsigned int set = 1;
     if (setsockopt(sd, IPPROTO_IP, IP_HDRINCL, &set, sizeof(set)) < 0) {
+        int e = errno;
         close(sd);
-        free(buffer);
-        ppl7::throwExceptionFromErrno(errno, "Could not set socket option IP_HDRINCL");
+        sd = -1;
+        ppl7::throwExceptionFromErrno(e, "Could not set socket option IP_HDRINCL");
     }
 }
 
-RawSocketSender::~RawSocketSender()
-{
-    close(sd);
-    free(buffer);
-}
-
 void RawSocketSender::setDestination(const ppl7::IPAddress& ip_addr, int port)
 {
-    if (ip_addr.family() != ppl7::IPAddress::IPv4)
-        throw UnsupportedIPFamily("Only IPv4 is supported");
-    ip_addr.toSockAddr(buffer, sizeof(struct sockaddr_in));
-    ((struct sockaddr_in*)buffer)->sin_port = htons(port);
+    if (ip_addr.family() == ppl7::IPAddress::IPv6) {
+        // the port of a raw IPv6 socket would be taken as protocol
+        addrlen = sizeof(struct sockaddr_in6);
+        ip_addr.toSockAddr(buffer, addrlen);
+        ((struct sockaddr_in6*)buffer)->sin6_port = 0;
+    } else if (ip_addr.family() == ppl7::IPAddress::IPv4) {
+        addrlen = sizeof(struct sockaddr_in);
+        ip_addr.toSockAddr(buffer, addrlen);
+        ((struct sockaddr_in*)buffer)->sin_port = htons(port);
+    } else {
+        throw UnsupportedIPFamily();
+    }
 }
 
 ssize_t RawSocketSender::send(Packet& pkt)
 {
-    struct sockaddr_in* dest = (struct sockaddr_in*)buffer;
-    if (dest->sin_addr.s_addr == (unsigned int)-1)
+    if (!addrlen)
         throw UnknownDestination();
-    return sendto(sd, pkt.ptr(), pkt.size(), 0,
-        (const struct sockaddr*)dest, sizeof(struct sockaddr_in));
+    struct iovec  iov[2];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name    = buffer;
+    msg.msg_namelen = addrlen;
+    msg.msg_iov     = iov;
+    msg.msg_iovlen  = pkt.gather(iov);
+    return sendmsg(sd, &msg, 0);
 }
 
 ppl7::SockAddr RawSocketSender::getSockAddr() const
 {
-    return ppl7::SockAddr(buffer, sizeof(struct sockaddr_in));
+    return ppl7::SockAddr(buffer, addrlen);
 }
 
 bool RawSocketSender::socketReady()
@@ -22,6 +22,7 @@
 #include "packet.h"
 
 #include <ppl7.h>
+#include <sys/socket.h>
 
 #ifndef __dnsmeter_raw_socket_sender_h
 #define __dnsmeter_raw_socket_sender_h
@@ -34,12 +35,14 @@ private:
     RawSocketSender const & operator=(RawSocketSender &&other);
 #endif
 
-    void* buffer;
-    int   sd;
+    void*     buffer;
+    socklen_t addrlen;
+    int       sd;
 
 public:
     RawSocketSender();
     ~RawSocketSender();
+    void open();
     void setDestination(const ppl7::IPAddress& ip_addr, int port);
     ssize_t send(Packet& pkt);
     ppl7::SockAddr getSockAddr() const;
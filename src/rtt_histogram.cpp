@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "rtt_histogram.h"
+
+#include <math.h>
+
+RTTHistogram::RTTHistogram()
+{
+    clear();
+}
+
+void RTTHistogram::clear()
+{
+    for (int i     = 0; i < BUCKETS; i++)
+        buckets[i] = 0;
+    total          = 0;
+}
+
+int RTTHistogram::bucketIndex(double seconds)
+{
+    if (seconds <= 0.0)
+        return 0;
+    ppluint64 us = (ppluint64)(seconds * 1000000.0);
+    if (us < 2 * SUB_BUCKETS)
+        return (int)us;
+    if (us >= (1ULL << MAX_BITS))
+        return BUCKETS - 1;
+    int msb   = 63 - __builtin_clzll(us);
+    int shift = msb - 5;
+    return 2 * SUB_BUCKETS + (msb - 6) * SUB_BUCKETS + (int)((us >> shift) - SUB_BUCKETS);
+}
+
+static ppluint64 bucket_lower_us(int bucket)
+{
+    if (bucket < 2 * RTTHistogram::SUB_BUCKETS)
+        return bucket;
+    int k     = (bucket - 2 * RTTHistogram::SUB_BUCKETS) / RTTHistogram::SUB_BUCKETS;
+    int sub   = (bucket - 2 * RTTHistogram::SUB_BUCKETS) % RTTHistogram::SUB_BUCKETS;
+    int shift = k + 1;
+    return (ppluint64)(RTTHistogram::SUB_BUCKETS + sub) << shift;
+}
+
+static ppluint64 bucket_upper_us(int bucket)
+{
+    if (bucket < 2 * RTTHistogram::SUB_BUCKETS)
+        return bucket + 1;
+    int k = (bucket - 2 * RTTHistogram::SUB_BUCKETS) / RTTHistogram::SUB_BUCKETS;
+    return bucket_lower_us(bucket) + (1ULL << (k + 1));
+}
+
+double RTTHistogram::bucketLowerBound(int bucket)
+{
+    return (double)bucket_lower_us(bucket) / 1000000.0;
+}
+
+double RTTHistogram::bucketUpperBound(int bucket)
+{
+    return (double)bucket_upper_us(bucket) / 1000000.0;
+}
+
+ppluint64 RTTHistogram::count() const
+{
+    return total;
+}
+
+ppluint64 RTTHistogram::bucketCount(int bucket) const
+{
+    if (bucket < 0 || bucket >= BUCKETS)
+        return 0;
+    return buckets[bucket];
+}
+
+void RTTHistogram::addBucket(int bucket, ppluint64 count)
+{
+    if (bucket < 0 || bucket >= BUCKETS)
+        return;
+    buckets[bucket] += count;
+    total += count;
+}
+
+ppluint64 RTTHistogram::countBelow(double seconds) const
+{
+    ppluint64 limit = (ppluint64)(seconds * 1000000.0);
+    ppluint64 sum   = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        if (bucket_upper_us(i) - 1 > limit)
+            break;
+        sum += buckets[i];
+    }
+    return sum;
+}
+
+double RTTHistogram::percentile(double p) const
+{
+    if (!total)
+        return 0.0;
+    ppluint64 rank = (ppluint64)ceil((double)total * p / 100.0);
+    if (rank < 1)
+        rank = 1;
+    ppluint64 sum = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        sum += buckets[i];
+        if (sum >= rank)
+            return (bucketLowerBound(i) + bucketUpperBound(i)) / 2.0;
+    }
+    return bucketUpperBound(BUCKETS - 1);
+}
+
+RTTHistogram& RTTHistogram::operator+=(const RTTHistogram& other)
+{
+    for (int i = 0; i < BUCKETS; i++)
+        buckets[i] += other.buckets[i];
+    total += other.total;
+    return *this;
+}
+
+RTTHistogram RTTHistogram::operator-(const RTTHistogram& other) const
+{
+    RTTHistogram r;
+    for (int i       = 0; i < BUCKETS; i++)
+        r.buckets[i] = buckets[i] - other.buckets[i];
+    r.total          = total - other.total;
+    return r;
+}
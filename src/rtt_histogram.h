@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ppl7.h>
+
+#ifndef __dnsmeter_rtt_histogram_h
+#define __dnsmeter_rtt_histogram_h
+
+/*
+ * Round trip time histogram with fixed memory. Times are stored in
+ * microseconds, the first 64 buckets are exact, above that every power of
+ * two is split into 32 buckets (max. error about 3%). Everything above
+ * 2^24 microseconds (~16.7 seconds) goes into the last bucket.
+ */
+class RTTHistogram {
+public:
+    enum {
+        SUB_BUCKETS = 32,
+        MAX_BITS    = 24,
+        BUCKETS     = 2 * SUB_BUCKETS + (MAX_BITS - 6) * SUB_BUCKETS
+    };
+
+private:
+    ppluint64 buckets[BUCKETS];
+    ppluint64 total;
+
+public:
+    RTTHistogram();
+    void clear();
+
+    inline void add(double seconds)
+    {
+        buckets[bucketIndex(seconds)]++;
+        total++;
+    }
+
+    ppluint64 count() const;
+    ppluint64 bucketCount(int bucket) const;
+    void      addBucket(int bucket, ppluint64 count);
+    ppluint64 countBelow(double seconds) const;
+    double    percentile(double p) const;
+
+    static int    bucketIndex(double seconds);
+    static double bucketLowerBound(int bucket);
+    static double bucketUpperBound(int bucket);
+
+    RTTHistogram& operator+=(const RTTHistogram& other);
+    RTTHistogram  operator-(const RTTHistogram& other) const;
+};
+
+#endif
@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ppl7.h>
+#include <stdlib.h>
+#include <new>
+
+#ifndef __dnsmeter_seqlock_h
+#define __dnsmeter_seqlock_h
+
+#define DNSMETER_CACHELINE_SIZE 64
+#define DNSMETER_CACHELINE_ALIGNED __attribute__((aligned(DNSMETER_CACHELINE_SIZE)))
+
+/*
+ * Sequence lock for data with exactly one writer. The writer never waits,
+ * readers retry their copy until they got one which was not modified
+ * while copying.
+ */
+class SeqLock {
+private:
+    unsigned int sequence;
+
+public:
+    SeqLock()
+    {
+        sequence = 0;
+    }
+
+    inline void writeBegin()
+    {
+        __atomic_store_n(&sequence, sequence + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    inline void writeEnd()
+    {
+        __atomic_store_n(&sequence, sequence + 1, __ATOMIC_RELEASE);
+    }
+
+    inline unsigned int readBegin() const
+    {
+        unsigned int s;
+        while ((s = __atomic_load_n(&sequence, __ATOMIC_ACQUIRE)) & 1) {
+#if defined(__i386__) || defined(__x86_64__)
+            __builtin_ia32_pause();
+#endif
+        }
+        return s;
+    }
+
+    inline bool readRetry(unsigned int start) const
+    {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        return __atomic_load_n(&sequence, __ATOMIC_RELAXED) != start;
+    }
+};
+
+/*
+ * Statistic counters owned by one thread. The block starts on its own
+ * cache line and is padded to full cache lines, so that the owner does not
+ * share lines with other threads. Other threads only get consistent
+ * snapshots.
+ */
+template <class T>
+class DNSMETER_CACHELINE_ALIGNED CounterBlock {
+private:
+    SeqLock lock;
+    T       data;
+
+public:
+    inline T& beginUpdate()
+    {
+        lock.writeBegin();
+        return data;
+    }
+
+    inline void endUpdate()
+    {
+        lock.writeEnd();
+    }
+
+    void clear()
+    {
+        lock.writeBegin();
+        data.clear();
+        lock.writeEnd();
+    }
+
+    void snapshot(T& copy) const
+    {
+        unsigned int s;
+        do {
+            s    = lock.readBegin();
+            copy = data;
+        } while (lock.readRetry(s));
+    }
+};
+
+/*
+ * One counter block per target. Every block keeps its own cache lines,
+ * the total is the sum of the snapshots of all blocks.
+ */
+template <class T>
+class CounterBlockArray {
+private:
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || __cplusplus >= 201103L
+    CounterBlockArray& operator=(const CounterBlockArray& other);
+    CounterBlockArray(CounterBlockArray &&other) noexcept;
+    CounterBlockArray const & operator=(CounterBlockArray &&other);
+#endif
+
+    CounterBlock<T>* blocks;
+    size_t           count;
+
+public:
+    CounterBlockArray()
+    {
+        blocks = NULL;
+        count  = 0;
+        resize(1);
+    }
+
+    ~CounterBlockArray()
+    {
+        resize(0);
+    }
+
+    void resize(size_t n)
+    {
+        for (size_t i = 0; i < count; i++)
+            blocks[i].~CounterBlock<T>();
+        free(blocks);
+        blocks  = NULL;
+        count   = 0;
+        void* p = NULL;
+        if (!n)
+            return;
+        if (posix_memalign(&p, DNSMETER_CACHELINE_SIZE, sizeof(CounterBlock<T>) * n) != 0)
+            throw ppl7::OutOfMemoryException();
+        blocks = (CounterBlock<T>*)p;
+        for (count = 0; count < n; count++)
+            new (&blocks[count]) CounterBlock<T>();
+    }
+
+    inline size_t size() const
+    {
+        return count;
+    }
+
+    inline CounterBlock<T>& operator[](size_t i)
+    {
+        return blocks[i];
+    }
+
+    inline const CounterBlock<T>& operator[](size_t i) const
+    {
+        return blocks[i];
+    }
+
+    void clear()
+    {
+        for (size_t i = 0; i < count; i++)
+            blocks[i].clear();
+    }
+
+    void snapshot(T& total) const
+    {
+        T copy;
+        total.clear();
+        for (size_t i = 0; i < count; i++) {
+            blocks[i].snapshot(copy);
+            total += copy;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "step_clock.h"
+
+#include <math.h>
+#include <time.h>
+
+StepView::StepView()
+{
+    step      = 0;
+    start_ts  = 0;
+    start     = 0.0;
+    duration  = 0.0;
+    grace_end = 0.0;
+    drain     = false;
+    grace     = false;
+    control   = 0;
+    queryrate = -1;
+    timeslice = 0.0f;
+    payload   = NULL;
+    paused    = false;
+    ended     = false;
+}
+
+StepClock::StepClock()
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+    parties   = 0;
+    idle      = 0;
+    step      = 0;
+    start_ts  = 0;
+    start     = 0.0;
+    duration  = 0.0;
+    grace     = 0.0;
+    drain     = false;
+    finished  = false;
+    control   = 0;
+    queryrate = -1;
+    timeslice = 0.0f;
+    payload   = NULL;
+    paused    = false;
+    ended     = false;
+}
+
+StepClock::~StepClock()
+{
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+}
+
+void StepClock::setParties(int threads)
+{
+    pthread_mutex_lock(&mutex);
+    parties = threads;
+    pthread_mutex_unlock(&mutex);
+}
+
+/*
+ * Waits until all threads have finished the current step or until the
+ * given time, returns true if all threads wait for the next step.
+ */
+bool StepClock::waitIdle(double until)
+{
+    struct timespec ts;
+    ts.tv_sec  = (time_t)until;
+    ts.tv_nsec = (long)((until - floor(until)) * 1000000000.0);
+    pthread_mutex_lock(&mutex);
+    while (idle < parties) {
+        if (pthread_cond_timedwait(&cond, &mutex, &ts) != 0)
+            break;
+    }
+    bool done = (idle >= parties);
+    pthread_mutex_unlock(&mutex);
+    return done;
+}
+
+/*
+ * Starts the next step, the threads send for duration seconds. Queries
+ * which were sent up to grace seconds before are still counted for the
+ * previous one. With drain, the threads wait for the outstanding
+ * responses at the end of the step.
+ */
+int StepClock::begin(double duration, double grace, bool drain)
+{
+    // the query timestamps wrap around after 6 seconds
+    if (grace > 5.0)
+        grace = 5.0;
+    pthread_mutex_lock(&mutex);
+    start          = ppl7::GetMicrotime();
+    start_ts       = getQueryTimestamp();
+    this->duration = duration;
+    this->grace    = grace;
+    this->drain    = drain;
+    idle           = 0;
+    queryrate      = -1;
+    ended          = false;
+    __atomic_store_n(&step, step + 1, __ATOMIC_RELEASE);
+    int started = step;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+    return started;
+}
+
+double StepClock::startTime()
+{
+    pthread_mutex_lock(&mutex);
+    double t = start;
+    pthread_mutex_unlock(&mutex);
+    return t;
+}
+
+/*
+ * Time until which responses are still counted for the previous step
+ */
+double StepClock::graceEnd()
+{
+    pthread_mutex_lock(&mutex);
+    double end = start + grace;
+    pthread_mutex_unlock(&mutex);
+    return end;
+}
+
+/*
+ * Ends the session, await() returns false from now on
+ */
+void StepClock::finish()
+{
+    pthread_mutex_lock(&mutex);
+    finished = true;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+}
+
+void StepClock::copy(StepView& view) const
+{
+    view.step      = step;
+    view.start     = start;
+    view.start_ts  = start_ts;
+    view.duration  = duration;
+    view.grace_end = start + grace;
+    view.drain     = drain;
+    view.grace     = (grace > 0.0);
+    view.control   = control;
+    view.queryrate = queryrate;
+    view.timeslice = timeslice;
+    view.payload   = payload;
+    view.paused    = paused;
+    view.ended     = ended;
+}
+
+/*
+ * Called by a sender thread when it has finished a step. Returns false
+ * if the session is finished, otherwise the next step is in view.
+ */
+bool StepClock::await(StepView& view)
+{
+    pthread_mutex_lock(&mutex);
+    idle++;
+    pthread_cond_broadcast(&cond);
+    while (!finished && step == view.step)
+        pthread_cond_wait(&cond, &mutex);
+    bool next = !finished;
+    if (next)
+        copy(view);
+    pthread_mutex_unlock(&mutex);
+    return next;
+}
+
+/*
+ * Puts the current step in view, returns true if it has changed.
+ */
+bool StepClock::sync(StepView& view)
+{
+    if (__atomic_load_n(&step, __ATOMIC_ACQUIRE) == view.step)
+        return false;
+    pthread_mutex_lock(&mutex);
+    copy(view);
+    pthread_mutex_unlock(&mutex);
+    return true;
+}
+
+// called with the mutex locked
+void StepClock::changed()
+{
+    __atomic_store_n(&control, control + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Changes the query rate per thread of the running step, 0 is unlimited
+ */
+void StepClock::setRate(int queryrate, float timeslice)
+{
+    pthread_mutex_lock(&mutex);
+    this->queryrate = queryrate;
+    this->timeslice = timeslice;
+    changed();
+    pthread_mutex_unlock(&mutex);
+}
+
+/*
+ * Switches the threads to another payload file, it has to be kept until
+ * the end of the session.
+ */
+void StepClock::setPayload(PayloadFile* payload)
+{
+    pthread_mutex_lock(&mutex);
+    this->payload = payload;
+    changed();
+    pthread_mutex_unlock(&mutex);
+}
+
+void StepClock::pause(bool paused)
+{
+    pthread_mutex_lock(&mutex);
+    this->paused = paused;
+    changed();
+    pthread_mutex_unlock(&mutex);
+}
+
+/*
+ * Ends the running step early, the threads finish it as usual
+ */
+void StepClock::end()
+{
+    pthread_mutex_lock(&mutex);
+    ended = true;
+    changed();
+    pthread_mutex_unlock(&mutex);
+}
+
+/*
+ * Called by a sender thread during a step, returns true if the step has
+ * been changed since the last call.
+ */
+bool StepClock::update(StepView& view)
+{
+    if (__atomic_load_n(&control, __ATOMIC_ACQUIRE) == view.control)
+        return false;
+    pthread_mutex_lock(&mutex);
+    copy(view);
+    pthread_mutex_unlock(&mutex);
+    return true;
+}
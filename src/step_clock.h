@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "seqlock.h"
+#include "query.h"
+
+#include <ppl7.h>
+#include <pthread.h>
+
+#ifndef __dnsmeter_step_clock_h
+#define __dnsmeter_step_clock_h
+
+class PayloadFile;
+
+/*
+ * The step a thread counts for. A response which arrives within the grace
+ * time after the start of a step is counted for the previous step if its
+ * query was sent before the step started, the DNS ID of every query is
+ * its send timestamp (see getQueryTimestamp()).
+ */
+class StepView {
+public:
+    int            step;
+    unsigned short start_ts;
+    double         start;
+    double         duration;
+    double         grace_end;
+    bool           drain;
+    bool           grace;
+
+    // changes of the running session, see StepClock::update()
+    int          control;
+    int          queryrate;
+    float        timeslice;
+    PayloadFile* payload;
+    bool         paused;
+    bool         ended;
+
+    StepView();
+
+    inline int slot() const
+    {
+        return step & 1;
+    }
+
+    // ends the grace time, called by the owner from time to time
+    inline void tick(double now)
+    {
+        grace = (now < grace_end);
+    }
+
+    inline int slot(unsigned short id) const
+    {
+        if (!grace)
+            return step & 1;
+        unsigned short now   = getQueryTimestamp();
+        int            age   = (now + 60000 - id) % 60000;
+        int            since = (now + 60000 - start_ts) % 60000;
+        return (age > since) ? (step + 1) & 1 : step & 1;
+    }
+};
+
+/*
+ * Counters of the current and the previous step. The owner clears the
+ * counters of a step when it starts, so the results of a step can be read
+ * while the next one is running.
+ */
+template <class T>
+class StepCounters {
+private:
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || __cplusplus >= 201103L
+    StepCounters& operator=(const StepCounters& other);
+    StepCounters(StepCounters &&other) noexcept;
+    StepCounters const & operator=(StepCounters &&other);
+#endif
+
+    CounterBlockArray<T> slots[2];
+    const StepView*      view;
+
+public:
+    StepCounters()
+    {
+        view = NULL;
+    }
+
+    void setView(const StepView* view)
+    {
+        this->view = view;
+    }
+
+    void resize(size_t n)
+    {
+        slots[0].resize(n);
+        slots[1].resize(n);
+    }
+
+    inline size_t size() const
+    {
+        return slots[0].size();
+    }
+
+    inline CounterBlockArray<T>& operator[](int slot)
+    {
+        return slots[slot];
+    }
+
+    inline const CounterBlockArray<T>& operator[](int slot) const
+    {
+        return slots[slot];
+    }
+
+    // slot of the step a response to the query with this ID counts for
+    inline int slot(unsigned short id) const
+    {
+        return view ? view->slot(id) : 0;
+    }
+};
+
+/*
+ * Steps of a session. The sender threads are started once and wait in
+ * await() for the next step, begin() starts it for all of them at once.
+ * Between two steps the main thread changes the rates while all threads
+ * are waiting. Threads which do not take part, like the receiver thread,
+ * follow the steps with sync().
+ *
+ * The running step can be changed with setRate(), setPayload(), pause()
+ * and end(), the sender threads pick the changes up with update(). A new
+ * rate is valid until the end of the step, a new payload and the pause
+ * until they are changed again.
+ */
+class StepClock {
+private:
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || __cplusplus >= 201103L
+    StepClock& operator=(const StepClock& other);
+    StepClock(StepClock &&other) noexcept;
+    StepClock const & operator=(StepClock &&other);
+#endif
+
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    int             parties;
+    int             idle;
+    int             step;
+    unsigned short  start_ts;
+    double          start;
+    double          duration;
+    double          grace;
+    bool            drain;
+    bool            finished;
+
+    int          control;
+    int          queryrate;
+    float        timeslice;
+    PayloadFile* payload;
+    bool         paused;
+    bool         ended;
+
+    void copy(StepView& view) const;
+    void changed();
+
+public:
+    StepClock();
+    ~StepClock();
+    void   setParties(int threads);
+    bool   waitIdle(double until);
+    int    begin(double duration, double grace, bool drain);
+    double startTime();
+    double graceEnd();
+    void   finish();
+    bool   await(StepView& view);
+    bool   sync(StepView& view);
+
+    void setRate(int queryrate, float timeslice);
+    void setPayload(PayloadFile* payload);
+    void pause(bool paused);
+    void end();
+    bool update(StepView& view);
+};
+
+#endif
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "target_list.h"
+#include "query.h"
+#include "exceptions.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+
+TargetList::Target::Target()
+{
+    port   = 0;
+    weight = 1.0;
+    nport  = 0;
+    memset(addr, 0, sizeof(addr));
+}
+
+TargetList::TargetList()
+{
+    selection = SELECT_ROUND_ROBIN;
+    ipFamily  = ppl7::IPAddress::UNKNOWN;
+    addrlen   = 0;
+}
+
+/*
+ * Parses a comma separated list of targets: HOST[:PORT][@WEIGHT].
+ * IPv6 addresses with a port have to be put in brackets.
+ */
+void TargetList::parse(const ppl7::String& list)
+{
+    targets.clear();
+    ipFamily = ppl7::IPAddress::UNKNOWN;
+    ppl7::Array tok(list, ",", 0, true);
+    for (size_t i = 0; i < tok.size(); i++)
+        addTarget(ppl7::String(tok[i]).trim());
+    if (targets.empty())
+        throw MissingCommandlineParameter("target IP/hostname or port missing (-z IP:PORT)");
+}
+
+void TargetList::addTarget(const ppl7::String& definition)
+{
+    Target       t;
+    ppl7::String Tmp = definition;
+    ppl7::String Host;
+    ppl7::Array  matches;
+    if (Tmp.pregMatch("/^(.+)@([0-9.]+)$/", matches)) {
+        Tmp      = matches[1];
+        t.weight = matches[2].toDouble();
+        if (t.weight <= 0.0)
+            throw InvalidCommandlineParameter("-z IP:PORT@WEIGHT, weight must be greater than 0");
+    }
+    ppl7::Array Tok(Tmp, ":");
+    // The default port depends on the engine and is set later
+    if (Tmp.pregMatch("/^\\[(.+)\\](:([0-9]+))?$/", matches)) {
+        Host = matches[1];
+        if (matches.size() > 3 && matches[3].notEmpty()) {
+            t.port = matches[3].toInt();
+            if (t.port < 1 || t.port > 65535)
+                throw InvalidCommandlineParameter("-z IP:PORT, Invalid Port");
+        }
+    } else if (Tok.size() == 2) {
+        Host   = Tok[0];
+        t.port = Tok[1].toInt();
+        if (t.port < 1 || t.port > 65535)
+            throw InvalidCommandlineParameter("-z IP:PORT, Invalid Port");
+    } else {
+        // hostname, IPv4 address or IPv6 address without port
+        Host = Tmp;
+    }
+    std::list<ppl7::IPAddress> Result;
+    size_t                     num = ppl7::GetHostByName(Host, Result, ppl7::af_unspec);
+    if (!num)
+        throw InvalidCommandlineParameter("-z IP:PORT, Invalid IP or could not resolve Hostname");
+    t.ip = Result.front();
+    if (t.ip.family() != ppl7::IPAddress::IPv4 && t.ip.family() != ppl7::IPAddress::IPv6)
+        throw UnsupportedIPFamily();
+    if (ipFamily == ppl7::IPAddress::UNKNOWN) {
+        ipFamily = t.ip.family();
+        addrlen  = (ipFamily == ppl7::IPAddress::IPv6) ? 16 : 4;
+    } else if (t.ip.family() != ipFamily) {
+        throw UnsupportedIPFamily("-z all targets must be of the same address family");
+    }
+    memcpy(t.addr, t.ip.addr(), addrlen);
+    targets.push_back(t);
+}
+
+void TargetList::setDefaultPort(int port)
+{
+    for (size_t i = 0; i < targets.size(); i++) {
+        Target& t = targets[i];
+        if (!t.port)
+            t.port = port;
+        t.nport = htons(t.port);
+        if (ipFamily == ppl7::IPAddress::IPv6)
+            t.name.setf("[%s]:%d", (const char*)t.ip.toString(), t.port);
+        else
+            t.name.setf("%s:%d", (const char*)t.ip.toString(), t.port);
+    }
+}
+
+void TargetList::setSelection(Selection selection)
+{
+    this->selection = selection;
+}
+
+/*
+ * Builds the alias table for the selection by weight.
+ */
+void TargetList::compile()
+{
+    std::vector<double> weights;
+    for (size_t i = 0; i < targets.size(); i++)
+        weights.push_back(targets[i].weight);
+    table.build(weights);
+}
+
+bool TargetList::hasWeights() const
+{
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets[i].weight != 1.0)
+            return true;
+    }
+    return false;
+}
+
+size_t TargetList::size() const
+{
+    return targets.size();
+}
+
+int TargetList::family() const
+{
+    return ipFamily;
+}
+
+const TargetList::Target& TargetList::operator[](size_t i) const
+{
+    return targets[i];
+}
+
+/*
+ * FNV-1a hash of the query name, case insensitive
+ */
+unsigned int TargetList::hashName(const unsigned char* query, size_t size)
+{
+    unsigned int hash = 2166136261u;
+    for (size_t i = sizeof(struct DNS_HEADER); i < size && query[i]; i++) {
+        unsigned char c = query[i];
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "alias_table.h"
+#include "fast_random.h"
+
+#include <ppl7.h>
+#include <ppl7-inet.h>
+#include <string.h>
+#include <vector>
+
+#ifndef __dnsmeter_target_list_h
+#define __dnsmeter_target_list_h
+
+/*
+ * The nameservers under test. Queries are distributed over the targets
+ * in turn, by weight or by a hash of the query name, so that every name
+ * always goes to the same target. Responses are attributed to a target
+ * by their source address and port.
+ *
+ * All targets must be of the same address family.
+ */
+class TargetList {
+public:
+    enum Selection {
+        SELECT_ROUND_ROBIN,
+        SELECT_WEIGHT,
+        SELECT_HASH
+    };
+
+    class Target {
+    public:
+        ppl7::IPAddress ip;
+        int             port;
+        double          weight;
+        ppl7::String    name;
+        unsigned char   addr[16];
+        unsigned short  nport;
+        Target();
+    };
+
+private:
+    std::vector<Target> targets;
+    AliasTable          table;
+    Selection           selection;
+    int                 ipFamily;
+    size_t              addrlen;
+
+    void addTarget(const ppl7::String& definition);
+
+public:
+    TargetList();
+    void          parse(const ppl7::String& list);
+    void          setDefaultPort(int port);
+    void          setSelection(Selection selection);
+    void          compile();
+    bool          hasWeights() const;
+    size_t        size() const;
+    int           family() const;
+    const Target& operator[](size_t i) const;
+
+    /*
+     * Returns the index of the target for the next query. "next" is the
+     * round robin position of the calling thread.
+     */
+    inline int select(unsigned int& next, FastRandom& random, const unsigned char* query, size_t size) const
+    {
+        if (targets.size() == 1)
+            return 0;
+        if (selection == SELECT_WEIGHT)
+            return (int)table.sample(random);
+        if (selection == SELECT_HASH)
+            return (int)(hashName(query, size) % targets.size());
+        if (++next >= targets.size())
+            next = 0;
+        return (int)next;
+    }
+
+    /*
+     * Returns the index of the target with the given address and port in
+     * network byte order or -1 if the packet is not from a target.
+     */
+    inline int find(const void* addr, unsigned short port) const
+    {
+        for (size_t i = 0; i < targets.size(); i++) {
+            const Target& t = targets[i];
+            if (t.nport == port && memcmp(t.addr, addr, addrlen) == 0)
+                return (int)i;
+        }
+        return -1;
+    }
+
+    static unsigned int hashName(const unsigned char* query, size_t size);
+};
+
+#endif
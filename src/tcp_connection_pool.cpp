@@ -0,0 +1,685 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "tcp_connection_pool.h"
+#include "query.h"
+#include "exceptions.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#define TCP_BUFFER_SIZE 4096
+
+static socklen_t make_sockaddr(const ppl7::IPAddress& ip, int port, struct sockaddr_storage& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    if (ip.family() == ppl7::IPAddress::IPv6) {
+        ip.toSockAddr(&addr, sizeof(struct sockaddr_in6));
+        ((struct sockaddr_in6*)&addr)->sin6_port = htons(port);
+        return sizeof(struct sockaddr_in6);
+    }
+    if (ip.family() != ppl7::IPAddress::IPv4)
+        throw UnsupportedIPFamily();
+    ip.toSockAddr(&addr, sizeof(struct sockaddr_in));
+    ((struct sockaddr_in*)&addr)->sin_port = htons(port);
+    return sizeof(struct sockaddr_in);
+}
+
+TCPConnectionPool::Counter::Counter()
+{
+    clear();
+}
+
+void TCPConnectionPool::Counter::clear()
+{
+    connects        = 0;
+    connect_errors  = 0;
+    closed_by_peer  = 0;
+    queries_dropped = 0;
+    resumed         = 0;
+    handshake_histogram.clear();
+}
+
+TCPConnectionPool::Counter& TCPConnectionPool::Counter::operator+=(const TCPConnectionPool::Counter& other)
+{
+    connects += other.connects;
+    connect_errors += other.connect_errors;
+    closed_by_peer += other.closed_by_peer;
+    queries_dropped += other.queries_dropped;
+    resumed += other.resumed;
+    handshake_histogram += other.handshake_histogram;
+    return *this;
+}
+
+TCPConnectionPool::TCPConnectionPool()
+{
+    conn           = NULL;
+    dirty          = NULL;
+    ids            = NULL;
+    numDirty       = 0;
+    numConnections = 0;
+    numTargets     = 0;
+    perTarget      = 0;
+    nextConnection = NULL;
+    epfd           = -1;
+    pipeline       = 1;
+    churn          = 0;
+    timeout        = 2.0;
+    lastMaintain   = 0.0;
+    remote         = NULL;
+    classes        = NULL;
+    classCounter   = NULL;
+    phases         = NULL;
+    memset(&local, 0, sizeof(local));
+    addrlen = 0;
+#ifdef HAVE_LIBSSL
+    ctx     = NULL;
+    session = NULL;
+#endif
+}
+
+TCPConnectionPool::~TCPConnectionPool()
+{
+    close();
+#ifdef HAVE_LIBSSL
+    if (ctx)
+        SSL_CTX_free(ctx);
+#endif
+}
+
+void TCPConnectionPool::setQueryClasses(const QueryClasses* classes, CounterBlock<QueryClassCounter>* counter)
+{
+    this->classes = classes;
+    classCounter  = counter;
+}
+
+void TCPConnectionPool::setPhaseTimer(PhaseTimer* phases)
+{
+    this->phases = phases;
+}
+
+/*
+ * Turns the pool into a DNS over TLS pool. The certificate of the target
+ * is not verified, we only want to measure it.
+ */
+void TCPConnectionPool::enableTLS(bool resume)
+{
+#ifdef HAVE_LIBSSL
+    OPENSSL_init_ssl(0, NULL);
+    if (!ctx && !(ctx = SSL_CTX_new(TLS_client_method())))
+        throw UnsupportedEngine("Could not create TLS context");
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+    // writes are retried with a moved and longer buffer
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    if (resume) {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, newSession);
+        SSL_CTX_set_app_data(ctx, this);
+    } else {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+    }
+#else
+    throw UnsupportedEngine("dnsmeter was built without OpenSSL");
+#endif
+}
+
+#ifdef HAVE_LIBSSL
+int TCPConnectionPool::newSession(SSL* ssl, SSL_SESSION* session)
+{
+    TCPConnectionPool* pool = (TCPConnectionPool*)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    const Connection*  c    = (const Connection*)SSL_get_app_data(ssl);
+    if (pool->session[c->target])
+        SSL_SESSION_free(pool->session[c->target]);
+    pool->session[c->target] = session;
+    return 1;
+}
+
+void TCPConnectionPool::startTLS(Connection& c)
+{
+    if (!(c.ssl = SSL_new(ctx)))
+        throw ppl7::OutOfMemoryException();
+    SSL_set_fd(c.ssl, c.sd);
+    SSL_set_app_data(c.ssl, &c);
+    SSL_set_connect_state(c.ssl);
+    if (session[c.target])
+        SSL_set_session(c.ssl, session[c.target]);
+    c.state = HANDSHAKING;
+}
+
+/*
+ * Returns false if the handshake failed.
+ */
+bool TCPConnectionPool::continueHandshake(Connection& c, CounterBlock<Counter>& counter)
+{
+    int r = SSL_do_handshake(c.ssl);
+    if (r == 1) {
+        connectionEstablished(c, counter);
+        return writeConnection(c);
+    }
+    int err = SSL_get_error(c.ssl, r);
+    if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE)
+        return false;
+    bool want_write = (err == SSL_ERROR_WANT_WRITE);
+    if (want_write != c.want_write) {
+        c.want_write = want_write;
+        updateEvents(c);
+    }
+    return true;
+}
+#endif
+
+void TCPConnectionPool::open(const ppl7::IPAddress& source, const TargetList& targets,
+    int count, int pipeline, int churn, int timeout)
+{
+#ifndef HAVE_SYS_EPOLL_H
+    throw UnsupportedEngine("the TCP engine needs epoll");
+#else
+    if (source.family() != targets.family())
+        throw UnsupportedIPFamily("source and destination must be of the same address family");
+    if (count < 1 || pipeline < 1 || churn < 0 || targets.size() < 1)
+        throw ppl7::InvalidArgumentsException();
+    close();
+    addrlen        = make_sockaddr(source, 0, local);
+    this->pipeline = pipeline;
+    this->churn    = churn;
+    this->timeout  = (double)timeout;
+    numTargets     = (int)targets.size();
+    perTarget      = count;
+    conn           = (Connection*)calloc(count * numTargets, sizeof(Connection));
+    dirty          = (int*)calloc(count * numTargets, sizeof(int));
+    ids            = (unsigned short*)calloc(count * numTargets * pipeline, sizeof(unsigned short));
+    remote         = (struct sockaddr_storage*)calloc(numTargets, sizeof(struct sockaddr_storage));
+    nextConnection = (int*)calloc(numTargets, sizeof(int));
+#ifdef HAVE_LIBSSL
+    session = (SSL_SESSION**)calloc(numTargets, sizeof(SSL_SESSION*));
+    if (!session)
+        throw ppl7::OutOfMemoryException();
+#endif
+    if (!conn || !dirty || !ids || !remote || !nextConnection)
+        throw ppl7::OutOfMemoryException();
+    for (int t = 0; t < numTargets; t++) {
+        make_sockaddr(targets[t].ip, targets[t].port, remote[t]);
+        nextConnection[t] = t * count;
+    }
+    numConnections = count * numTargets;
+    for (int i = 0; i < numConnections; i++) {
+        conn[i].sd     = -1;
+        conn[i].state  = CLOSED;
+        conn[i].target = i / count;
+        conn[i].ids    = ids + i * pipeline;
+    }
+    if ((epfd = epoll_create1(0)) < 0)
+        ppl7::throwExceptionFromErrno(errno, "Could not create epoll instance");
+#endif
+}
+
+void TCPConnectionPool::close()
+{
+    for (int i = 0; i < numConnections; i++) {
+        closeConnection(conn[i]);
+        free(conn[i].rbuf);
+        free(conn[i].wbuf);
+    }
+#ifdef HAVE_LIBSSL
+    for (int t = 0; session && t < numTargets; t++) {
+        if (session[t])
+            SSL_SESSION_free(session[t]);
+    }
+    free(session);
+    session = NULL;
+#endif
+    free(conn);
+    free(dirty);
+    free(ids);
+    free(remote);
+    free(nextConnection);
+    conn           = NULL;
+    dirty          = NULL;
+    ids            = NULL;
+    remote         = NULL;
+    nextConnection = NULL;
+    numDirty       = 0;
+    numConnections = 0;
+    numTargets     = 0;
+    if (epfd >= 0)
+        ::close(epfd);
+    epfd = -1;
+}
+
+/*
+ * Opens all connections which are not open yet.
+ */
+void TCPConnectionPool::connect(CounterBlock<Counter>& counter)
+{
+    for (int i = 0; i < numConnections; i++) {
+        if (conn[i].state == CLOSED)
+            startConnection(conn[i], counter);
+    }
+    lastMaintain = ppl7::GetMicrotime();
+}
+
+bool TCPConnectionPool::startConnection(Connection& c, CounterBlock<Counter>& counter)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    c.start         = ppl7::GetMicrotime();
+    c.last_activity = c.start;
+    c.sd            = socket(local.ss_family, SOCK_STREAM, 0);
+    if (c.sd >= 0) {
+        int set = 1;
+        setsockopt(c.sd, IPPROTO_TCP, TCP_NODELAY, &set, sizeof(set));
+        if (churn) {
+            // Reset instead of a graceful close, otherwise the local ports
+            // would run out in TIME_WAIT
+            struct linger l;
+            l.l_onoff  = 1;
+            l.l_linger = 0;
+            setsockopt(c.sd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+        }
+        fcntl(c.sd, F_SETFL, fcntl(c.sd, F_GETFL, 0) | O_NONBLOCK);
+        if (bind(c.sd, (const struct sockaddr*)&local, addrlen) == 0
+            && (::connect(c.sd, (const struct sockaddr*)&remote[c.target], addrlen) == 0 || errno == EINPROGRESS)) {
+            struct epoll_event ev;
+            ev.events   = EPOLLIN | EPOLLOUT;
+            ev.data.u32 = (uint32_t)(&c - conn);
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, c.sd, &ev) == 0) {
+                c.state      = CONNECTING;
+                c.want_write = true;
+                return true;
+            }
+        }
+        ::close(c.sd);
+        c.sd = -1;
+    }
+    counter.beginUpdate().connect_errors++;
+    counter.endUpdate();
+    c.state = CLOSED;
+#endif
+    return false;
+}
+
+void TCPConnectionPool::closeConnection(Connection& c)
+{
+#ifdef HAVE_LIBSSL
+    if (c.ssl) {
+        // OpenSSL invalidates the session if the connection is freed
+        // without a close_notify
+        if (c.draining)
+            SSL_shutdown(c.ssl);
+        SSL_free(c.ssl);
+    }
+    c.ssl = NULL;
+#endif
+    if (c.sd >= 0)
+        ::close(c.sd);
+    c.sd         = -1;
+    c.state      = CLOSED;
+    c.inflight   = 0;
+    c.first      = 0;
+    c.queries    = 0;
+    c.rused      = 0;
+    c.wused      = 0;
+    c.want_write = false;
+    c.draining   = false;
+}
+
+/*
+ * Closes a failed connection. Its queries in flight are counted as
+ * dropped and give their window slots back, as their responses can not
+ * arrive anymore.
+ */
+void TCPConnectionPool::dropConnection(Connection& c, CounterBlock<Counter>& counter, ConcurrencyWindow* window, int lane)
+{
+    counter.beginUpdate().queries_dropped += c.inflight;
+    counter.endUpdate();
+    if (window) {
+        for (int i = 0; i < c.inflight; i++)
+            window->release(lane, c.ids[(c.first + i) % pipeline]);
+    }
+    closeConnection(c);
+}
+
+/*
+ * Removes an answered query from the IDs in flight. Responses usually
+ * arrive in the order of the queries, so the oldest one is checked
+ * first. A response without a matching ID answers the oldest query.
+ */
+void TCPConnectionPool::answered(Connection& c, unsigned short id)
+{
+    if (c.inflight == 0)
+        return;
+    for (int i = 0; i < c.inflight; i++) {
+        int p = (c.first + i) % pipeline;
+        if (c.ids[p] == id) {
+            c.ids[p] = c.ids[c.first];
+            break;
+        }
+    }
+    c.first = (c.first + 1) % pipeline;
+    c.inflight--;
+}
+
+void TCPConnectionPool::connectionEstablished(Connection& c, CounterBlock<Counter>& counter)
+{
+    double now      = ppl7::GetMicrotime();
+    c.state         = ESTABLISHED;
+    c.last_activity = now;
+    Counter& cc     = counter.beginUpdate();
+    cc.connects++;
+    cc.handshake_histogram.add(now - c.start);
+#ifdef HAVE_LIBSSL
+    if (c.ssl && SSL_session_reused(c.ssl))
+        cc.resumed++;
+#endif
+    counter.endUpdate();
+}
+
+void TCPConnectionPool::updateEvents(Connection& c)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event ev;
+    ev.events   = EPOLLIN | (c.want_write ? EPOLLOUT : 0);
+    ev.data.u32 = (uint32_t)(&c - conn);
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c.sd, &ev);
+#endif
+}
+
+/*
+ * Adds a query to the write buffer of the next connection to the target
+ * which has room for another outstanding query. Returns false if all
+ * connections to the target are busy or closed.
+ */
+bool TCPConnectionPool::send(const unsigned char* query, size_t size, int target)
+{
+    int first = target * perTarget;
+    for (int i = 0; i < perTarget; i++) {
+        int         nc = nextConnection[target];
+        Connection& c  = conn[nc];
+        nextConnection[target] = (nc + 1 < first + perTarget) ? nc + 1 : first;
+        if (c.state != ESTABLISHED || c.draining || c.inflight >= pipeline)
+            continue;
+        if (c.wused + size + 2 > c.wsize) {
+            size_t         newsize = c.wsize ? c.wsize * 2 : TCP_BUFFER_SIZE;
+            unsigned char* buf;
+            while (newsize < c.wused + size + 2)
+                newsize *= 2;
+            if (!(buf = (unsigned char*)realloc(c.wbuf, newsize)))
+                throw ppl7::OutOfMemoryException();
+            c.wbuf  = buf;
+            c.wsize = newsize;
+        }
+        c.wbuf[c.wused]     = (unsigned char)(size >> 8);
+        c.wbuf[c.wused + 1] = (unsigned char)(size & 0xff);
+        memcpy(c.wbuf + c.wused + 2, query, size);
+        c.wused += size + 2;
+        c.ids[(c.first + c.inflight) % pipeline] = ntohs(((const struct DNS_HEADER*)query)->id);
+        c.inflight++;
+        c.queries++;
+        if (churn && c.queries >= (ppluint64)churn)
+            c.draining = true;
+        if (!c.dirty) {
+            c.dirty           = true;
+            dirty[numDirty++] = nc;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool TCPConnectionPool::writeConnection(Connection& c)
+{
+    size_t done = 0;
+    while (done < c.wused) {
+        ssize_t n;
+#ifdef HAVE_LIBSSL
+        if (c.ssl) {
+            int r = SSL_write(c.ssl, c.wbuf + done, (int)(c.wused - done));
+            if (r <= 0) {
+                int err = SSL_get_error(c.ssl, r);
+                if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ)
+                    break;
+                return false;
+            }
+            done += r;
+            continue;
+        }
+#endif
+        n = write(c.sd, c.wbuf + done, c.wused - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return false;
+        }
+        done += n;
+    }
+    if (done < c.wused)
+        memmove(c.wbuf, c.wbuf + done, c.wused - done);
+    c.wused -= done;
+    bool want_write = (c.wused > 0);
+    if (want_write != c.want_write) {
+        c.want_write = want_write;
+        updateEvents(c);
+    }
+    return true;
+}
+
+/*
+ * Writes the queued queries of all connections. Connections which are
+ * still connecting are written as soon as they are established.
+ */
+void TCPConnectionPool::flush(CounterBlock<Counter>& counter, ConcurrencyWindow* window, int lane)
+{
+    for (int i = 0; i < numDirty; i++) {
+        Connection& c = conn[dirty[i]];
+        c.dirty       = false;
+        if (c.state == ESTABLISHED && !c.want_write && !writeConnection(c)) {
+            counter.beginUpdate().closed_by_peer++;
+            counter.endUpdate();
+            dropConnection(c, counter, window, lane);
+        }
+    }
+    numDirty = 0;
+}
+
+/*
+ * Reads everything available and counts all complete responses. Returns
+ * false if the connection was closed by the peer or failed.
+ */
+bool TCPConnectionPool::readConnection(Connection& c, StepCounters<RawSocketReceiver::Counter>& counter, ConcurrencyWindow* window, int lane)
+{
+    bool tls = false;
+#ifdef HAVE_LIBSSL
+    tls = (c.ssl != NULL);
+#endif
+    while (1) {
+        if (c.rused == c.rsize) {
+            size_t         newsize = c.rsize ? c.rsize * 2 : TCP_BUFFER_SIZE;
+            unsigned char* buf     = (unsigned char*)realloc(c.rbuf, newsize);
+            if (!buf)
+                throw ppl7::OutOfMemoryException();
+            c.rbuf  = buf;
+            c.rsize = newsize;
+        }
+        size_t  space = c.rsize - c.rused;
+        ssize_t n;
+#ifdef HAVE_LIBSSL
+        if (c.ssl) {
+            // OpenSSL may have buffered more than epoll knows about, read
+            // until it wants more from the socket
+            int r = SSL_read(c.ssl, c.rbuf + c.rused, (int)space);
+            if (r <= 0) {
+                int err = SSL_get_error(c.ssl, r);
+                return (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE);
+            }
+            n = r;
+        } else
+#endif
+        {
+            n = read(c.sd, c.rbuf + c.rused, space);
+            if (n == 0)
+                return false;
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                return (errno == EAGAIN || errno == EWOULDBLOCK);
+            }
+        }
+        c.rused += n;
+        c.last_activity = ppl7::GetMicrotime();
+
+        size_t pos = 0;
+        while (c.rused - pos >= 2) {
+            size_t len = ((size_t)c.rbuf[pos] << 8) | c.rbuf[pos + 1];
+            if (c.rused - pos < len + 2)
+                break;
+            const unsigned char* payload = c.rbuf + pos + 2;
+            unsigned short       id      = 0;
+            if (len >= sizeof(struct DNS_HEADER)) {
+                id = ntohs(((const struct DNS_HEADER*)payload)->id);
+                double         rd = getQueryRTT(id);
+                int            s  = counter.slot(id);
+                if (window)
+                    window->release(lane, id);
+                counter[s][c.target].beginUpdate().add(payload, len + 2, rd);
+                counter[s][c.target].endUpdate();
+                if (classes) {
+                    classCounter[s].beginUpdate().add(classes->classify(payload, len), payload, rd);
+                    classCounter[s].endUpdate();
+                }
+            }
+            answered(c, id);
+            pos += len + 2;
+        }
+        if (pos) {
+            memmove(c.rbuf, c.rbuf + pos, c.rused - pos);
+            c.rused -= pos;
+        }
+        if ((size_t)n < space && !tls)
+            return true;
+    }
+}
+
+/*
+ * Replaces closed connections, connections which are done with their
+ * share of queries in churn mode, and connections on which responses are
+ * overdue.
+ */
+void TCPConnectionPool::maintain(CounterBlock<Counter>& counter, ConcurrencyWindow* window, int lane)
+{
+    double now = ppl7::GetMicrotime();
+    if (now - lastMaintain < 0.01)
+        return;
+    lastMaintain = now;
+    for (int i = 0; i < numConnections; i++) {
+        Connection& c = conn[i];
+        if (c.state != CLOSED) {
+            if (c.draining && c.inflight == 0 && c.wused == 0) {
+                closeConnection(c);
+            } else if (c.inflight > 0 && now - c.last_activity > timeout) {
+                dropConnection(c, counter, window, lane);
+            } else if ((c.state == CONNECTING || c.state == HANDSHAKING) && now - c.start > timeout) {
+                counter.beginUpdate().connect_errors++;
+                counter.endUpdate();
+                closeConnection(c);
+            }
+        }
+        if (c.state == CLOSED)
+            startConnection(c, counter);
+    }
+}
+
+void TCPConnectionPool::receive(StepCounters<RawSocketReceiver::Counter>& counter, CounterBlock<Counter>& conn_counter,
+    ConcurrencyWindow* window, int lane, int timeout_ms)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event events[256];
+    int                n = epoll_wait(epfd, events, 256, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        Connection& c  = conn[events[i].data.u32];
+        bool        ok = true;
+        if (c.state == CLOSED)
+            continue;
+        if (c.state == CONNECTING) {
+            int       err = 0;
+            socklen_t len = sizeof(err);
+            if (getsockopt(c.sd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+                conn_counter.beginUpdate().connect_errors++;
+                conn_counter.endUpdate();
+                closeConnection(c);
+                continue;
+            }
+            if (!(events[i].events & EPOLLOUT))
+                continue;
+#ifdef HAVE_LIBSSL
+            if (ctx)
+                startTLS(c);
+#endif
+        }
+#ifdef HAVE_LIBSSL
+        if (c.state == HANDSHAKING) {
+            if (!continueHandshake(c, conn_counter)) {
+                conn_counter.beginUpdate().connect_errors++;
+                conn_counter.endUpdate();
+                closeConnection(c);
+            }
+            continue;
+        }
+#endif
+        if (c.state == CONNECTING) {
+            connectionEstablished(c, conn_counter);
+            ok = writeConnection(c);
+        } else {
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                bool timed = phases && phases->begin();
+                ok         = readConnection(c, counter, window, lane);
+                if (timed)
+                    phases->mark(PhaseTimer::RECEIVE);
+            }
+            if (ok && (events[i].events & EPOLLOUT))
+                ok = writeConnection(c);
+        }
+        if (!ok) {
+            conn_counter.beginUpdate().closed_by_peer++;
+            conn_counter.endUpdate();
+            dropConnection(c, conn_counter, window, lane);
+        } else if (c.draining && c.inflight == 0 && c.wused == 0) {
+            // churn mode, replace the connection right away
+            closeConnection(c);
+            startConnection(c, conn_counter);
+        }
+    }
+    maintain(conn_counter, window, lane);
+#endif
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "raw_socket_receiver.h"
+#include "rtt_histogram.h"
+#include "concurrency_window.h"
+#include "seqlock.h"
+#include "target_list.h"
+#include "phase_timer.h"
+
+#include <ppl7.h>
+#include <ppl7-inet.h>
+#include <netinet/in.h>
+#ifdef HAVE_LIBSSL
+#include <openssl/ssl.h>
+#endif
+
+#ifndef __dnsmeter_tcp_connection_pool_h
+#define __dnsmeter_tcp_connection_pool_h
+
+/*
+ * Sends queries over a pool of persistent TCP connections (RFC 7766).
+ *
+ * Every connection carries up to "pipeline" outstanding queries. Queries
+ * are length-prefixed and collected in the write buffer of the
+ * connection until flush() is called, responses are matched in any
+ * order: the DNS ID is the send timestamp, so a response only has to be
+ * counted and its round trip time calculated.
+ * The IDs in flight are kept per connection, so that the queries lost
+ * with a failed connection are counted as dropped and give their slots
+ * of the closed-loop window back.
+ *
+ * With churn > 0, a connection is closed after it has sent that many
+ * queries and all responses have been received, and a new one is opened,
+ * so that the handshake capacity of the target is measured as well.
+ *
+ * With several targets every target gets its own set of connections.
+ *
+ * With TLS enabled (DNS over TLS, RFC 7858) every connection does a TLS
+ * handshake after the TCP handshake. The last session ticket a target
+ * sent is used to resume the next connection to it. Queries are only sent on
+ * connections which are fully established, so the round trip times of
+ * the queries never include a handshake.
+ *
+ * All sockets are non-blocking and driven by one epoll instance per
+ * sender thread.
+ */
+class TCPConnectionPool {
+private:
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || __cplusplus >= 201103L
+    TCPConnectionPool& operator=(const TCPConnectionPool& other);
+    TCPConnectionPool(TCPConnectionPool &&other) noexcept;
+    TCPConnectionPool const & operator=(TCPConnectionPool &&other);
+#endif
+
+public:
+    class Counter {
+    public:
+        Counter();
+        void         clear();
+        ppluint64    connects;
+        ppluint64    connect_errors;
+        ppluint64    closed_by_peer;
+        ppluint64    queries_dropped;
+        ppluint64    resumed;
+        RTTHistogram handshake_histogram;
+        Counter&     operator+=(const Counter& other);
+    };
+
+    enum State {
+        CLOSED,
+        CONNECTING,
+        HANDSHAKING,
+        ESTABLISHED
+    };
+
+private:
+    class Connection {
+    public:
+        int             sd;
+        int             target;
+        State           state;
+        double          start;
+        double          last_activity;
+        int             inflight;
+        int             first;
+        unsigned short* ids;
+        ppluint64       queries;
+        unsigned char*  rbuf;
+        size_t          rsize, rused;
+        unsigned char*  wbuf;
+        size_t          wsize, wused;
+        bool            want_write;
+        bool            draining;
+        bool            dirty;
+#ifdef HAVE_LIBSSL
+        SSL* ssl;
+#endif
+    };
+
+    Connection*                      conn;
+    int*                             dirty;
+    unsigned short*                  ids;
+    int                              numDirty;
+    int                              numConnections;
+    int                              numTargets;
+    int                              perTarget;
+    int*                             nextConnection;
+    int                              epfd;
+    int                              pipeline;
+    int                              churn;
+    double                           timeout;
+    double                           lastMaintain;
+    struct sockaddr_storage*         remote;
+    struct sockaddr_storage          local;
+    socklen_t                        addrlen;
+    const QueryClasses*              classes;
+    CounterBlock<QueryClassCounter>* classCounter;
+    PhaseTimer*                      phases;
+#ifdef HAVE_LIBSSL
+    SSL_CTX*      ctx;
+    SSL_SESSION** session;
+
+    static int newSession(SSL* ssl, SSL_SESSION* session);
+    void       startTLS(Connection& c);
+    bool       continueHandshake(Connection& c, CounterBlock<Counter>& counter);
+#endif
+
+    bool startConnection(Connection& c, CounterBlock<Counter>& counter);
+    void closeConnection(Connection& c);
+    void dropConnection(Connection& c, CounterBlock<Counter>& counter, ConcurrencyWindow* window, int lane);
+    void answered(Connection& c, unsigned short id);
+    void connectionEstablished(Connection& c, CounterBlock<Counter>& counter);
+    void updateEvents(Connection& c);
+    bool writeConnection(Connection& c);
+    bool readConnection(Connection& c, StepCounters<RawSocketReceiver::Counter>& counter, ConcurrencyWindow* window, int lane);
+    void maintain(CounterBlock<Counter>& counter, ConcurrencyWindow* window, int lane);
+
+public:
+    TCPConnectionPool();
+    ~TCPConnectionPool();
+    void open(const ppl7::IPAddress& source, const TargetList& targets,
+        int count, int pipeline, int churn, int timeout);
+    void close();
+    void enableTLS(bool resume);
+    void setQueryClasses(const QueryClasses* classes, CounterBlock<QueryClassCounter>* counter);
+    void setPhaseTimer(PhaseTimer* phases);
+    void connect(CounterBlock<Counter>& counter);
+    bool send(const unsigned char* query, size_t size, int target);
+    void flush(CounterBlock<Counter>& counter, ConcurrencyWindow* window, int lane);
+    void receive(StepCounters<RawSocketReceiver::Counter>& counter, CounterBlock<Counter>& conn_counter,
+        ConcurrencyWindow* window, int lane, int timeout_ms);
+};
+
+#endif
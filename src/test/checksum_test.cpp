@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "checksum.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Compares every checksum implementation the CPU supports with the
+ * scalar routine packet.cpp used before, for random data, lengths and
+ * alignments. Buffers of 0xff bytes check that carries are not lost.
+ */
+
+static unsigned char buffer[65536 + 64];
+
+// the one's complement sum of the former in_cksum() and cksum_add()
+static unsigned int reference_sum(unsigned int sum, const void* data, size_t len)
+{
+    const unsigned short* w = (const unsigned short*)data;
+    while (len > 1) {
+        sum += *w++;
+        len -= 2;
+    }
+    if (len) {
+        unsigned short last      = 0;
+        *(unsigned char*)(&last) = *(const unsigned char*)w;
+        sum += last;
+    }
+    return sum;
+}
+
+static unsigned short reference_cksum(const void* data, size_t len)
+{
+    unsigned int sum = reference_sum(0, data, len);
+    sum              = (sum >> 16) + (sum & 0xffff);
+    sum += (sum >> 16);
+    return (unsigned short)~sum;
+}
+
+static int check(Checksum::Implementation impl, size_t offset, size_t len, unsigned int start)
+{
+    Checksum::Function f        = Checksum::get(impl);
+    const void*        data     = buffer + offset;
+    unsigned int       expected = reference_sum(start, data, len);
+    unsigned int       sum      = f(start, data, len);
+    unsigned short     cksum    = (unsigned short)~Checksum::fold(f(0, data, len));
+    if (sum == expected && cksum == reference_cksum(data, len))
+        return 0;
+    printf("FAIL %s: offset %zu, length %zu, start 0x%08x: sum 0x%08x, expected 0x%08x\n",
+        Checksum::name(impl), offset, len, start, sum, expected);
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    int          failed = 0;
+    unsigned int seed   = 4711;
+    if (argc > 1)
+        seed = (unsigned int)strtoul(argv[1], NULL, 10);
+    srandom(seed);
+    printf("seed %u, selected: %s\n", seed, Checksum::name(Checksum::selected()));
+
+    for (int i = 0; i < Checksum::IMPLEMENTATIONS; i++) {
+        Checksum::Implementation impl = (Checksum::Implementation)i;
+        if (!Checksum::supported(impl)) {
+            printf("%s: not supported\n", Checksum::name(impl));
+            continue;
+        }
+        int errors = 0;
+        for (size_t len = 0; len <= 4096; len++) {
+            for (size_t j = 0; j < sizeof(buffer); j++)
+                buffer[j] = (unsigned char)random();
+            errors += check(impl, random() % 64, len, 0);
+            errors += check(impl, random() % 64, len, (unsigned int)random() & 0xffff);
+        }
+        for (int n = 0; n < 200; n++) {
+            size_t len = random() % 65536;
+            errors += check(impl, random() % 64, len, 0);
+        }
+        memset(buffer, 0xff, sizeof(buffer));
+        for (size_t offset = 0; offset < 64; offset++) {
+            errors += check(impl, offset, 4096 + offset, 0);
+            errors += check(impl, offset, 65535 - offset, 0);
+        }
+        memset(buffer, 0, sizeof(buffer));
+        errors += check(impl, 0, 4096, 0);
+        printf("%s: %s\n", Checksum::name(impl), errors ? "FAILED" : "ok");
+        failed += errors;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh -e
+
+# the dot engine against "openssl s_server" as TLS stand-in on the
+# loopback interface. The stand-in does not answer the queries, so the
+# connection times out after a second and is opened again, resuming the
+# session unless --no-resume is given.
+if ! command -v openssl >/dev/null 2>&1 || ! openssl s_server -help >/dev/null 2>&1; then
+    echo "needs openssl s_server, skipped"
+    exit 77
+fi
+
+set -x
+openssl req -x509 -newkey rsa:2048 -nodes -subj /CN=localhost -days 1 \
+  -keyout test10.key -out test10.crt 2>/dev/null
+openssl s_server -quiet -accept 127.0.0.1:53101 -cert test10.crt -key test10.key \
+  >test10-server.out 2>&1 </dev/null &
+server=$!
+trap "kill $server" EXIT
+sleep 1
+
+if ! ../dnsmeter --engine dot -q 127.0.0.1 -z 127.0.0.1:53101 --sockets 1 -t 1 \
+  --generate "{rand:8}.example.com A" -r 10 -l 5 >test10.out; then
+    if grep "built without OpenSSL" test10.out; then
+        exit 77
+    fi
+    exit 1
+fi
+# several connections, all but the first one resumed
+grep "TCP connections opened: " test10.out | awk '{ exit !($4 > 1) }'
+grep "TLS sessions resumed: " test10.out | awk '{ exit !($4 > 0) }'
+
+../dnsmeter --engine dot -q 127.0.0.1 -z 127.0.0.1:53101 --sockets 1 -t 1 \
+  --generate "{rand:8}.example.com A" -r 10 -l 5 --no-resume >test10-noresume.out
+grep "TCP connections opened: " test10-noresume.out | awk '{ exit !($4 > 1) }'
+grep "TLS sessions resumed: 0 of " test10-noresume.out
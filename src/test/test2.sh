@@ -0,0 +1,28 @@
+#!/bin/sh -xe
+
+echo "test2-secret" >test2.secret
+echo "wrong-secret" >test2-wrong.secret
+
+# coordinator with two agents on the loopback interface
+../dnsmeter --agent 127.0.0.1:53011 --agent-secret test2.secret &
+agent1=$!
+../dnsmeter --agent 127.0.0.1:53012 --agent-secret test2.secret &
+agent2=$!
+trap "kill $agent1 $agent2" EXIT
+sleep 1
+
+../dnsmeter --agents 127.0.0.1:53011,127.0.0.1:53012 --engine udp \
+  --agent-secret test2.secret \
+  -q 127.0.0.1 -z 127.0.0.1:53013 --generate "{rand:8}.example.com A" \
+  -r 200,400 -l 2 >test2.out
+grep "Start Session with Agents: 2, Queryrate: 400" test2.out
+grep "Agent 127.0.0.1:53011: send" test2.out
+grep "Agent 127.0.0.1:53012: send" test2.out
+
+# a coordinator with a wrong secret is rejected
+if ../dnsmeter --agents 127.0.0.1:53011 --engine udp \
+  --agent-secret test2-wrong.secret \
+  -q 127.0.0.1 -z 127.0.0.1:53013 --generate "{rand:8}.example.com A" \
+  -r 200 -l 1 >test2-wrong.out; then
+  exit 1
+fi
@@ -0,0 +1,12 @@
+#!/bin/sh -xe
+
+# dnsmeter against dnsmeter-responder on the loopback interface
+../dnsmeter-responder -b 127.0.0.1:53021 -n 2 --rcode NXDOMAIN --answer-size 100 >test3-responder.out &
+responder=$!
+trap "kill $responder" EXIT
+sleep 1
+
+../dnsmeter --engine udp -q 127.0.0.1 -z 127.0.0.1:53021 \
+  --generate "{rand:8}.example.com A" -r 1000 -l 2 >test3.out
+grep "DNS RCODES: NAME: " test3.out
+grep "# Listening on 127.0.0.1 port 53021 with Threads: 2, rcode: NXDOMAIN" test3-responder.out
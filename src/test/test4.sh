@@ -0,0 +1,93 @@
+#!/bin/sh -e
+
+# End-to-end throughput of dnsmeter against dnsmeter-responder over a veth
+# pair between two network namespaces, so no external network is needed.
+# Every engine is run at increasing rates and the achieved queries per
+# second, the loss and the CPU usage of dnsmeter are written to test4.out.
+# The tcp and dot engines are not covered, dnsmeter-responder only
+# answers over UDP.
+#
+# Needs root and iproute2, otherwise the test is skipped. Settings:
+#
+#   E2E_ENGINES   engines to test (default "raw udp")
+#   E2E_RATES     comma separated query rates (default 10000,50000,100000)
+#   E2E_RUNTIME   seconds per rate (default 2)
+#   E2E_THREADS   sender threads and responder threads (default 2)
+#   E2E_MAX_LOSS  maximum loss in percent at every rate (default 1)
+#   E2E_MIN_QPS   minimum received qps at the highest rate (default 0)
+
+engines=${E2E_ENGINES:-raw udp}
+rates=${E2E_RATES:-10000,50000,100000}
+runtime=${E2E_RUNTIME:-2}
+threads=${E2E_THREADS:-2}
+max_loss=${E2E_MAX_LOSS:-1}
+min_qps=${E2E_MIN_QPS:-0}
+
+if [ "$(id -u)" != 0 ] || ! command -v ip >/dev/null 2>&1; then
+    echo "needs root and iproute2, skipped"
+    exit 77
+fi
+
+gen=dnsmeter-gen-$$
+resp=dnsmeter-resp-$$
+responder=
+cleanup() {
+    if [ -n "$responder" ]; then
+        kill $responder 2>/dev/null || true
+    fi
+    ip netns del $gen 2>/dev/null || true
+    ip netns del $resp 2>/dev/null || true
+}
+trap cleanup EXIT
+
+if ! ip netns add $gen; then
+    echo "could not create network namespace, skipped"
+    exit 77
+fi
+ip netns add $resp
+ip link add veth-gen netns $gen type veth peer name veth-resp netns $resp
+ip -n $gen addr add 198.18.0.1/24 dev veth-gen
+ip -n $resp addr add 198.18.0.2/24 dev veth-resp
+ip -n $gen link set lo up
+ip -n $gen link set veth-gen up
+ip -n $resp link set lo up
+ip -n $resp link set veth-resp up
+
+set -x
+ip netns exec $resp ../dnsmeter-responder -b 198.18.0.2:53 -n $threads >test4-responder.out &
+responder=$!
+sleep 1
+
+# cpu seconds (user + system) of all finished child processes
+child_cpu() {
+    times >test4.times
+    awk 'NR == 2 { split($1, u, /[ms]/); split($2, s, /[ms]/);
+        printf "%0.2f\n", u[1] * 60 + u[2] + s[1] * 60 + s[2] }' test4.times
+}
+
+echo "#engine;rate;qps send;qps rcv;loss %;cpu %" >test4.out
+steps=$(echo $rates | tr ',' ' ' | wc -w)
+for engine in $engines; do
+    rm -f test4-$engine.csv
+    before=$(child_cpu)
+    ip netns exec $gen ../dnsmeter --engine $engine -q 198.18.0.1 -z 198.18.0.2:53 \
+      --generate "{rand:8}.example.com A" -n $threads -r $rates -l $runtime \
+      -c test4-$engine.csv >test4-$engine.log
+    after=$(child_cpu)
+    # the cpu usage is the average over all rates of the engine
+    awk -F';' -v engine=$engine -v rates=$rates -v steps=$steps -v runtime=$runtime \
+      -v cpu="$before $after" '
+        BEGIN { split(rates, r, ","); split(cpu, c, " ");
+            usage = (c[2] - c[1]) * 100 / (steps * runtime) }
+        !/^#/ { n++; printf "%s;%s;%s;%s;%s;%0.1f\n", engine, r[n], $1, $2, $4, usage }' \
+      test4-$engine.csv >>test4.out
+done
+cat test4.out
+
+# every rate of every engine must have been measured
+[ $(grep -vc '^#' test4.out) -eq $(($(echo $engines | wc -w) * steps)) ]
+awk -F';' -v max_loss=$max_loss '!/^#/ && $5 > max_loss { print "loss too high: " $0; bad = 1 }
+    END { exit bad }' test4.out
+awk -F';' -v min_qps=$min_qps -v last=$(echo $rates | tr ',' '\n' | tail -1) \
+  '!/^#/ && $2 == last && $4 < min_qps { print "qps too low: " $0; bad = 1 }
+    END { exit bad }' test4.out
@@ -0,0 +1,4 @@
+#!/bin/sh -xe
+
+# every checksum implementation the CPU supports against the scalar one
+../checksum-test
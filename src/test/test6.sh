@@ -0,0 +1,14 @@
+#!/bin/sh -xe
+
+# pcap payloads with other link types than Ethernet, VLAN tags, IP options
+# and IPv6 extension headers, and pcapng
+check() {
+    ../dnsmeter --engine udp -q 127.0.0.1 -z 127.0.0.1:53061 \
+      -p "$srcdir/$1" -r 100 -l 1 >test6.out
+    grep "Packets read from pcap file: $2, valid UDP DNS queries: $3" test6.out
+}
+
+check vlan.pcap 6 3
+check sll.pcap 3 2
+check raw.pcap 3 2
+check ethernet.pcapng 2 2
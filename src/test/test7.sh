@@ -0,0 +1,34 @@
+#!/bin/sh -xe
+
+# control socket: change the rate, take a snapshot and end both load steps
+# early, the session must not run the full 60 seconds per step
+
+if ! command -v socat >/dev/null 2>&1; then
+    echo "needs socat, skipped"
+    exit 77
+fi
+
+control() {
+    echo "$1" | socat -t 2 - UNIX-CONNECT:test7.sock
+}
+
+rm -f test7.sock
+../dnsmeter --engine udp -q 127.0.0.1 -z 127.0.0.1:53061 \
+  --generate "{rand:8}.example.com A" -r 100,200 -l 60 -t 1 \
+  --control test7.sock >test7.out &
+pid=$!
+trap "kill $pid 2>/dev/null || true" EXIT
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S test7.sock ] && break
+    sleep 1
+done
+sleep 2
+control "RATE 500" | grep "^OK$"
+control STATS | grep "^OK send=[1-9]"
+control FOO | grep "^ERROR"
+control END | grep "^OK$"
+sleep 3
+control END | grep "^OK$"
+wait $pid
+grep "# Control: RATE 500" test7.out
+grep "Queryrate: 200" test7.out
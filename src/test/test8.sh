@@ -0,0 +1,12 @@
+#!/bin/sh -xe
+
+# warm-up before every load step, the results report the measurement
+# window without it
+rm -f test8.csv
+../dnsmeter --engine udp -q 127.0.0.1 -z 127.0.0.1:53061 \
+  --generate "{rand:8}.example.com A" -r 100,200 -l 2 -t 1 --warmup 1 \
+  -c test8.csv >test8.out
+[ $(grep -c "# Warm-up ended after 1\.[0-9]* s, measuring for 2 s" test8.out) -eq 2 ]
+[ $(grep -c "^Measured from [0-9.]* for 2\.[0-9]* s after 1\.[0-9]* s warm-up$" test8.out) -eq 2 ]
+# start and duration of the window are the last columns of the CSV-file
+[ $(awk -F';' '!/^#/ && $9 >= 2 && $9 < 2.5 { n++ } END { print n }' test8.csv) -eq 2 ]
@@ -0,0 +1,20 @@
+#!/bin/sh -e
+
+# the default raw engine against dnsmeter-responder on the loopback
+# interface, the raw sockets need root
+if [ "$(id -u)" != 0 ]; then
+    echo "needs root, skipped"
+    exit 77
+fi
+
+set -x
+../dnsmeter-responder -b 127.0.0.1:53091 -n 1 >test9-responder.out &
+responder=$!
+trap "kill $responder" EXIT
+sleep 1
+
+../dnsmeter -q 127.0.0.1 -z 127.0.0.1:53091 -e lo \
+  --generate "{rand:8}.example.com A" -r 100 -l 1 >test9.out
+grep "# Start Session with Threads: 1, Queryrate: 100" test9.out
+# at least some queries went out of the raw socket
+grep "DNS Queries send: " test9.out | awk '{ exit !($4 > 0) }'
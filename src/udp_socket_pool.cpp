@@ -0,0 +1,362 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "udp_socket_pool.h"
+#include "query.h"
+#include "exceptions.h"
+
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+static socklen_t make_sockaddr(const ppl7::IPAddress& ip, int port, struct sockaddr_storage& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    if (ip.family() == ppl7::IPAddress::IPv6) {
+        ip.toSockAddr(&addr, sizeof(struct sockaddr_in6));
+        ((struct sockaddr_in6*)&addr)->sin6_port = htons(port);
+        return sizeof(struct sockaddr_in6);
+    }
+    if (ip.family() != ppl7::IPAddress::IPv4)
+        throw UnsupportedIPFamily();
+    ip.toSockAddr(&addr, sizeof(struct sockaddr_in));
+    ((struct sockaddr_in*)&addr)->sin_port = htons(port);
+    return sizeof(struct sockaddr_in);
+}
+
+UDPSocketPool::UDPSocketPool()
+{
+    sockets    = NULL;
+    numSockets = 0;
+    nextSocket = 0;
+#ifndef HAVE_SYS_EPOLL_H
+    pollfds = NULL;
+#endif
+    epfd         = -1;
+    pending      = 0;
+    overhead     = 0;
+    targets      = NULL;
+    remote       = NULL;
+    addrlen      = 0;
+    connected    = false;
+    classes      = NULL;
+    classCounter = NULL;
+    phases       = NULL;
+    sendBuffer   = (unsigned char*)malloc(BATCH * MAXQUERYSIZE);
+    recvBuffer   = (unsigned char*)malloc(BATCH * MAXQUERYSIZE);
+    if (!sendBuffer || !recvBuffer) {
+        free(sendBuffer);
+        free(recvBuffer);
+        throw ppl7::OutOfMemoryException();
+    }
+    memset(sendIov, 0, sizeof(sendIov));
+    memset(recvIov, 0, sizeof(recvIov));
+    memset(queryRef, 0, sizeof(queryRef));
+    for (int i = 0; i < BATCH; i++) {
+        sendIov[2 * i].iov_base = sendBuffer + i * MAXQUERYSIZE;
+        recvIov[i].iov_base     = recvBuffer + i * MAXQUERYSIZE;
+        recvIov[i].iov_len  = MAXQUERYSIZE;
+    }
+#ifdef HAVE_SENDMMSG
+    memset(sendMsg, 0, sizeof(sendMsg));
+    for (int i = 0; i < BATCH; i++) {
+        sendMsg[i].msg_hdr.msg_iov    = &sendIov[2 * i];
+        sendMsg[i].msg_hdr.msg_iovlen = 1;
+    }
+#endif
+#ifdef HAVE_RECVMMSG
+    memset(recvMsg, 0, sizeof(recvMsg));
+    for (int i = 0; i < BATCH; i++) {
+        recvMsg[i].msg_hdr.msg_iov    = &recvIov[i];
+        recvMsg[i].msg_hdr.msg_iovlen = 1;
+        recvMsg[i].msg_hdr.msg_name   = &recvAddr[i];
+    }
+#endif
+}
+
+UDPSocketPool::~UDPSocketPool()
+{
+    close();
+    free(sendBuffer);
+    free(recvBuffer);
+}
+
+void UDPSocketPool::open(const ppl7::IPAddress& source, const TargetList& targets, int count)
+{
+    if (source.family() != targets.family())
+        throw UnsupportedIPFamily("source and destination must be of the same address family");
+    if (count < 1 || targets.size() < 1)
+        throw ppl7::InvalidArgumentsException();
+    close();
+    sockets = (int*)calloc(count, sizeof(int));
+    remote  = (struct sockaddr_storage*)calloc(targets.size(), sizeof(struct sockaddr_storage));
+    if (!sockets || !remote)
+        throw ppl7::OutOfMemoryException();
+#ifndef HAVE_SYS_EPOLL_H
+    pollfds = (struct pollfd*)calloc(count, sizeof(struct pollfd));
+    if (!pollfds)
+        throw ppl7::OutOfMemoryException();
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+    if ((epfd = epoll_create1(0)) < 0)
+        ppl7::throwExceptionFromErrno(errno, "Could not create epoll instance");
+#endif
+    struct sockaddr_storage local;
+    addrlen = make_sockaddr(source, 0, local);
+    for (size_t t = 0; t < targets.size(); t++)
+        make_sockaddr(targets[t].ip, targets[t].port, remote[t]);
+    this->targets = &targets;
+    connected     = (targets.size() == 1);
+#ifdef HAVE_SENDMMSG
+    for (int i = 0; i < BATCH; i++)
+        sendMsg[i].msg_hdr.msg_namelen = connected ? 0 : addrlen;
+#endif
+    // Sizes are counted like on the raw socket path, including IP and UDP header
+    overhead = sizeof(struct udphdr) + ((source.family() == ppl7::IPAddress::IPv6) ? 40 : sizeof(struct ip));
+    while (numSockets < count) {
+        int sd = socket(local.ss_family, SOCK_DGRAM, 0);
+        if (sd < 0)
+            ppl7::throwExceptionFromErrno(errno, "Could not create UDP socket");
+        sockets[numSockets++] = sd;
+        int rcvbuf            = 4 * 1024 * 1024;
+        setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        if (bind(sd, (const struct sockaddr*)&local, addrlen) < 0)
+            ppl7::throwExceptionFromErrno(errno, "Could not bind UDP socket");
+        if (connected && ::connect(sd, (const struct sockaddr*)&remote[0], addrlen) < 0)
+            ppl7::throwExceptionFromErrno(errno, "Could not connect UDP socket");
+#ifdef HAVE_SYS_EPOLL_H
+        struct epoll_event ev;
+        ev.events  = EPOLLIN;
+        ev.data.fd = sd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, sd, &ev) < 0)
+            ppl7::throwExceptionFromErrno(errno, "Could not add UDP socket to epoll");
+#else
+        pollfds[numSockets - 1].fd     = sd;
+        pollfds[numSockets - 1].events = POLLIN;
+#endif
+    }
+    nextSocket = 0;
+    pending    = 0;
+}
+
+void UDPSocketPool::close()
+{
+    for (int i = 0; i < numSockets; i++)
+        ::close(sockets[i]);
+    free(sockets);
+    free(remote);
+    sockets    = NULL;
+    remote     = NULL;
+    numSockets = 0;
+#ifndef HAVE_SYS_EPOLL_H
+    free(pollfds);
+    pollfds = NULL;
+#endif
+    if (epfd >= 0)
+        ::close(epfd);
+    epfd    = -1;
+    pending = 0;
+}
+
+int UDPSocketPool::queued() const
+{
+    return pending;
+}
+
+size_t UDPSocketPool::size(int i) const
+{
+    return querySize[i] + overhead;
+}
+
+unsigned short UDPSocketPool::id(int i) const
+{
+    return queryId[i];
+}
+
+int UDPSocketPool::target(int i) const
+{
+    return queryTarget[i];
+}
+
+void UDPSocketPool::clear()
+{
+    pending = 0;
+}
+
+/*
+ * Sends the queued queries from index first on, on the next socket of the
+ * pool, and returns the number of queries which have been sent, counted
+ * from the start of the queue. If this is less than queued(), errno
+ * contains the reason why the rest was not sent and the flush can be
+ * resumed from there. The queue is not cleared, so that the caller can
+ * account for every query.
+ */
+int UDPSocketPool::flush(int first)
+{
+    if (first >= pending)
+        return pending;
+    int sd     = sockets[nextSocket];
+    nextSocket = (nextSocket + 1) % numSockets;
+    int done   = first;
+    for (int i = first; i < pending; i++) {
+        struct iovec* iov = &sendIov[2 * i];
+        if (queryRef[i]) {
+            iov[0].iov_len  = 2;
+            iov[1].iov_base = (void*)(queryRef[i] + 2);
+            iov[1].iov_len  = querySize[i] - 2;
+            iovCount[i]     = 2;
+        } else {
+            iov[0].iov_len = querySize[i];
+            iovCount[i]    = 1;
+        }
+#ifdef HAVE_SENDMMSG
+        sendMsg[i].msg_hdr.msg_iovlen = iovCount[i];
+        if (!connected)
+            sendMsg[i].msg_hdr.msg_name = &remote[queryTarget[i]];
+#endif
+    }
+    while (done < pending) {
+#ifdef HAVE_SENDMMSG
+        int n = sendmmsg(sd, sendMsg + done, pending - done, 0);
+#else
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov    = &sendIov[2 * done];
+        msg.msg_iovlen = iovCount[done];
+        if (!connected) {
+            msg.msg_name    = &remote[queryTarget[done]];
+            msg.msg_namelen = addrlen;
+        }
+        int n = (sendmsg(sd, &msg, 0) < 0) ? -1 : 1;
+#endif
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+void UDPSocketPool::setQueryClasses(const QueryClasses* classes, CounterBlock<QueryClassCounter>* counter)
+{
+    this->classes = classes;
+    classCounter  = counter;
+}
+
+void UDPSocketPool::setPhaseTimer(PhaseTimer* phases)
+{
+    this->phases = phases;
+}
+
+int UDPSocketPool::findTarget(const struct sockaddr_storage& addr) const
+{
+    if (addr.ss_family == AF_INET6) {
+        const struct sockaddr_in6* a = (const struct sockaddr_in6*)&addr;
+        return targets->find(&a->sin6_addr, a->sin6_port);
+    }
+    const struct sockaddr_in* a = (const struct sockaddr_in*)&addr;
+    return targets->find(&a->sin_addr, a->sin_port);
+}
+
+void UDPSocketPool::drain(int sd, StepCounters<RawSocketReceiver::Counter>& counter, ConcurrencyWindow* window, int lane)
+{
+    while (1) {
+#ifdef HAVE_RECVMMSG
+        for (int i = 0; i < BATCH; i++)
+            recvMsg[i].msg_hdr.msg_namelen = connected ? 0 : sizeof(struct sockaddr_storage);
+        int n = recvmmsg(sd, recvMsg, BATCH, MSG_DONTWAIT, NULL);
+#else
+        socklen_t namelen = sizeof(struct sockaddr_storage);
+        ssize_t   len     = recvfrom(sd, recvIov[0].iov_base, MAXQUERYSIZE, MSG_DONTWAIT,
+            (struct sockaddr*)&recvAddr[0], &namelen);
+        int n = len < 0 ? -1 : 1;
+#endif
+        if (n <= 0)
+            return;
+        for (int i = 0; i < n; i++) {
+#ifdef HAVE_RECVMMSG
+            size_t len = recvMsg[i].msg_len;
+#endif
+            if (len < sizeof(struct DNS_HEADER))
+                continue;
+            // a socket which is not connected receives from anybody
+            int t = connected ? 0 : findTarget(recvAddr[i]);
+            if (t < 0)
+                continue;
+            const unsigned char* payload = (const unsigned char*)recvIov[i].iov_base;
+            unsigned short       id      = ntohs(((const struct DNS_HEADER*)payload)->id);
+            double               rd      = getQueryRTT(id);
+            int                  s       = counter.slot(id);
+            if (window)
+                window->release(lane, id);
+            counter[s][t].beginUpdate().add(payload, len + overhead, rd);
+            counter[s][t].endUpdate();
+            if (classes) {
+                classCounter[s].beginUpdate().add(classes->classify(payload, len), payload, rd);
+                classCounter[s].endUpdate();
+            }
+        }
+        if (n < BATCH)
+            return;
+    }
+}
+
+/*
+ * Reads all responses which are waiting on any socket of the pool. Waits
+ * up to timeout_ms milliseconds if there is nothing to read.
+ */
+void UDPSocketPool::receive(StepCounters<RawSocketReceiver::Counter>& counter, ConcurrencyWindow* window, int lane, int timeout_ms)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event events[64];
+    int                n = epoll_wait(epfd, events, 64, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        // waiting for the sockets is not part of the receive phase
+        bool timed = phases && phases->begin();
+        drain(events[i].data.fd, counter, window, lane);
+        if (timed)
+            phases->mark(PhaseTimer::RECEIVE);
+    }
+#else
+    if (poll(pollfds, numSockets, timeout_ms) <= 0)
+        return;
+    for (int i = 0; i < numSockets; i++) {
+        if (pollfds[i].revents & POLLIN) {
+            bool timed = phases && phases->begin();
+            drain(pollfds[i].fd, counter, window, lane);
+            if (timed)
+                phases->mark(PhaseTimer::RECEIVE);
+        }
+    }
+#endif
+}
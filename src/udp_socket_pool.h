@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2019-2021, OARC, Inc.
+ * Copyright (c) 2019, DENIC eG
+ * All rights reserved.
+ *
+ * This file is part of dnsmeter.
+ *
+ * dnsmeter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnsmeter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dnsmeter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "raw_socket_receiver.h"
+#include "concurrency_window.h"
+#include "seqlock.h"
+#include "target_list.h"
+#include "phase_timer.h"
+
+#include <ppl7.h>
+#include <ppl7-inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#ifndef HAVE_SYS_EPOLL_H
+#include <poll.h>
+#endif
+
+#ifndef __dnsmeter_udp_socket_pool_h
+#define __dnsmeter_udp_socket_pool_h
+
+/*
+ * Sends queries over ordinary UDP sockets, which does not need any
+ * privileges but can not spoof the sender address.
+ *
+ * Every socket is bound to its own ephemeral port. With a single target
+ * the sockets are connected to it, so the kernel only delivers responses
+ * of the target. With several targets every query carries the address of
+ * its target and responses are attributed to a target by their source
+ * address, everything else is dropped.
+ * Queries are collected in a batch and sent with sendmmsg on the next
+ * socket of the pool, responses are read with recvmmsg from all sockets
+ * which epoll reports as readable.
+ */
+class UDPSocketPool {
+private:
+#if defined(__GXX_EXPERIMENTAL_CXX0X__) || __cplusplus >= 201103L
+    UDPSocketPool& operator=(const UDPSocketPool& other);
+    UDPSocketPool(UDPSocketPool &&other) noexcept;
+    UDPSocketPool const & operator=(UDPSocketPool &&other);
+#endif
+
+public:
+    enum {
+        BATCH        = 32,
+        MAXQUERYSIZE = 4096
+    };
+
+private:
+    int*           sockets;
+    int            numSockets;
+    int            nextSocket;
+    int            epfd;
+#ifndef HAVE_SYS_EPOLL_H
+    struct pollfd* pollfds;
+#endif
+    int            pending;
+    size_t         overhead;
+    unsigned char* sendBuffer;
+    unsigned char* recvBuffer;
+    size_t         querySize[BATCH];
+    unsigned short queryId[BATCH];
+    int            queryTarget[BATCH];
+    int            iovCount[BATCH];
+    struct iovec   sendIov[2 * BATCH];
+    struct iovec   recvIov[BATCH];
+
+    const unsigned char* queryRef[BATCH];
+
+    const TargetList*                targets;
+    struct sockaddr_storage*         remote;
+    socklen_t                        addrlen;
+    bool                             connected;
+    struct sockaddr_storage          recvAddr[BATCH];
+    const QueryClasses*              classes;
+    CounterBlock<QueryClassCounter>* classCounter;
+    PhaseTimer*                      phases;
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr sendMsg[BATCH];
+#endif
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr recvMsg[BATCH];
+#endif
+
+    int  findTarget(const struct sockaddr_storage& addr) const;
+    void drain(int sd, StepCounters<RawSocketReceiver::Counter>& counter, ConcurrencyWindow* window, int lane);
+
+public:
+    UDPSocketPool();
+    ~UDPSocketPool();
+    void open(const ppl7::IPAddress& source, const TargetList& targets, int count);
+    void close();
+    void setQueryClasses(const QueryClasses* classes, CounterBlock<QueryClassCounter>* counter);
+    void setPhaseTimer(PhaseTimer* phases);
+
+    /*
+     * Returns the buffer for the next query of the batch, the query is
+     * added to the batch with queue().
+     */
+    inline unsigned char* queryBuffer()
+    {
+        return sendBuffer + pending * MAXQUERYSIZE;
+    }
+
+    inline void queue(size_t size, unsigned short id, int target)
+    {
+        querySize[pending]   = size;
+        queryId[pending]     = id;
+        queryTarget[pending] = target;
+        queryRef[pending]    = NULL;
+        pending++;
+    }
+
+    /*
+     * Adds a query which is sent in place from query, only the DNS ID is
+     * put into the buffer of the batch. The query must not change until
+     * the batch is flushed.
+     */
+    inline void queueReference(const unsigned char* query, size_t size, unsigned short id, int target)
+    {
+        *((unsigned short*)queryBuffer()) = htons(id);
+        querySize[pending]                = size;
+        queryId[pending]                  = id;
+        queryTarget[pending]              = target;
+        queryRef[pending]                 = query;
+        pending++;
+    }
+
+    inline bool full() const
+    {
+        return pending == BATCH;
+    }
+
+    int    queued() const;
+    size_t size(int i) const;
+    unsigned short id(int i) const;
+    int    target(int i) const;
+    int    flush(int first = 0);
+    void   clear();
+    void   receive(StepCounters<RawSocketReceiver::Counter>& counter, ConcurrencyWindow* window, int lane, int timeout_ms);
+};
+
+#endif